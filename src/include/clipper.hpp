@@ -0,0 +1,74 @@
+#ifndef CLIPPER_H
+#define CLIPPER_H
+
+#include <cstdint>
+#include "geometry.hpp"
+
+// Homogeneous clip space clipping, done before the perspective divide.
+// A clip space point (x, y, z, w) is inside the view frustum when
+//   0 <= z <= w   and   -w <= x, y <= w
+// which for the projection built by makeProjectionMatrix puts z = 0 on the
+// near plane and z = w on the far plane.
+enum clipPlane
+{
+    CLIP_NEAR,
+    CLIP_FAR,
+    CLIP_LEFT,
+    CLIP_RIGHT,
+    CLIP_BOTTOM,
+    CLIP_TOP,
+    CLIP_PLANE_COUNT
+};
+
+// The side planes are only clipped against at GUARD_BAND times the view
+// size. Triangles poking out of the screen but staying inside that band
+// go straight to the rasterizer, which clamps them to the target anyway,
+// so only triangles that are huge on screen or cross the near or far
+// plane ever get clipped.
+const float GUARD_BAND = 4.0f;
+
+// Sutherland-Hodgman adds at most one vertex per plane
+const int MAX_CLIP_VERTS = 3 + CLIP_PLANE_COUNT;
+
+// Outcode bits from clipOutcode. Bit p of the low byte is set when the
+// point is outside frustum plane p, used to reject whole triangles. Bit p
+// of the second byte is set when the point is outside the plane the
+// clipper actually uses, the guard band one for the side planes.
+const uint32_t CLIP_OUTSIDE_MASK = 0x3f;
+const uint32_t CLIP_GUARD_SHIFT = 8;
+const uint32_t CLIP_GUARD_MASK = CLIP_OUTSIDE_MASK << CLIP_GUARD_SHIFT;
+
+// Most triangles one clipped triangle is counted as in clipResults
+const int CLIP_RESULT_BUCKETS = 4;
+
+// What the clipper did, summed per frame. planeClips counts how often a
+// polygon actually crossed each plane, clipResults how many clipped
+// triangles came out as 0, 1, 2 or more triangles. backfacing triangles
+// never reach the clipper.
+struct clipStats
+{
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t backfacing = 0;
+    uint64_t clipped = 0;
+    uint64_t planeClips[CLIP_PLANE_COUNT] = { 0 };
+    uint64_t clipResults[CLIP_RESULT_BUCKETS] = { 0 };
+
+    void add(const clipStats &other);
+};
+
+extern uint32_t clipOutcode(float x, float y, float z, float w);
+
+// Clips the triangle in[0..2] against every plane whose guard bit is set
+// in codes (the OR of the three vertex outcodes). The convex result is
+// written to out, working entirely in fixed size stack buffers, and its
+// vertex count returned, 0 when nothing is left. Edges are always split
+// from their inside end, so two triangles sharing an edge get bit
+// identical new vertices and no cracks.
+extern int clipTriangle(const vec3d in[3], uint32_t codes, vec3d out[MAX_CLIP_VERTS], clipStats &stats);
+
+// Perspective divide and viewport mapping for one clip space vertex,
+// matching projectVertices: x/y in pixels, z after the divide, w kept
+extern vec3d clipToScreen(const vec3d &c, const viewport &vp);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+// Option values of graph and its tools. Each must be the whole argument:
+// trailing text, a sign where none belongs or a value out of range fails
+// instead of being cut short or wrapped around.
+
+// A whole number from 0 to max
+extern bool parseCount(const char *text, unsigned max, unsigned &value);
+
+// A finite number from min to max
+extern bool parseNumber(const char *text, float min, float max, float &value);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef DEPTH_SORT_H
+#define DEPTH_SORT_H
+
+#include <cstdint>
+#include <vector>
+#include "geometry.hpp"
+
+struct threadPool;
+
+// Back to front ordering for the painter's algorithm. Every triangle gets
+// one integer key from its summed screen z, computed once, and the keys
+// are put in order by a stable LSD radix sort, 8 bits per pass. Passes
+// where every key has the same digit are skipped. With a pool, histograms
+// and scatters run in parallel chunks with per-chunk offsets, so the
+// order is the same for any thread count. All scratch buffers are kept
+// and reused from frame to frame. The sorted triangles are swapped into
+// tris, so keeping tris alive across frames lets both buffers be reused.
+struct depthSorter
+{
+    threadPool *pool = nullptr;
+
+    void sort(std::vector<triangle> &tris);
+
+    // Bytes held by the scratch buffers, the high-water mark of sorting
+    size_t scratchBytes() const;
+
+private:
+    std::vector<uint32_t> keys, keysTmp;
+    std::vector<uint32_t> order, orderTmp;
+    std::vector<uint32_t> counts;
+    std::vector<triangle> sorted;
+};
+
+// Maps a float to an unsigned integer with the same ordering
+extern uint32_t floatSortKey(float f);
+
+#endif
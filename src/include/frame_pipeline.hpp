@@ -0,0 +1,83 @@
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pipeline.hpp"
+#include "scene.hpp"
+
+// Runs a geometry stage on a thread of its own, so the geometry of later
+// frames overlaps rasterizing and presenting earlier ones and a frame
+// costs about as much as its slowest stage instead of the sum of them.
+//
+// The caller submits the inputs of a frame and later takes its result,
+// oldest first. Up to latency frames are queued or in flight behind the
+// one the caller holds, every one with its own triangle list, so input
+// reaches the screen latency frames later than in a serial loop. Give the
+// stage a pool of its own: a threadPool takes one caller at a time. An
+// optional scene stage adds the instances of a frame's scene after the
+// mesh, on the same thread.
+// Most frames of latency a pipeline takes, larger requests are capped.
+// Each one holds a frame's triangles and delays input by a frame.
+const unsigned MAX_PIPELINE_LATENCY = 8;
+
+struct framePipeline
+{
+    // One frame's output, with the stage's counters of that run
+    struct frame
+    {
+        std::vector<triangle> triangles;
+        cullStats cull;
+        clipStats clip;         // of the mesh and the instances together
+        sceneStats instances;
+        stageTimes times;
+        viewport vp;            // the triangles' pixel space, the frame's render size
+
+        // False when the inputs matched the frame before, which left
+        // triangles untouched, stale, and whatever was drawn from the
+        // frame before still good
+        bool changed = false;
+    };
+
+    framePipeline(geometryStage &stage, unsigned latency, sceneStage *instanceStage = nullptr);
+    ~framePipeline();
+    framePipeline(const framePipeline &) = delete;
+    framePipeline &operator=(const framePipeline &) = delete;
+
+    unsigned latency() const { return (unsigned)slots.size() - 1; }
+
+    // Queues a frame, waiting while latency frames are already queued.
+    // m and instances must stay alive and unchanged until the frame is
+    // taken.
+    void submit(const mesh &m, const frameParams &params, const scene *instances = nullptr);
+
+    // Waits for the oldest submitted frame and hands it over. It stays
+    // valid until the next take, which gives its slot back. At least one
+    // frame must have been submitted and not taken yet.
+    frame &take();
+
+private:
+    struct slot
+    {
+        const mesh *m = nullptr;
+        const scene *instances = nullptr;
+        frameParams params;
+        frame result;
+    };
+
+    geometryStage &stage;
+    sceneStage *instanceStage;
+    std::vector<slot> slots;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable submitted, finished, released;
+    uint64_t submitCount = 0, finishCount = 0, takeCount = 0;
+    bool stopping = false;
+
+    void workerLoop();
+};
+
+#endif
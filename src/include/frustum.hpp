@@ -0,0 +1,36 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <cstdint>
+#include "geometry.hpp"
+
+// View frustum as six planes a*x + b*y + c*z + d >= 0, in whatever space
+// the matrix it was made from starts in. Built from world * view *
+// projection it tests object space boxes directly, without transforming
+// any vertex. Plane order follows clipPlane.
+struct frustum
+{
+    float planes[6][4];
+};
+
+enum cullResult
+{
+    CULL_OUTSIDE,
+    CULL_INTERSECTS,
+    CULL_INSIDE
+};
+
+// All six planes, for the planeMask argument of testBox
+const uint32_t FRUSTUM_ALL_PLANES = 0x3f;
+
+extern frustum makeFrustum(const mat4x4 &m);
+
+// Tests the box against the planes whose bit is set in planeMask and
+// clears the bits of planes the box is entirely inside of, so children
+// of a box only need testing against what is left
+extern cullResult testBox(const frustum &f, const float boxMin[3], const float boxMax[3], uint32_t &planeMask);
+
+// Tests a sphere against all six planes
+extern cullResult testSphere(const frustum &f, const float center[3], float radius);
+
+#endif
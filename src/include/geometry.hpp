@@ -2,15 +2,9 @@
 #define GEOMETRY_H
 
 #include <SFML/Graphics.hpp>
+#include <cstdint>
 #include <vector>
-
-struct vec3d
-{
-    float x = 0;
-    float y = 0;
-    float z = 0;
-    float w = 1;
-};
+#include "vecmath.hpp"
 
 struct triangle
 {
@@ -18,36 +12,86 @@ struct triangle
     sf::Color color;
 };
 
-struct mesh
+// Read-only structure-of-arrays positions, one contiguous array per
+// component. Positions are points, so w is implicitly 1. The arrays may
+// belong to a vertexStream or live inside a memory mapped mesh file.
+struct vertexSpan
+{
+    const float *x = nullptr;
+    const float *y = nullptr;
+    const float *z = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    vec3d get(size_t i) const { return { x[i], y[i], z[i] }; }
+    vertexSpan slice(size_t first, size_t n) const;
+};
+
+// Bytes reserved by v, used or not
+template <typename T>
+size_t capacityBytes(const std::vector<T> &v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+// Owned structure-of-arrays vertices. Each component lives in its own
+// contiguous array so the batch kernels below can load 4 or 8 vertices
+// per instruction instead of gathering them out of vec3d structs.
+struct vertexStream
+{
+    std::vector<float> x, y, z, w;
+
+    size_t size() const { return x.size(); }
+    void resize(size_t n);
+    void clear();
+    size_t capacityBytes() const;
+    void push_back(const vec3d &v);
+    vec3d get(size_t i) const;
+    vertexSpan span() const;
+};
+
+// Target size in pixels for the viewport mapping done after the divide
+struct viewport
 {
-    std::vector<triangle> tris;
-    bool loadFromObjFile(std::string filename);
+    float width = 0;
+    float height = 0;
 };
 
-struct mat4x4
+// Where the segment crosses the plane through planeP with normal planeN
+extern vec3d intersectPlane(const vec3d &planeP, const vec3d &planeN, const vec3d &lineStart, const vec3d &lineEnd);
+
+// Batch kernels over whole vertex streams. The best instruction set the
+// CPU supports (AVX2+FMA, SSE, or plain scalar) is picked on first use.
+// transformVertices applies m to every position (w = 1), typically a
+// combined world * view * projection matrix into clip space.
+// projectVertices takes such clip space vertices through the perspective
+// divide and viewport mapping, without touching the matrix again: out x/y
+// are pixels, out z is depth after the divide and out w keeps the clip
+// space w (view z), so callers can still spot vertices that need near
+// plane clipping. The ranged overloads only touch vertices [first, last)
+// and expect out to already hold as many vertices as the input, so
+// several threads can fill disjoint ranges of one stream.
+extern void transformVertices(const mat4x4 &m, const vertexSpan &in, vertexStream &out);
+extern void transformVertices(const mat4x4 &m, const vertexSpan &in, vertexStream &out, size_t first, size_t last);
+extern void projectVertices(const viewport &vp, const vertexStream &clip, vertexStream &out);
+extern void projectVertices(const viewport &vp, const vertexStream &clip, vertexStream &out, size_t first, size_t last);
+extern const char *vertexKernelName();
+
+// The ranged transform and project of one instruction set
+struct vertexKernels
 {
-    float m[4][4] = { 0 };
+    void (*transform)(const mat4x4 &, const vertexSpan &, vertexStream &, size_t, size_t);
+    void (*project)(const viewport &, const vertexStream &, vertexStream &, size_t, size_t);
+    const char *name;
 };
 
-extern mat4x4 makeIdentityMatrix();
-extern mat4x4 makeRotatedMatrixX(float angleRad);
-extern mat4x4 makeRotatedMatrixY(float angleRad);
-extern mat4x4 makeRotatedMatrixZ(float angleRad);
-extern mat4x4 makeTranslatedMatrix(float x, float y, float z);
-extern mat4x4 makeProjectionMatrix(float fovDegrees, float aspectRatio, float near, float far);
-extern mat4x4 mulMatrices(mat4x4 &m1, mat4x4 &m2);
-extern mat4x4 pointAt(vec3d &pos, vec3d &forw, vec3d &up);
-extern mat4x4 quickInverse(mat4x4 &m);
-extern vec3d mulMatrixByVector(mat4x4 &m, vec3d &i);
-extern vec3d addVectors(vec3d &v1, vec3d &v2);
-extern vec3d subVectors(vec3d &v1, vec3d &v2);
-extern vec3d mulVector(vec3d &v1, float k);
-extern vec3d divVector(vec3d &v1, float k);
-extern float dotProduct(vec3d &v1, vec3d &v2);
-extern float lenVector(vec3d &v);
-extern vec3d normVector(vec3d &v);
-extern vec3d crossProduct(vec3d &v1, vec3d &v2);
-extern vec3d intersectPlane(vec3d &planeP, vec3d &planeN, vec3d &lineStart, vec3d&lineEnd);
+// Every set of kernels the CPU can run, scalar first, whatever
+// GRAPH_VERTEX_KERNEL picks, so each one can be checked on its own
+extern std::vector<vertexKernels> supportedVertexKernels();
+
+// True when both the CPU and the OS support AVX2 and FMA, always false
+// off x86-64
+extern bool cpuHasAVX2();
 extern int clipAgainstPlane(vec3d planeP, vec3d planeN, triangle &inTri, triangle &outTri1, triangle &outTri2);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only view of a whole file mapped into the address space. Pages are
+// faulted in by the OS as they are touched, nothing is copied up front.
+struct mappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+
+    mappedFile() = default;
+    ~mappedFile();
+    mappedFile(const mappedFile &) = delete;
+    mappedFile &operator=(const mappedFile &) = delete;
+
+    bool open(const std::string &filename);
+    void close();
+
+private:
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "geometry.hpp"
+
+struct mappedFile;
+
+// Read-only view over a contiguous array, see mesh below
+template <typename T>
+struct arrayView
+{
+    const T *ptr = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T *data() const { return ptr; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + count; }
+    const T &operator[](size_t i) const { return ptr[i]; }
+};
+
+// Node of the bounding volume hierarchy built over a mesh at load time.
+// Nodes are stored depth first, so an interior node's first child comes
+// right after it and secondChild points at the other one (0 for leaves,
+// the root is never a child). Every node covers triangles [first, first
+// + count), and the vertices those triangles use all lie in
+// [vertexFirst, vertexLast). Leaves are spatially compact and
+// consecutive leaves use mostly consecutive vertices, small enough to
+// act as clusters for culling.
+//
+// The normal cone bounds the face normals below the node: every one is
+// within acos(coneCos) of coneAxis. A coneCos of -1 means no useful cone.
+// lodChunk is one past the index of the node's entry in mesh::lodChunks,
+// 0 when the node has none.
+struct meshNode
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t first;
+    uint32_t count;
+    uint32_t secondChild;
+    uint32_t vertexFirst;
+    uint32_t vertexLast;
+    float coneAxis[3];
+    float coneCos;
+    uint32_t lodChunk;
+
+    bool isLeaf() const { return secondChild == 0; }
+};
+
+// Most triangles a hierarchy leaf (cluster) holds
+const uint32_t MESH_LEAF_TRIANGLES = 32;
+
+// Most levels of nodes a hierarchy may have, the root being the first.
+// Median splits keep any 32-bit triangle count far below it. Traversals
+// size their stacks by it, and caches with deeper trees are rejected.
+const uint32_t MESH_MAX_DEPTH = 64;
+
+// Simplified version of one LOD chunk, triangles [first, first + count)
+// of mesh::lodIndices. error bounds how far, in object space units, the
+// surface moved from the full resolution one.
+struct meshLodLevel
+{
+    uint32_t first;
+    uint32_t count;
+    float error;
+    uint32_t padding;
+};
+
+// The highest hierarchy nodes with at most MESH_LOD_CHUNK_TRIANGLES are
+// LOD chunks, each with levels [levelFirst, levelFirst + levelCount) of
+// mesh::lodLevels, every one about half the triangles of the one before.
+// Vertices shared with other chunks or on open edges never move, so
+// neighbouring chunks at different levels still meet without cracks.
+struct meshLodChunk
+{
+    uint32_t node;
+    uint32_t levelFirst;
+    uint32_t levelCount;
+    uint32_t padding;
+};
+
+const uint32_t MESH_LOD_CHUNK_TRIANGLES = 1024;
+const uint32_t MESH_LOD_MAX_LEVELS = 4;
+
+// Indexed triangle mesh, every three entries of indices form one triangle
+// and refer to positions shared through verts. faceNormals holds one unit
+// normal per triangle. nodes is a bounding volume hierarchy over the
+// triangles, node 0 being the root. Loading reorders triangles so every
+// leaf is a contiguous range, and vertices by first use.
+//
+// Coarser levels of detail are built per chunk by quadric error edge
+// collapse. They reuse the full resolution vertices and only add index
+// buffers: lodIndices and lodNormals hold their triangles, lodChunks and
+// lodLevels say where each one starts.
+//
+// The public arrays are views. They point either into storage the mesh
+// owns (after loading an OBJ) or straight into a memory mapped binary
+// cache, which is used in place without copying or parsing. Because of
+// that a mesh can be moved but not copied.
+struct mesh
+{
+    vertexSpan verts;
+    arrayView<uint32_t> indices;
+    arrayView<vec3d> faceNormals;
+    arrayView<meshNode> nodes;
+    arrayView<uint32_t> lodIndices;
+    arrayView<vec3d> lodNormals;
+    arrayView<meshLodChunk> lodChunks;
+    arrayView<meshLodLevel> lodLevels;
+    vec3d boundsMin, boundsMax;
+
+    // Changes whenever the mesh is loaded again and differs between
+    // meshes, so results derived from one can tell when they are stale
+    uint64_t version;
+
+    mesh();
+    ~mesh();
+    mesh(mesh &&) noexcept;
+    mesh &operator=(mesh &&) noexcept;
+    mesh(const mesh &) = delete;
+    mesh &operator=(const mesh &) = delete;
+
+    size_t triangleCount() const { return indices.size() / 3; }
+
+    // Loads filename, using the binary cache next to it instead when that
+    // cache exists and is newer. On failure returns false and, if given,
+    // fills error with a readable reason.
+    bool load(const std::string &filename, std::string *error = nullptr);
+
+    // Reads positions and faces from a Wavefront OBJ file. On failure
+    // returns false and, if given, fills error with "file:line: reason".
+    bool loadFromObjFile(const std::string &filename, std::string *error = nullptr);
+
+    // Takes positions and triangles built in memory, such as generated
+    // test meshes. Fails when an index is out of range or the coordinate
+    // arrays differ in length.
+    bool loadFromArrays(std::vector<float> x, std::vector<float> y, std::vector<float> z,
+                        std::vector<uint32_t> triangleIndices, std::string *error = nullptr);
+
+    // Maps a binary cache written by saveToCacheFile
+    bool loadFromCacheFile(const std::string &filename, std::string *error = nullptr);
+    bool saveToCacheFile(const std::string &filename, std::string *error = nullptr) const;
+
+    // Cache file that belongs to an OBJ path ("x.obj" -> "x.gmesh")
+    static std::string cacheFileName(const std::string &objFilename);
+
+private:
+    std::vector<float> ownedX, ownedY, ownedZ;
+    std::vector<uint32_t> ownedIndices;
+    std::vector<vec3d> ownedNormals;
+    std::vector<meshNode> ownedNodes;
+    std::vector<uint32_t> ownedLodIndices;
+    std::vector<vec3d> ownedLodNormals;
+    std::vector<meshLodChunk> ownedLodChunks;
+    std::vector<meshLodLevel> ownedLodLevels;
+    std::unique_ptr<mappedFile> mapping;
+
+    void clear();
+    void finalize();
+    void buildHierarchy();
+    void buildNormalCones();
+    void buildLods();
+};
+
+// On-disk layout of a binary mesh cache. The header is followed by the
+// sections it points to, each aligned to 64 bytes so the arrays can be
+// used straight out of the mapping. Integers and floats are stored in
+// the host (little endian) byte order. checksum is meshCacheChecksum of
+// everything after the header. Indices and ranges are checked against
+// their counts on load, and the hierarchy against the layout meshNode
+// describes.
+struct meshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t checksum;
+    uint64_t xOffset, yOffset, zOffset;
+    uint64_t indexOffset;
+    uint64_t normalOffset;
+    uint64_t nodeOffset;
+    uint32_t nodeCount;
+    uint32_t lodIndexCount;
+    uint64_t lodIndexOffset;
+    uint64_t lodNormalOffset;
+    uint64_t lodChunkOffset;
+    uint64_t lodLevelOffset;
+    uint32_t lodChunkCount;
+    uint32_t lodLevelCount;
+    uint64_t fileSize;
+};
+
+const uint32_t MESH_CACHE_VERSION = 4;
+
+// FNV-1a's offset basis and prime, but folding in eight bytes at a time
+// and only the tail byte by byte, so checking a large cache stays close
+// to memory bandwidth. It is not FNV-1a and matches no FNV-1a tool. It
+// catches truncated and damaged files, not deliberate ones.
+extern uint64_t meshCacheChecksum(const char *data, size_t size);
+
+#endif
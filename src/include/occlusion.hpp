@@ -0,0 +1,63 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "geometry.hpp"
+
+// Pixels per side of a texel of the finest pyramid level, one coverage
+// bit for each of them
+const int HIZ_TEXEL_PIXELS = 4;
+
+// Low resolution depth pyramid for occlusion culling. Occluder triangles,
+// already in screen space, are snapped and tested against pixel centers
+// with the rasterizer's own fill rule, so they cover exactly the pixels
+// it will draw for them. A texel of the finest level holds a depth only
+// once every pixel center in it is covered, the farthest any of the
+// covering triangles reaches within the texel, so it is never nearer than
+// what the rasterizer will draw there. Partly covered texels gather
+// coverage from several triangles until they are full. Every coarser
+// level holds the farthest of the 2x2 texels below it. A screen rectangle
+// whose nearest depth lies behind every texel it touches is hidden.
+struct depthPyramid
+{
+    // Empties the pyramid for a viewport, nothing occludes anything
+    void reset(const viewport &vp);
+
+    // Texel rows of the finest level
+    int rows() const { return levels.empty() ? 0 : levels[0].height; }
+
+    // Draws the part of a triangle within texel rows firstRow..lastRow.
+    // Vertices are in screen space, in front of the near plane and inside
+    // the guard band, either winding; color is ignored. Threads may draw
+    // at the same time into rows no other thread draws into.
+    void drawTriangle(const triangle &tri, int firstRow, int lastRow);
+
+    void build();
+
+    // True when everything within the pixel rectangle at depth minZ or
+    // farther is hidden by what was drawn
+    bool occluded(float minX, float minY, float maxX, float maxY, float minZ) const;
+
+    size_t scratchBytes() const;
+
+private:
+    struct level
+    {
+        int width, height;
+        size_t offset;  // of the first texel in texels
+    };
+
+    int pixelWidth = 0, pixelHeight = 0;
+    std::vector<level> levels;
+    std::vector<float> covered;         // finest level, infinite until full
+    std::vector<uint16_t> partMask;     // pixels covered towards the next full texel
+    std::vector<float> partDepth;       // farthest depth of those
+    std::vector<float> texels;          // every level, finest first
+
+    uint16_t offscreenMask(int tx, int ty) const;
+    void addCoverage(size_t texel, int tx, int ty, uint16_t mask, float z);
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include "clipper.hpp"
+#include "frustum.hpp"
+#include "geometry.hpp"
+#include "mesh.hpp"
+#include "occlusion.hpp"
+
+struct threadPool;
+
+// Everything the geometry stage needs to know about one frame
+struct frameParams
+{
+    mat4x4 matWorld;
+    mat4x4 matView;
+    mat4x4 matProj;
+    vec3d cameraPos;
+    vec3d lightDirection = { 0.0f, 1.0f, -1.0f, 0.0f };
+    viewport vp;
+
+    // Largest screen space error, in pixels, a coarser level of detail may
+    // show. 0 always draws full detail.
+    float lodErrorPixels = 1.0f;
+
+    // Drop hierarchy leaves and LOD chunks hidden behind the nodes that
+    // cover the most of the screen. Off by default: on open terrain the
+    // pyramid hides too little to pay for drawing it.
+    bool occlusionCulling = false;
+
+    // Version stamps the caller bumps whenever the inputs behind them
+    // change: world covers matWorld and lightDirection, view matView and
+    // cameraPos, projection matProj, vp, lodErrorPixels and
+    // occlusionCulling. 0 means not tracked, always treated as changed.
+    uint64_t worldVersion = 0;
+    uint64_t viewVersion = 0;
+    uint64_t projVersion = 0;
+};
+
+// Hierarchy culling counters. Triangles are either skipped with a node
+// outside the frustum, skipped with a node whose normal cone faces away
+// from the camera, skipped with a node hidden behind the occluders, or
+// tested one by one. Tested triangles that survive backface culling and
+// clipping are drawn. Chunks drawn at a coarser level of detail test fewer
+// triangles than they hold, the difference is counted as saved. Occluder
+// triangles are the ones drawn into the depth pyramid.
+struct cullStats
+{
+    uint64_t nodesTested = 0;
+    uint64_t nodesCulled = 0;
+    uint64_t nodesBackfacing = 0;
+    uint64_t trianglesSkipped = 0;
+    uint64_t trianglesBackfacing = 0;
+    uint64_t trianglesTested = 0;
+    uint64_t trianglesDrawn = 0;
+    uint64_t lodChunksCoarse = 0;
+    uint64_t trianglesSavedByLod = 0;
+    uint64_t nodesOccluded = 0;
+    uint64_t trianglesOccluded = 0;
+    uint64_t occluderTriangles = 0;
+};
+
+// Wall clock milliseconds spent in each part of the last run. cull walks
+// the hierarchy, transform covers the vertices, occlusion the depth pyramid
+// and clip the triangles: assembly, backface culling, lighting, clipping
+// and merging the bins.
+struct stageTimes
+{
+    double cull = 0.0;
+    double transform = 0.0;
+    double occlusion = 0.0;
+    double clip = 0.0;
+};
+
+// Frustum and normal cone culling of the mesh hierarchy, then backface
+// culling, lighting, clip space clipping and projection of what is left.
+// Vertices outside every visible node are never transformed. Culling and
+// lighting happen in object space against the precomputed face normals,
+// with the camera and light brought into object space once per run,
+// which assumes matWorld is rigid (rotation and translation only).
+//
+// LOD chunks get the coarsest level whose error, projected at the point of
+// the chunk's box nearest the camera, stays within lodErrorPixels. To keep
+// chunks from flickering between two levels at one distance, a chunk only
+// goes coarser once that level is well below the limit, and the level of
+// every chunk is remembered from run to run.
+//
+// With occlusionCulling the front facing triangles of the visible nodes
+// that look largest from the camera for their triangle count, up to a
+// fixed budget, are drawn into a low resolution depth pyramid from the
+// transformed vertices. A leaf or LOD chunk whose box lies entirely behind
+// it is dropped before any of its triangles are assembled. When that hides
+// fewer than a few triangles per occluder the pyramid is skipped for the
+// next runs, twice as many each time up to a limit, then tried again.
+//
+// A run whose stamps and mesh version all match the last run's does no
+// work and hands back the last result. When only the view or projection
+// changed the world space inputs, the camera and light in object space,
+// are kept.
+//
+// Vertices and triangles are split into chunks that run on the thread
+// pool (inline when there is none). Every chunk fills its own output bin
+// and the bins are concatenated in chunk order, so the result is identical
+// whatever the thread count.
+struct geometryStage
+{
+    threadPool *pool = nullptr;
+
+    // Counters of the last run
+    clipStats clipCounters;
+    cullStats cullCounters;
+    stageTimes timeCounters;
+
+    void run(const mesh &m, const frameParams &params, std::vector<triangle> &out);
+
+    // True when running with these inputs would only repeat the last run,
+    // so a caller that kept that run's output can skip it and everything
+    // downstream
+    bool upToDate(const mesh &m, const frameParams &params) const;
+
+    // Forgets what runs hand on to later ones, the remembered LOD levels
+    // and the occlusion backoff, so the next run picks them as if it were
+    // the first. Its output then depends on its own inputs alone.
+    void forgetHistory();
+
+    // Bytes held by the per-run buffers. They are cleared, never freed, so
+    // this is the high-water mark of the stage's memory and steady state
+    // runs do not allocate.
+    size_t scratchBytes() const;
+
+private:
+    // Half open [first, last) range of vertices or triangles
+    struct itemRange
+    {
+        uint32_t first, last;
+    };
+
+    std::vector<itemRange> vertexRanges, triangleRanges, lodRanges;
+    std::vector<itemRange> vertexJobs, triangleJobs, lodJobs;
+
+    // A leaf or LOD chunk that passed frustum and cone culling
+    struct visibleNode
+    {
+        uint32_t node;
+        uint32_t lod;           // 1 + index into mesh::lodLevels, 0 for full detail
+        float occluderScore;    // higher ones are drawn into the depth pyramid first
+        bool occluded;
+    };
+
+    std::vector<visibleNode> visibleNodes;
+    std::vector<uint32_t> occluderOrder;
+    std::vector<triangle> occluders;        // in screen space
+    depthPyramid occlusion;
+    uint32_t occlusionIdle = 0, occlusionBackoff = 0;  // runs left to skip it, and the last skip
+    std::vector<uint32_t> chunkLevels;      // per LOD chunk, 0 is full detail
+    uint64_t meshVersion = 0, worldVersion = 0, viewVersion = 0, projVersion = 0;
+    affineMatrix matWorldInv;
+    vec3d objectCamera, objectLight;
+    float lodPixelsPerUnit, lodErrorPixels; // pixels per object space unit at distance 1
+    vertexStream clipVerts, screenVerts;
+    std::vector<uint32_t> outcodes;
+    std::vector<std::vector<triangle>> bins;
+    size_t binCount = 0;                    // used by the last run
+    std::vector<clipStats> binStats;
+
+    void cullNodes(const mesh &m, const frustum &f);
+    void cullOccluded(const mesh &m, const mat4x4 &matWorldViewProj, const viewport &vp);
+    void collectVertexRanges(const mesh &m);
+    void collectTriangleRanges(const mesh &m);
+    bool nodeBackfacing(const meshNode &node) const;
+    float occluderScore(const mesh &m, const visibleNode &v) const;
+    static uint32_t nodeTriangles(const mesh &m, const visibleNode &v);
+    uint32_t selectLevel(const mesh &m, const meshNode &node);
+    size_t appendBins(std::vector<triangle> &out) const;
+    void planJobs(const std::vector<itemRange> &ranges, size_t minPerJob, std::vector<itemRange> &jobs) const;
+};
+
+// Vertices of a mesh after the transform, with the camera and the light
+// direction (unit length) brought into its object space
+struct transformedVertices
+{
+    vertexSpan verts;                   // object space
+    const vertexStream *clipVerts;
+    const vertexStream *screenVerts;
+    const uint32_t *outcodes;
+    vec3d objectCamera, objectLight;
+    viewport vp;
+};
+
+// Triangles [first, last) of indices, with normals the matching face
+// normals: rejected when outside a frustum plane, backface culled against
+// the camera, lit, clipped where they leave the guard band and appended to
+// out in screen space
+extern void assembleTriangles(const transformedVertices &v, const uint32_t *indices, const vec3d *normals,
+                              size_t first, size_t last, std::vector<triangle> &out, clipStats &stats);
+
+#endif
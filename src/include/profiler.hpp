@@ -0,0 +1,163 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Frame profiler: scoped stage timers and per-frame counters, kept for the
+// last PROFILE_HISTORY_FRAMES frames for an overlay, and optionally
+// streamed to a rolling CSV or JSON lines log and to a Chrome trace event
+// file (chrome://tracing, Perfetto). Built with GRAPH_PROFILE=0 (the
+// GRAPH_PROFILE CMake option) every PROFILE_ macro compiles to nothing and
+// the allocation hook is left out, so disabled builds pay nothing.
+#ifndef GRAPH_PROFILE
+#define GRAPH_PROFILE 1
+#endif
+
+enum profileCounter
+{
+    PROFILE_TRIANGLES_OCCLUDED, // in hierarchy nodes hidden by the depth pyramid
+    PROFILE_TRIANGLES_IN,       // reached per triangle culling
+    PROFILE_BACKFACE_CULLED,
+    PROFILE_NEAR_CLIPPED,       // crossed the near plane
+    PROFILE_SCREEN_CLIPPED,     // crossed a side plane's guard band
+    PROFILE_CLIPPED_TO_0,       // clipped triangles by how many came out
+    PROFILE_CLIPPED_TO_1,
+    PROFILE_CLIPPED_TO_2,
+    PROFILE_CLIPPED_TO_MORE,
+    PROFILE_TRIANGLES_DRAWN,
+    PROFILE_ALLOCATIONS,
+    PROFILE_BYTES_ALLOCATED,
+    PROFILE_SCRATCH_BYTES,      // held by the stages' reusable buffers
+    PROFILE_COUNTER_COUNT
+};
+
+extern const char *profileCounterName(profileCounter c);
+
+const size_t PROFILE_HISTORY_FRAMES = 240;
+
+// Events every frame has room for from the start. Frames pass their
+// buffers round the history, so without it a buffer could still grow a
+// history's worth of frames into a steady run.
+const size_t PROFILE_FRAME_EVENTS = 128;
+
+// A rolling log starts over in a new file after this many frames, the old
+// one is kept with ".1" appended
+const uint64_t PROFILE_LOG_MAX_FRAMES = 36000;
+
+using profileClock = std::chrono::steady_clock;
+
+// One timed scope, in microseconds since the profiler was created. depth
+// is how many scopes were open around it on its thread.
+struct profileEvent
+{
+    const char *name;
+    double start;
+    double duration;
+    uint32_t thread;
+    uint32_t depth;
+};
+
+struct profileFrame
+{
+    uint64_t index = 0;
+    double start = 0.0;
+    double duration = 0.0;
+    uint32_t thread = 0;    // the one that began and ended the frame
+    uint64_t counters[PROFILE_COUNTER_COUNT] = { 0 };
+    std::vector<profileEvent> events;
+
+    // Total milliseconds of the events called name
+    double stageMilliseconds(const char *name) const;
+};
+
+// Collects events between beginFrame and endFrame. Events and counters may
+// come from any thread. Event names must be string literals or otherwise
+// outlive the profiler.
+struct profiler
+{
+    profiler();
+    ~profiler();
+
+    void beginFrame();
+    void endFrame();
+
+    void addEvent(const char *name, profileClock::time_point start, profileClock::time_point end);
+    void count(profileCounter c, uint64_t n);
+
+    // Output files, written from endFrame. A log ending in ".csv" gets one
+    // CSV row per frame, anything else one JSON object per line.
+    bool openLog(const std::string &filename, std::string *error = nullptr);
+    bool openTrace(const std::string &filename, std::string *error = nullptr);
+    void close();
+
+    // Finished frames, oldest first, at most PROFILE_HISTORY_FRAMES
+    size_t historySize() const;
+    const profileFrame &history(size_t i) const;
+
+private:
+    profileClock::time_point origin;
+    std::mutex lock;
+    profileFrame current;
+    bool inFrame = false;
+    uint64_t frameCount = 0;
+    uint64_t allocationsAtStart = 0, bytesAtStart = 0;
+
+    std::vector<profileFrame> ring;
+    size_t ringNext = 0;
+
+    std::string logName;
+    std::ofstream log;
+    bool logCsv = false;
+    uint64_t logFrames = 0;
+    std::vector<const char *> logStages;    // CSV columns, from the first frame
+
+    std::ofstream trace;
+    bool traceFirst = true;
+
+    double microseconds(profileClock::time_point t) const;
+    void writeLog(const profileFrame &frame);
+    void writeTrace(const profileFrame &frame);
+};
+
+extern profiler frameProfiler;
+
+// Allocations made through operator new since startup, counted only when
+// the profiler is built in
+extern uint64_t allocationCount();
+extern uint64_t allocatedBytes();
+
+// Times the enclosing block as one event
+struct profileScope
+{
+    const char *name;
+    profileClock::time_point start;
+
+    explicit profileScope(const char *n);
+    ~profileScope();
+    profileScope(const profileScope &) = delete;
+    profileScope &operator=(const profileScope &) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if GRAPH_PROFILE
+#define PROFILE_SCOPE(name) profileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#define PROFILE_EVENT(name, start, end) frameProfiler.addEvent(name, start, end)
+#define PROFILE_COUNT(counter, n) frameProfiler.count(counter, n)
+#define PROFILE_BEGIN_FRAME() frameProfiler.beginFrame()
+#define PROFILE_END_FRAME() frameProfiler.endFrame()
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_EVENT(name, start, end) do { (void)(name); (void)(start); (void)(end); } while (0)
+#define PROFILE_COUNT(counter, n) do { (void)(counter); (void)(n); } while (0)
+#define PROFILE_BEGIN_FRAME() do {} while (0)
+#define PROFILE_END_FRAME() do {} while (0)
+#endif
+
+#endif
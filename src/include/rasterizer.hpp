@@ -0,0 +1,99 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "geometry.hpp"
+
+struct threadPool;
+
+// Color + depth target owned by the CPU. Color is stored as packed RGBA8
+// in the same byte order sf::Texture::update and sf::Image expect, so the
+// finished frame can be handed to SFML (or written to disk) in one go.
+struct framebuffer
+{
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<sf::Uint32> color;
+    std::vector<float> depth;
+
+    void resize(unsigned int w, unsigned int h);
+    void clear(sf::Color c = sf::Color::Black);
+    const sf::Uint8 *pixels() const;
+    bool saveToFile(const std::string &filename) const;
+};
+
+// Pixel rectangle, both bounds inclusive
+struct pixelRect
+{
+    int minX, minY, maxX, maxY;
+};
+
+const int TILE_SIZE = 64;
+
+// Bins triangles into TILE_SIZE square screen tiles by bounding box, then
+// clears and rasterizes the tiles in parallel. Each tile is owned by one
+// task and triangles are clipped to its bounds while filling, so threads
+// never share framebuffer pixels and no locks are needed. Within a tile
+// triangles are drawn in submission order, like the serial path.
+struct tiledRasterizer
+{
+    threadPool *pool = nullptr;
+    sf::Color clearColor = sf::Color::Black;
+
+    void draw(framebuffer &fb, const std::vector<triangle> &tris);
+
+    // Bytes held by the bins. They are only ever cleared, so this is the
+    // high-water mark of what drawing needs.
+    size_t scratchBytes() const;
+
+private:
+    // Triangle indices per [binning chunk][tile], reused frame to frame
+    std::vector<std::vector<std::vector<uint32_t>>> bins;
+};
+
+// Vertices are snapped to 1/16 pixel and covered pixels found with exact
+// integer edge functions at pixel centers. Pixels on an edge belong to the
+// triangle only for top and left edges, so triangles sharing an edge
+// never both draw, nor both miss, a pixel there.
+const int SUBPIXEL_BITS = 4;
+
+// Triangles are walked in RASTER_BLOCK square blocks aligned to the
+// screen. Blocks outside an edge are skipped whole, blocks inside every
+// edge only depth test, and only blocks an edge crosses test pixels
+// against it. The blocks are filled by the best of AVX2, SSE and plain
+// scalar code the CPU supports; GRAPH_RASTER_KERNEL=scalar|sse|avx2 caps
+// the choice. Depth is a plane in screen space, evaluated once per block
+// and stepped from there, and color is flat per triangle.
+const int RASTER_BLOCK = 8;
+
+// A triangle ready for filling. Pixel (x, y) is covered when every
+// edge[i] + (x - minX) * stepX[i] + (y - minY) * stepY[i] is at least 0;
+// the fill rule is folded into edge as a bias. minX..maxY bound the pixels
+// whose centers can be covered.
+struct triangleSetup
+{
+    int minX, minY, maxX, maxY;
+    int64_t edge[3];
+    int32_t stepX[3], stepY[3];
+    float zAnchor, dzdx, dzdy;      // depth at the center of (minX, minY) and per pixel
+    sf::Uint32 color;
+};
+
+// False when no pixel center can be covered
+extern bool setupTriangle(const triangle &tri, triangleSetup &s);
+
+extern sf::Uint32 packColor(sf::Color c);
+extern void rasterizeTriangle(framebuffer &fb, const triangle &tri);
+extern void rasterizeTriangle(framebuffer &fb, const triangle &tri, const pixelRect &clip);
+extern const char *rasterKernelName();
+
+// Same coverage, one pixel at a time from edge functions and a fill rule
+// of its own, with depth interpolated in double at every pixel center.
+// Slow, it is the reference the block kernels must match: coverage pixel
+// for pixel, depth to within the rounding of their float depth plane.
+extern void rasterizeTriangleReference(framebuffer &fb, const triangle &tri, const pixelRect &clip);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <cstddef>
+
+// Frame times the controller keeps, and how many of them must be under
+// budget before it lets the resolution go up
+const size_t RESOLUTION_HISTORY = 16;
+
+// Frames looked at for a slowdown, few enough to react within a frame or two
+const size_t RESOLUTION_RECENT = 4;
+
+// Render widths are multiples of this many pixels, so times too small to
+// move it by that much change nothing
+const unsigned RESOLUTION_WIDTH_STEP = 8;
+
+// Internal render size that follows the frame time. The image is drawn
+// at scale times the output size and stretched to the output in one blit,
+// so heavy frames cost sharpness instead of frame rate.
+//
+// Pixel work goes with the square of the scale, so a frame that took ms
+// at scale s would take about target at s * sqrt(target / ms). When the
+// mean of the last RESOLUTION_RECENT frames goes over budget the scale
+// comes down right away, far enough for that mean; it only goes back up,
+// a few percent at a time, once a whole history of frames stayed under
+// budget with headroom to spare. Treating all of the frame as pixel work
+// overshoots downwards, which errs on the side of holding the budget.
+//
+// After a change, the frames already in flight at the old size and the
+// first one at the new size, which pays for the resize, are not timed.
+struct resolutionController
+{
+    float targetMs = 1000.0f / 60.0f;   // 0 leaves the scale alone
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float headroom = 0.85f;             // share of the budget to aim for
+    float maxStepUp = 0.05f;            // largest scale increase at a time
+
+    // Size the render target is stretched to, the scale applies to it
+    void setOutputSize(unsigned width, unsigned height);
+
+    // Sets the scale outright, clamped to [minScale, maxScale], and
+    // forgets the frame times measured so far
+    void setScale(float s);
+
+    // Frames between picking a size and timing a frame made at it, the
+    // frame pipeline's latency or 0 for a serial loop
+    void setLatency(unsigned frames) { settleFrames = frames + 1; }
+
+    // Takes the time the last rendered frame took. Frames that only reused
+    // the previous image say nothing about the cost of a new one and must
+    // not be fed in. True when the render size changed.
+    bool update(float frameMs);
+
+    float scale() const { return currentScale; }
+    unsigned width() const { return renderWidth; }
+    unsigned height() const { return renderHeight; }
+
+private:
+    unsigned outputWidth = 1, outputHeight = 1;
+    unsigned renderWidth = 1, renderHeight = 1;
+    float currentScale = 1.0f;
+    float history[RESOLUTION_HISTORY] = {};
+    size_t samples = 0;
+    unsigned settle = 0;
+    unsigned settleFrames = 1;     // frame times ignored after a change
+
+    bool resize(float s);
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+#include <vector>
+#include "pipeline.hpp"
+
+struct threadPool;
+
+// A mesh many instances share, with a bounding sphere around its vertices
+// in object space. The mesh must outlive the scene.
+struct sceneAsset
+{
+    const mesh *m;
+    float center[3];
+    float radius;
+};
+
+// Placement of one copy of an asset: uniform scale, then a turn of yaw
+// radians about the y axis, then a move to position. Instances hold no
+// geometry of their own.
+struct meshInstance
+{
+    uint32_t asset;
+    float position[3];
+    float yaw;
+    float scale;
+};
+
+// Shared meshes and the instances placed from them, in world space
+struct scene
+{
+    std::vector<sceneAsset> assets;
+    std::vector<meshInstance> instances;
+
+    // Returns the index addInstance takes
+    uint32_t addAsset(const mesh &m);
+
+    // False, adding nothing, for an asset that was never added or a scale
+    // that is zero or not finite, which drawing divides by
+    bool addInstance(uint32_t asset, const float position[3], float yaw, float scale);
+
+    // Bytes held by the instance and asset arrays, not by the meshes
+    size_t bytes() const;
+};
+
+struct sceneStats
+{
+    uint64_t instancesTested = 0;
+    uint64_t instancesCulled = 0;
+    uint64_t trianglesTested = 0;
+    uint64_t trianglesDrawn = 0;
+};
+
+// Draws every instance of a scene, the geometry stage's per triangle work
+// without its hierarchy. Instances whose bounding sphere is outside the
+// frustum are dropped whole. The rest are split into batches of
+// consecutive instances with enough triangles to be worth a thread. Per
+// instance the world, view and projection matrices are combined once, the
+// asset's vertices are streamed through them into the batch's scratch
+// streams and its triangles assembled from there, with the camera and
+// light brought into the instance's object space. Scratch streams are
+// sized by the largest asset, not by the instance count.
+//
+// Batches start on at most a fixed number of triangles and run in rounds
+// of a few per thread, each round's bins appended to the output before
+// the next round reuses them. Bins are appended in batch order, so the
+// output does not depend on the thread count, and the bins hold one round
+// of triangles however many instances there are. matWorld and the version
+// stamps of params are unused.
+struct sceneStage
+{
+    threadPool *pool = nullptr;
+
+    // Counters of the last run
+    sceneStats counters;
+    clipStats clipCounters;
+
+    // Appends the triangles of s to out
+    void run(const scene &s, const frameParams &params, std::vector<triangle> &out);
+
+    size_t scratchBytes() const;
+
+private:
+    struct batch
+    {
+        uint32_t first, last;   // in visible
+        vertexStream clipVerts, screenVerts;
+        std::vector<uint32_t> outcodes;
+        std::vector<triangle> bin;
+        clipStats stats;
+    };
+
+    std::vector<uint32_t> visible;          // instances inside the frustum
+    std::vector<batch> batches;             // one round
+
+    void drawInstance(const scene &s, const meshInstance &instance, const frameParams &params,
+                      const mat4x4 &matViewProj, batch &b);
+};
+
+#endif
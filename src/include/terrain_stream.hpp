@@ -0,0 +1,165 @@
+#ifndef TERRAIN_STREAM_H
+#define TERRAIN_STREAM_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mesh.hpp"
+#include "pipeline.hpp"
+
+struct threadPool;
+
+// Manifest a tile set is described by, inside its directory
+const char *const TERRAIN_MANIFEST = "tiles.txt";
+
+const uint64_t TERRAIN_DEFAULT_BUDGET = 64ull << 20;
+
+// Most tiles per side a tile set is split into, which bounds the cells
+// writeTerrainTiles sorts triangles into
+const int MAX_TERRAIN_TILES_PER_SIDE = 256;
+
+// One tile of a streamed terrain: a binary mesh cache in the tile set's
+// directory covering one cell of a grid over the terrain's XZ bounds
+struct terrainTileInfo
+{
+    int col, row;
+    std::string file;
+    float boundsMin[3], boundsMax[3];
+    uint64_t bytes;     // of the cache file, what the tile holds in memory
+};
+
+// Splits m into a tilesPerSide x tilesPerSide grid over its XZ bounds, 1
+// to MAX_TERRAIN_TILES_PER_SIDE a side, every triangle going to the cell
+// its centroid falls in, and writes each non-empty cell as a mesh cache
+// plus the manifest into dir. Tiles repeat the vertices they share with
+// their neighbours, and coarser levels never move vertices on open edges,
+// so tiles meet without cracks.
+extern bool writeTerrainTiles(const mesh &m, int tilesPerSide, const std::string &dir, std::string *error = nullptr);
+
+// Reads the manifest of the tile set in dir
+extern bool readTerrainManifest(const std::string &dir, std::vector<terrainTileInfo> &tiles, std::string *error = nullptr);
+
+struct terrainStreamStats
+{
+    uint64_t loadsFinished = 0;
+    uint64_t loadsFailed = 0;
+    uint64_t evictions = 0;
+    uint64_t deferred = 0;      // wanted tiles left out by the budget this update
+    uint32_t resident = 0;
+    uint32_t pending = 0;       // queued or being loaded
+    uint64_t residentBytes = 0;
+    uint64_t pendingBytes = 0;  // of the pending tiles, counted against the budget like resident ones
+};
+
+// Terrain split into tiles on disk, of which only the ones around the
+// camera are in memory. Tiles are loaded on a background I/O thread; the
+// render thread only hands it requests and picks up what it finished, so
+// it never waits on disk. A tile is wanted when its XZ box lies within
+// loadRadius of the camera or of a point prefetchDistance ahead of it
+// along the look direction (and along the way it last moved), nearer
+// ones first. Loading a wanted tile first evicts the tiles used longest
+// ago that are not wanted any more, as far as needed to keep resident
+// and pending tiles within budgetBytes; what still does not fit waits.
+//
+// Every resident tile keeps a geometry stage of its own so its LOD levels
+// and unchanged results carry over between frames. The stages, and their
+// scratch buffers, are reused from evicted tiles. Positions are in the
+// terrain's object space.
+struct terrainStreamer
+{
+    threadPool *pool = nullptr;         // for the tiles' geometry stages
+    uint64_t budgetBytes = TERRAIN_DEFAULT_BUDGET;
+    float loadRadius = 0.0f;            // 0 picks three tiles
+    float prefetchDistance = 0.0f;      // 0 picks two tiles
+
+    terrainStreamStats counters;
+
+    terrainStreamer();
+    ~terrainStreamer();
+    terrainStreamer(const terrainStreamer &) = delete;
+    terrainStreamer &operator=(const terrainStreamer &) = delete;
+
+    // Reads the manifest and starts the I/O thread. Nothing is resident
+    // until the first updates.
+    bool open(const std::string &dir, std::string *error = nullptr);
+    void close();
+
+    // Render thread, once per frame: takes in finished loads, then evicts
+    // and queues loads for the camera
+    void update(const vec3d &camera, const vec3d &lookDir);
+
+    // Blocks until no load is queued or running, for offline frames that
+    // want every wanted tile in place. A following update takes them in.
+    void waitIdle();
+
+    // True when run would only repeat the last run: no tile came or went
+    // and every tile's stage is up to date
+    bool upToDate(const frameParams &params) const;
+
+    // Geometry of every resident tile appended to out, counters summed
+    void run(const frameParams &params, std::vector<triangle> &out);
+    cullStats cullCounters;
+    clipStats clipCounters;
+
+    size_t scratchBytes() const;
+
+private:
+    enum tileState : uint8_t
+    {
+        TILE_ABSENT,
+        TILE_PENDING,
+        TILE_RESIDENT,
+        TILE_FAILED
+    };
+
+    struct residentTile
+    {
+        uint32_t tile;
+        std::unique_ptr<mesh> m;
+        geometryStage stage;
+        uint64_t lastUsed;
+    };
+
+    struct finishedLoad
+    {
+        uint32_t tile;
+        std::unique_ptr<mesh> m;
+    };
+
+    struct wantedTile
+    {
+        uint32_t tile;
+        float distance;
+    };
+
+    std::string directory;
+    std::vector<terrainTileInfo> tiles;
+    std::vector<tileState> states;
+    std::vector<uint64_t> wantedFrame;          // last update that wanted each tile
+    std::vector<std::unique_ptr<residentTile>> resident, spare;
+    std::vector<wantedTile> wanted;
+    std::vector<finishedLoad> arrived;
+    float tileSize = 1.0f;
+    uint64_t frame = 0;
+    bool residentChanged = true;
+    vec3d lastCamera;
+
+    // Shared with the I/O thread, under lock
+    std::mutex lock;
+    std::condition_variable wake, idle;
+    std::deque<uint32_t> requests;
+    std::vector<finishedLoad> finished;
+    bool loading = false, stopping = false;
+    std::thread worker;
+
+    void ioLoop();
+    void want(const vec3d &point, float extra);
+    bool makeRoom(uint64_t bytes);
+};
+
+#endif
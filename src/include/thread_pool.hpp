@@ -0,0 +1,85 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Non-owning reference to a callable taking a task index. Unlike
+// std::function it never allocates, which keeps frames free of heap
+// traffic; the callable only has to outlive the call it is passed to.
+struct taskFunction
+{
+    template <typename F>
+    taskFunction(const F &fn)
+        : object(&fn), call([](const void *o, size_t task) { (*static_cast<const F *>(o))(task); })
+    {
+    }
+
+    void operator()(size_t task) const { call(object, task); }
+
+private:
+    const void *object;
+    void (*call)(const void *, size_t);
+};
+
+// Fixed set of worker threads for data-parallel loops. The calling thread
+// joins in as well, so a pool of size 1 simply runs everything inline.
+//
+// Tasks are scheduled by work stealing: every thread starts with an even,
+// contiguous share of the task range and takes tasks from its front. A
+// thread that runs dry steals the back half of another thread's share.
+// Shares are single atomic words, so there are no locks on the hot path.
+// Most threads a pool starts, whatever it is asked for
+const unsigned MAX_POOL_THREADS = 256;
+
+struct threadPool
+{
+    // threadCount counts the caller too, 0 means one per hardware thread.
+    // Both are capped at MAX_POOL_THREADS.
+    explicit threadPool(unsigned threadCount = 0);
+    ~threadPool();
+    threadPool(const threadPool &) = delete;
+    threadPool &operator=(const threadPool &) = delete;
+
+    unsigned size() const { return (unsigned)workers.size() + 1; }
+
+    // Calls fn(task) once for every task in [0, taskCount), spread over all
+    // threads, and returns when every call has finished. Tasks must not
+    // call back into the same pool.
+    void parallelFor(size_t taskCount, taskFunction fn);
+
+private:
+    // Remaining [begin, end) of one thread's share, packed as two 32-bit halves
+    struct alignas(64) taskRange
+    {
+        std::atomic<uint64_t> range{0};
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<taskRange> ranges;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    const taskFunction *job = nullptr;
+    unsigned busyWorkers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void workerLoop(unsigned self);
+    void runTasks(unsigned self);
+    bool popTask(unsigned self, uint32_t &task);
+    bool stealTasks(unsigned self);
+};
+
+// Number of chunks to split count items into: a few per thread so uneven
+// chunks balance out, but none smaller than minPerChunk items
+extern size_t chunkCount(threadPool *pool, size_t count, size_t minPerChunk);
+
+// threadPool::parallelFor that runs inline when there is no pool
+extern void parallelFor(threadPool *pool, size_t taskCount, taskFunction fn);
+
+#endif
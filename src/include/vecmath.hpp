@@ -0,0 +1,312 @@
+#ifndef VECMATH_H
+#define VECMATH_H
+
+#include <cmath>
+
+// Vector and matrix helpers. Everything is inline and takes its operands
+// by const reference or value, so calls fold into their callers and
+// temporaries can be passed straight in. What needs no sqrt or trig is
+// constexpr. Vectors are rows multiplied on the left of matrices: row 3
+// of a matrix is the translation and column 3 produces w.
+
+// Set to 1 to let mulAdd use a fused multiply-add. It defaults to on
+// only where the compiler may assume the instruction, a libm call being
+// far slower than the two operations it replaces.
+#ifndef GRAPH_MATH_FMA
+#if defined(__FMA__) || defined(__AVX2__)
+#define GRAPH_MATH_FMA 1
+#else
+#define GRAPH_MATH_FMA 0
+#endif
+#endif
+
+struct vec3d
+{
+    float x = 0;
+    float y = 0;
+    float z = 0;
+    float w = 1;
+};
+
+struct mat4x4
+{
+    float m[4][4] = { 0 };
+};
+
+// A mat4x4 whose column 3 is (0, 0, 0, 1), as every world and view
+// transform is: rows 0-2 hold the linear part and row 3 the translation
+// (the 3x4 affine matrix of column vector notation). Products of these
+// skip every multiply by the constant column.
+struct affineMatrix
+{
+    float m[4][3] = { { 0 } };
+};
+
+// a * b + c, rounded once when GRAPH_MATH_FMA is on
+inline float mulAdd(float a, float b, float c)
+{
+#if GRAPH_MATH_FMA
+    return std::fma(a, b, c);
+#else
+    return a * b + c;
+#endif
+}
+
+constexpr vec3d addVectors(const vec3d &v1, const vec3d &v2)
+{
+    return { v1.x + v2.x, v1.y + v2.y, v1.z + v2.z };
+}
+
+constexpr vec3d subVectors(const vec3d &v1, const vec3d &v2)
+{
+    return { v1.x - v2.x, v1.y - v2.y, v1.z - v2.z };
+}
+
+constexpr vec3d mulVector(const vec3d &v1, float k)
+{
+    return { v1.x * k, v1.y * k, v1.z * k };
+}
+
+constexpr vec3d divVector(const vec3d &v1, float k)
+{
+    return { v1.x / k, v1.y / k, v1.z / k };
+}
+
+constexpr float dotProduct(const vec3d &v1, const vec3d &v2)
+{
+    return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
+}
+
+constexpr vec3d crossProduct(const vec3d &v1, const vec3d &v2)
+{
+    return { v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x };
+}
+
+inline float lenVector(const vec3d &v)
+{
+    return std::sqrt(dotProduct(v, v));
+}
+
+inline vec3d normVector(const vec3d &v)
+{
+    float l = lenVector(v);
+    return { v.x / l, v.y / l, v.z / l };
+}
+
+constexpr mat4x4 makeIdentityMatrix()
+{
+    mat4x4 matrix;
+    matrix.m[0][0] = 1.0f;
+    matrix.m[1][1] = 1.0f;
+    matrix.m[2][2] = 1.0f;
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+inline mat4x4 makeRotatedMatrixX(float angleRad)
+{
+    mat4x4 matrix;
+    matrix.m[0][0] = 1.0f;
+    matrix.m[1][1] = std::cos(angleRad);
+    matrix.m[1][2] = std::sin(angleRad);
+    matrix.m[2][1] = -std::sin(angleRad);
+    matrix.m[2][2] = std::cos(angleRad);
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+inline mat4x4 makeRotatedMatrixY(float angleRad)
+{
+    mat4x4 matrix;
+    matrix.m[0][0] = std::cos(angleRad);
+    matrix.m[0][2] = std::sin(angleRad);
+    matrix.m[2][0] = -std::sin(angleRad);
+    matrix.m[1][1] = 1.0f;
+    matrix.m[2][2] = std::cos(angleRad);
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+inline mat4x4 makeRotatedMatrixZ(float angleRad)
+{
+    mat4x4 matrix;
+    matrix.m[0][0] = std::cos(angleRad);
+    matrix.m[0][1] = std::sin(angleRad);
+    matrix.m[1][0] = -std::sin(angleRad);
+    matrix.m[1][1] = std::cos(angleRad);
+    matrix.m[2][2] = 1.0f;
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+constexpr mat4x4 makeTranslatedMatrix(float x, float y, float z)
+{
+    mat4x4 matrix = makeIdentityMatrix();
+    matrix.m[3][0] = x;
+    matrix.m[3][1] = y;
+    matrix.m[3][2] = z;
+    return matrix;
+}
+
+inline mat4x4 makeProjectionMatrix(float fovDegrees, float aspectRatio, float near, float far)
+{
+    float fovRad = 1.0f / std::tan(fovDegrees * 0.5f / 180.0f * 3.14159f);
+    mat4x4 matrix;
+    matrix.m[0][0] = aspectRatio*fovRad;
+    matrix.m[1][1] = fovRad;
+    matrix.m[2][2] = far / (far-near);
+    matrix.m[3][2] = (-far*near) / (far-near);
+    matrix.m[2][3] = 1.0f;
+    matrix.m[3][3] = 0.0f;
+    return matrix;
+}
+
+constexpr mat4x4 mulMatrices(const mat4x4 &m1, const mat4x4 &m2)
+{
+    mat4x4 matrix;
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+            matrix.m[r][c] = m1.m[r][0] * m2.m[0][c]
+                            + m1.m[r][1] * m2.m[1][c]
+                            + m1.m[r][2] * m2.m[2][c]
+                            + m1.m[r][3] * m2.m[3][c];
+    return matrix;
+}
+
+constexpr vec3d mulMatrixByVector(const mat4x4 &m, const vec3d &i)
+{
+    return {
+        i.x * m.m[0][0] + i.y * m.m[1][0] + i.z * m.m[2][0] + i.w * m.m[3][0],
+        i.x * m.m[0][1] + i.y * m.m[1][1] + i.z * m.m[2][1] + i.w * m.m[3][1],
+        i.x * m.m[0][2] + i.y * m.m[1][2] + i.z * m.m[2][2] + i.w * m.m[3][2],
+        i.x * m.m[0][3] + i.y * m.m[1][3] + i.z * m.m[2][3] + i.w * m.m[3][3]
+    };
+}
+
+inline mat4x4 pointAt(const vec3d &pos, const vec3d &forw, const vec3d &up)
+{
+    // Forward direction
+    vec3d newForward = normVector(subVectors(forw, pos));
+
+    // Up direction
+    vec3d a = mulVector(newForward, dotProduct(up, newForward));
+    vec3d newUp = normVector(subVectors(up, a));
+
+    // Right direction
+    vec3d newRight = crossProduct(newUp, newForward);
+
+    // Point at matrix
+    mat4x4 matrix;
+    matrix.m[0][0] = newRight.x;   matrix.m[0][1] = newRight.y;   matrix.m[0][2] = newRight.z;   matrix.m[0][3] = 0.0f;
+    matrix.m[1][0] = newUp.x;      matrix.m[1][1] = newUp.y;      matrix.m[1][2] = newUp.z;      matrix.m[1][3] = 0.0f;
+    matrix.m[2][0] = newForward.x; matrix.m[2][1] = newForward.y; matrix.m[2][2] = newForward.z; matrix.m[2][3] = 0.0f;
+    matrix.m[3][0] = pos.x;        matrix.m[3][1] = pos.y;        matrix.m[3][2] = pos.z;        matrix.m[3][3] = 1.0f;
+
+    return matrix;
+}
+
+constexpr mat4x4 quickInverse(const mat4x4 &m) // Only for rotation/translation matrices
+{
+    mat4x4 matrix;
+    matrix.m[0][0] = m.m[0][0]; matrix.m[0][1] = m.m[1][0]; matrix.m[0][2] = m.m[2][0]; matrix.m[0][3] = 0.0f;
+    matrix.m[1][0] = m.m[0][1]; matrix.m[1][1] = m.m[1][1]; matrix.m[1][2] = m.m[2][1]; matrix.m[1][3] = 0.0f;
+    matrix.m[2][0] = m.m[0][2]; matrix.m[2][1] = m.m[1][2]; matrix.m[2][2] = m.m[2][2]; matrix.m[2][3] = 0.0f;
+    matrix.m[3][0] = -(m.m[3][0] * matrix.m[0][0] + m.m[3][1] * matrix.m[1][0] + m.m[3][2] * matrix.m[2][0]);
+    matrix.m[3][1] = -(m.m[3][0] * matrix.m[0][1] + m.m[3][1] * matrix.m[1][1] + m.m[3][2] * matrix.m[2][1]);
+    matrix.m[3][2] = -(m.m[3][0] * matrix.m[0][2] + m.m[3][1] * matrix.m[1][2] + m.m[3][2] * matrix.m[2][2]);
+    matrix.m[3][3] = 1.0f;
+    return matrix;
+}
+
+// Drops column 3, which must be (0, 0, 0, 1)
+constexpr affineMatrix toAffine(const mat4x4 &m)
+{
+    affineMatrix a;
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 3; c++)
+            a.m[r][c] = m.m[r][c];
+    return a;
+}
+
+constexpr mat4x4 toMatrix(const affineMatrix &a)
+{
+    mat4x4 m;
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 3; c++)
+            m.m[r][c] = a.m[r][c];
+    m.m[3][3] = 1.0f;
+    return m;
+}
+
+// a * b, 36 multiplies where mulMatrices takes 64
+constexpr affineMatrix mulAffine(const affineMatrix &a, const affineMatrix &b)
+{
+    affineMatrix matrix;
+    for (int c = 0; c < 3; c++)
+    {
+        for (int r = 0; r < 3; r++)
+            matrix.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] + a.m[r][2] * b.m[2][c];
+        matrix.m[3][c] = a.m[3][0] * b.m[0][c] + a.m[3][1] * b.m[1][c] + a.m[3][2] * b.m[2][c] + b.m[3][c];
+    }
+    return matrix;
+}
+
+// a * m with a general m such as a projection, 48 multiplies
+constexpr mat4x4 mulAffineByMatrix(const affineMatrix &a, const mat4x4 &m)
+{
+    mat4x4 matrix;
+    for (int c = 0; c < 4; c++)
+    {
+        for (int r = 0; r < 3; r++)
+            matrix.m[r][c] = a.m[r][0] * m.m[0][c] + a.m[r][1] * m.m[1][c] + a.m[r][2] * m.m[2][c];
+        matrix.m[3][c] = a.m[3][0] * m.m[0][c] + a.m[3][1] * m.m[1][c] + a.m[3][2] * m.m[2][c] + m.m[3][c];
+    }
+    return matrix;
+}
+
+// Point (w = 1, whatever p.w says) through a, 9 multiplies
+constexpr vec3d transformPoint(const affineMatrix &a, const vec3d &p)
+{
+    return {
+        p.x * a.m[0][0] + p.y * a.m[1][0] + p.z * a.m[2][0] + a.m[3][0],
+        p.x * a.m[0][1] + p.y * a.m[1][1] + p.z * a.m[2][1] + a.m[3][1],
+        p.x * a.m[0][2] + p.y * a.m[1][2] + p.z * a.m[2][2] + a.m[3][2],
+        1.0f
+    };
+}
+
+// Direction (w = 0) through a, the translation left out
+constexpr vec3d transformDirection(const affineMatrix &a, const vec3d &d)
+{
+    return {
+        d.x * a.m[0][0] + d.y * a.m[1][0] + d.z * a.m[2][0],
+        d.x * a.m[0][1] + d.y * a.m[1][1] + d.z * a.m[2][1],
+        d.x * a.m[0][2] + d.y * a.m[1][2] + d.z * a.m[2][2],
+        0.0f
+    };
+}
+
+// transformPoint as a chain of mulAdd
+inline vec3d transformPointFused(const affineMatrix &a, const vec3d &p)
+{
+    return {
+        mulAdd(p.x, a.m[0][0], mulAdd(p.y, a.m[1][0], mulAdd(p.z, a.m[2][0], a.m[3][0]))),
+        mulAdd(p.x, a.m[0][1], mulAdd(p.y, a.m[1][1], mulAdd(p.z, a.m[2][1], a.m[3][1]))),
+        mulAdd(p.x, a.m[0][2], mulAdd(p.y, a.m[1][2], mulAdd(p.z, a.m[2][2], a.m[3][2]))),
+        1.0f
+    };
+}
+
+// Inverse of a rotation and translation
+constexpr affineMatrix quickInverse(const affineMatrix &a)
+{
+    affineMatrix matrix;
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            matrix.m[r][c] = a.m[c][r];
+    for (int c = 0; c < 3; c++)
+        matrix.m[3][c] = -(a.m[3][0] * matrix.m[0][c] + a.m[3][1] * matrix.m[1][c] + a.m[3][2] * matrix.m[2][c]);
+    return matrix;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#include <utility>
+#include "../include/clipper.hpp"
+
+void clipStats::add(const clipStats &other)
+{
+    accepted += other.accepted;
+    rejected += other.rejected;
+    backfacing += other.backfacing;
+    clipped += other.clipped;
+    for (int p = 0; p < CLIP_PLANE_COUNT; p++)
+        planeClips[p] += other.planeClips[p];
+    for (int r = 0; r < CLIP_RESULT_BUCKETS; r++)
+        clipResults[r] += other.clipResults[r];
+}
+
+uint32_t clipOutcode(float x, float y, float z, float w)
+{
+    float guard = GUARD_BAND * w;
+    uint32_t code = 0;
+
+    if (z < 0.0f) code |= (1u << CLIP_NEAR) | (1u << (CLIP_NEAR + CLIP_GUARD_SHIFT));
+    if (z > w) code |= (1u << CLIP_FAR) | (1u << (CLIP_FAR + CLIP_GUARD_SHIFT));
+
+    if (x < -w) code |= 1u << CLIP_LEFT;
+    if (x > w) code |= 1u << CLIP_RIGHT;
+    if (y < -w) code |= 1u << CLIP_BOTTOM;
+    if (y > w) code |= 1u << CLIP_TOP;
+
+    if (x < -guard) code |= 1u << (CLIP_LEFT + CLIP_GUARD_SHIFT);
+    if (x > guard) code |= 1u << (CLIP_RIGHT + CLIP_GUARD_SHIFT);
+    if (y < -guard) code |= 1u << (CLIP_BOTTOM + CLIP_GUARD_SHIFT);
+    if (y > guard) code |= 1u << (CLIP_TOP + CLIP_GUARD_SHIFT);
+
+    return code;
+}
+
+// Signed distance to a clipping plane, positive inside
+static inline float planeDistance(int plane, const vec3d &v)
+{
+    switch (plane)
+    {
+        case CLIP_NEAR:   return v.z;
+        case CLIP_FAR:    return v.w - v.z;
+        case CLIP_LEFT:   return GUARD_BAND * v.w + v.x;
+        case CLIP_RIGHT:  return GUARD_BAND * v.w - v.x;
+        case CLIP_BOTTOM: return GUARD_BAND * v.w + v.y;
+        default:          return GUARD_BAND * v.w - v.y;
+    }
+}
+
+static inline vec3d lerpVertex(const vec3d &a, const vec3d &b, float t)
+{
+    return {
+        a.x + (b.x - a.x) * t,
+        a.y + (b.y - a.y) * t,
+        a.z + (b.z - a.z) * t,
+        a.w + (b.w - a.w) * t
+    };
+}
+
+int clipTriangle(const vec3d in[3], uint32_t codes, vec3d out[MAX_CLIP_VERTS], clipStats &stats)
+{
+    // Ping-pong between the caller's buffer and a local one
+    vec3d scratch[MAX_CLIP_VERTS];
+    vec3d *src = scratch, *dst = out;
+    src[0] = in[0];
+    src[1] = in[1];
+    src[2] = in[2];
+    int count = 3;
+
+    for (int plane = 0; plane < CLIP_PLANE_COUNT; plane++)
+    {
+        if (!(codes & (1u << (plane + CLIP_GUARD_SHIFT))))
+            continue;
+
+        float dist[MAX_CLIP_VERTS];
+        bool crossed = false;
+        for (int i = 0; i < count; i++)
+        {
+            dist[i] = planeDistance(plane, src[i]);
+            crossed |= dist[i] < 0.0f;
+        }
+        if (!crossed)
+            continue;
+        stats.planeClips[plane]++;
+
+        int n = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int j = i + 1 == count ? 0 : i + 1;
+            bool insideI = dist[i] >= 0.0f, insideJ = dist[j] >= 0.0f;
+
+            if (insideI)
+                dst[n++] = src[i];
+            if (insideI != insideJ)
+            {
+                if (insideI)
+                    dst[n++] = lerpVertex(src[i], src[j], dist[i] / (dist[i] - dist[j]));
+                else
+                    dst[n++] = lerpVertex(src[j], src[i], dist[j] / (dist[j] - dist[i]));
+            }
+        }
+
+        count = n;
+        std::swap(src, dst);
+        if (count < 3)
+            return 0;
+    }
+
+    // The last pass may have left the result in the scratch buffer
+    if (src != out)
+        for (int i = 0; i < count; i++)
+            out[i] = src[i];
+
+    return count;
+}
+
+vec3d clipToScreen(const vec3d &c, const viewport &vp)
+{
+    float invW = 1.0f / c.w;
+    return {
+        (1.0f - c.x * invW) * (0.5f * vp.width),
+        (1.0f - c.y * invW) * (0.5f * vp.height),
+        c.z * invW,
+        c.w
+    };
+}
@@ -0,0 +1,23 @@
+#include <cmath>
+#include <cstdlib>
+#include "../include/command_line.hpp"
+
+bool parseCount(const char *text, unsigned max, unsigned &value)
+{
+    char *end;
+    long v = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || v < 0 || (unsigned long)v > max)
+        return false;
+    value = (unsigned)v;
+    return true;
+}
+
+bool parseNumber(const char *text, float min, float max, float &value)
+{
+    char *end;
+    double v = std::strtod(text, &end);
+    if (end == text || *end != '\0' || !std::isfinite(v) || v < min || v > max)
+        return false;
+    value = (float)v;
+    return true;
+}
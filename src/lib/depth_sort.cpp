@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include "../include/depth_sort.hpp"
+#include "../include/thread_pool.hpp"
+
+const size_t MIN_KEYS_PER_CHUNK = 16384;
+const int RADIX_BITS = 8;
+const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+uint32_t floatSortKey(float f)
+{
+    // Negative floats have every bit flipped so larger magnitudes sort
+    // lower, positive ones only get the sign bit set to land above them
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+void depthSorter::sort(std::vector<triangle> &tris)
+{
+    size_t n = tris.size();
+    if (n < 2) return;
+
+    size_t chunks = chunkCount(pool, n, MIN_KEYS_PER_CHUNK);
+    keys.resize(n);
+    keysTmp.resize(n);
+    order.resize(n);
+    orderTmp.resize(n);
+    counts.resize(chunks * RADIX_BUCKETS);
+
+    // Farthest first, so the key is inverted. The sum orders the same as
+    // the average without the divide.
+    parallelFor(pool, chunks, [&](size_t c)
+    {
+        for (size_t i = n * c / chunks, last = n * (c + 1) / chunks; i < last; i++)
+        {
+            const triangle &t = tris[i];
+            keys[i] = ~floatSortKey(t.p[0].z + t.p[1].z + t.p[2].z);
+            order[i] = (uint32_t)i;
+        }
+    });
+
+    for (int shift = 0; shift < 32; shift += RADIX_BITS)
+    {
+        // Histogram of this digit, one per chunk
+        parallelFor(pool, chunks, [&](size_t c)
+        {
+            uint32_t *count = &counts[c * RADIX_BUCKETS];
+            std::fill(count, count + RADIX_BUCKETS, 0);
+            for (size_t i = n * c / chunks, last = n * (c + 1) / chunks; i < last; i++)
+                count[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        });
+
+        // Every key in one bucket, this pass would not move anything
+        uint32_t digit = (keys[0] >> shift) & (RADIX_BUCKETS - 1);
+        size_t inDigit = 0;
+        for (size_t c = 0; c < chunks; c++)
+            inDigit += counts[c * RADIX_BUCKETS + digit];
+        if (inDigit == n)
+            continue;
+
+        // Turn the counts into start offsets, bucket major then chunk, so
+        // earlier chunks keep their keys ahead and the sort stays stable
+        uint32_t offset = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++)
+        {
+            for (size_t c = 0; c < chunks; c++)
+            {
+                uint32_t count = counts[c * RADIX_BUCKETS + b];
+                counts[c * RADIX_BUCKETS + b] = offset;
+                offset += count;
+            }
+        }
+
+        parallelFor(pool, chunks, [&](size_t c)
+        {
+            uint32_t *next = &counts[c * RADIX_BUCKETS];
+            for (size_t i = n * c / chunks, last = n * (c + 1) / chunks; i < last; i++)
+            {
+                uint32_t dst = next[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keysTmp[dst] = keys[i];
+                orderTmp[dst] = order[i];
+            }
+        });
+
+        std::swap(keys, keysTmp);
+        std::swap(order, orderTmp);
+    }
+
+    // Gather the triangles once, in their final order
+    sorted.resize(n);
+    parallelFor(pool, chunks, [&](size_t c)
+    {
+        for (size_t i = n * c / chunks, last = n * (c + 1) / chunks; i < last; i++)
+            sorted[i] = tris[order[i]];
+    });
+    std::swap(tris, sorted);
+}
+
+size_t depthSorter::scratchBytes() const
+{
+    return capacityBytes(keys) + capacityBytes(keysTmp) + capacityBytes(order) + capacityBytes(orderTmp) +
+           capacityBytes(counts) + capacityBytes(sorted);
+}
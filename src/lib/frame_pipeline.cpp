@@ -0,0 +1,94 @@
+#include <algorithm>
+#include "../include/frame_pipeline.hpp"
+#include "../include/profiler.hpp"
+
+// One slot for the frame the caller holds plus one per frame of latency
+framePipeline::framePipeline(geometryStage &s, unsigned latency, sceneStage *instances)
+    : stage(s), instanceStage(instances), slots(std::min(latency, MAX_PIPELINE_LATENCY) + 1)
+{
+    worker = std::thread(&framePipeline::workerLoop, this);
+}
+
+framePipeline::~framePipeline()
+{
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        stopping = true;
+    }
+    submitted.notify_one();
+    worker.join();
+}
+
+void framePipeline::submit(const mesh &m, const frameParams &params, const scene *instances)
+{
+    std::unique_lock<std::mutex> lk(lock);
+
+    // The frame last taken keeps its slot until the next take
+    uint64_t held = takeCount > 0 ? 1 : 0;
+    released.wait(lk, [&]{ return submitCount - (takeCount - held) < slots.size(); });
+
+    slot &s = slots[submitCount % slots.size()];
+    s.m = &m;
+    s.instances = instances;
+    s.params = params;
+    submitCount++;
+    lk.unlock();
+    submitted.notify_one();
+}
+
+framePipeline::frame &framePipeline::take()
+{
+    std::unique_lock<std::mutex> lk(lock);
+    finished.wait(lk, [&]{ return finishCount > takeCount; });
+
+    frame &result = slots[takeCount % slots.size()].result;
+    takeCount++;
+    lk.unlock();
+    released.notify_one();
+    return result;
+}
+
+void framePipeline::workerLoop()
+{
+    for (;;)
+    {
+        slot *s;
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            submitted.wait(lk, [&]{ return stopping || submitCount > finishCount; });
+            if (stopping) return;
+            s = &slots[finishCount % slots.size()];
+        }
+
+        // The slot belongs to this thread until it is marked finished
+        frame &result = s->result;
+        result.vp = s->params.vp;
+        result.changed = !stage.upToDate(*s->m, s->params);
+        if (result.changed)
+        {
+            PROFILE_SCOPE("geometry");
+            result.triangles.clear();
+            stage.run(*s->m, s->params, result.triangles);
+            result.cull = stage.cullCounters;
+            result.clip = stage.clipCounters;
+            result.times = stage.timeCounters;
+            result.instances = sceneStats();
+            if (instanceStage && s->instances)
+            {
+                instanceStage->run(*s->instances, s->params, result.triangles);
+                result.clip.add(instanceStage->clipCounters);
+                result.instances = instanceStage->counters;
+            }
+        }
+        else
+        {
+            result.times = stageTimes();
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            finishCount++;
+        }
+        finished.notify_one();
+    }
+}
@@ -0,0 +1,66 @@
+#include <cmath>
+#include "../include/frustum.hpp"
+
+frustum makeFrustum(const mat4x4 &m)
+{
+    // Vectors are rows multiplied on the left, so column k of m gives clip
+    // component k. Each plane is a combination of columns matching the
+    // clip space inequalities 0 <= z <= w and -w <= x, y <= w.
+    auto column = [&](int k, int r) { return m.m[r][k]; };
+
+    frustum f;
+    for (int r = 0; r < 4; r++)
+    {
+        f.planes[0][r] = column(2, r);                  // near:   z >= 0
+        f.planes[1][r] = column(3, r) - column(2, r);   // far:    w - z >= 0
+        f.planes[2][r] = column(3, r) + column(0, r);   // left:   w + x >= 0
+        f.planes[3][r] = column(3, r) - column(0, r);   // right:  w - x >= 0
+        f.planes[4][r] = column(3, r) + column(1, r);   // bottom: w + y >= 0
+        f.planes[5][r] = column(3, r) - column(1, r);   // top:    w - y >= 0
+    }
+    return f;
+}
+
+cullResult testBox(const frustum &f, const float boxMin[3], const float boxMax[3], uint32_t &planeMask)
+{
+    for (int p = 0; p < 6; p++)
+    {
+        if (!(planeMask & (1u << p)))
+            continue;
+
+        const float *plane = f.planes[p];
+
+        // Corner farthest along the plane normal, and the opposite one
+        float farthest = plane[3], nearest = plane[3];
+        for (int k = 0; k < 3; k++)
+        {
+            float lo = plane[k] * boxMin[k], hi = plane[k] * boxMax[k];
+            farthest += std::fmax(lo, hi);
+            nearest += std::fmin(lo, hi);
+        }
+
+        if (farthest < 0.0f)
+            return CULL_OUTSIDE;
+        if (nearest >= 0.0f)
+            planeMask &= ~(1u << p);
+    }
+
+    return planeMask ? CULL_INTERSECTS : CULL_INSIDE;
+}
+
+cullResult testSphere(const frustum &f, const float center[3], float radius)
+{
+    cullResult result = CULL_INSIDE;
+    for (int p = 0; p < 6; p++)
+    {
+        // The planes are not normalized, so the radius is scaled to match
+        const float *plane = f.planes[p];
+        float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+        float scaled = radius * std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (distance < -scaled)
+            return CULL_OUTSIDE;
+        if (distance < scaled)
+            result = CULL_INTERSECTS;
+    }
+    return result;
+}
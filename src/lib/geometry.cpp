@@ -1,231 +1,73 @@
 #include <SFML/Graphics.hpp>
+#include <algorithm>
 #include <cmath>
-#include <fstream>
-#include <strstream>
+#include <cstdlib>
+#include <cstring>
 #include "../include/geometry.hpp"
 
-bool mesh::loadFromObjFile(std::string filename)
+#if defined(__x86_64__) || defined(_M_X64)
+#define GEOMETRY_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+void vertexStream::resize(size_t n)
 {
-    std::ifstream f(filename);
-    if (!f.is_open()) return false;
-
-    // Local cache vertices
-    std::vector<vec3d> verts;
-
-    while (!f.eof())
-    {
-        char line[128];
-        f.getline(line, 128);
-
-        std::strstream s;
-        s << line;
-
-        char junk;
-
-        if (line[0] == 'v')
-        {
-            vec3d v;
-            s >> junk >> v.x >> v.y >> v.z;
-            verts.push_back(v);
-        }
-
-        if (line[0] == 'f')
-        {
-            int f[3];
-            s >> junk >> f[0] >> f[1] >> f[2];
-            tris.push_back({verts[f[0]-1], verts[f[1]-1], verts[f[2]-1]});
-        }
-    }
-
-    return true;
-}
-
-mat4x4 makeIdentityMatrix()
-{
-    mat4x4 matrix;
-    matrix.m[0][0] = 1.0f;
-    matrix.m[1][1] = 1.0f;
-    matrix.m[2][2] = 1.0f;
-    matrix.m[3][3] = 1.0f;
-    return matrix;
-}
-
-mat4x4 makeRotatedMatrixX(float angleRad)
-{
-    mat4x4 matrix;
-    matrix.m[0][0] = 1.0f;
-    matrix.m[1][1] = cosf(angleRad);
-    matrix.m[1][2] = sinf(angleRad);
-    matrix.m[2][1] = -sinf(angleRad);
-    matrix.m[2][2] = cosf(angleRad);
-    matrix.m[3][3] = 1.0f;
-    return matrix;
-}
-
-mat4x4 makeRotatedMatrixY(float angleRad)
-{
-    mat4x4 matrix;
-    matrix.m[0][0] = cosf(angleRad);
-    matrix.m[0][2] = sinf(angleRad);
-    matrix.m[2][0] = -sinf(angleRad);
-    matrix.m[1][1] = 1.0f;
-    matrix.m[2][2] = cosf(angleRad);
-    matrix.m[3][3] = 1.0f;
-    return matrix;
-}
-
-mat4x4 makeRotatedMatrixZ(float angleRad)
-{
-    mat4x4 matrix;
-    matrix.m[0][0] = cosf(angleRad);
-    matrix.m[0][1] = sinf(angleRad);
-    matrix.m[1][0] = -sinf(angleRad);
-    matrix.m[1][1] = cosf(angleRad);
-    matrix.m[2][2] = 1.0f;
-    matrix.m[3][3] = 1.0f;
-    return matrix;
-}
-
-mat4x4 makeTranslatedMatrix(float x, float y, float z)
-{
-    mat4x4 matrix;
-    matrix.m[0][0] = 1.0f;
-    matrix.m[1][1] = 1.0f;
-    matrix.m[2][2] = 1.0f;
-    matrix.m[3][3] = 1.0f;
-    matrix.m[3][0] = x;
-    matrix.m[3][1] = y;
-    matrix.m[3][2] = z;
-    return matrix;
-}
-
-mat4x4 makeProjectionMatrix(float fovDegrees, float aspectRatio, float near, float far)
-{
-    float fovRad = 1.0f / tanf(fovDegrees * 0.5f / 180.0f * 3.14159f);
-    mat4x4 matrix;
-    matrix.m[0][0] = aspectRatio*fovRad;
-    matrix.m[1][1] = fovRad;
-    matrix.m[2][2] = far / (far-near);
-    matrix.m[3][2] = (-far*near) / (far-near);
-    matrix.m[2][3] = 1.0f;
-    matrix.m[3][3] = 0.0f;
-    return matrix;
-}
-
-mat4x4 mulMatrices(mat4x4 &m1, mat4x4 &m2)
-{
-    mat4x4 matrix;
-    for (int c = 0; c < 4; c++)
-        for (int r = 0; r < 4; r++)
-            matrix.m[r][c] = m1.m[r][0] * m2.m[0][c]
-                            + m1.m[r][1] * m2.m[1][c]
-                            + m1.m[r][2] * m2.m[2][c]
-                            + m1.m[r][3] * m2.m[3][c];
-    return matrix;
-}
-
-mat4x4 pointAt(vec3d &pos, vec3d &forw, vec3d &up)
-{
-    // Forward direction
-    vec3d newForward = subVectors(forw, pos);
-    newForward = normVector(newForward);
-
-    // Up direction
-    vec3d a = mulVector(newForward, dotProduct(up, newForward));
-    vec3d newUp = subVectors(up, a);
-    newUp = normVector(newUp);
-
-    // Right direction
-    vec3d newRight = crossProduct(newUp, newForward);
-
-    // Point at matrix
-    mat4x4 matrix;
-    matrix.m[0][0] = newRight.x;   matrix.m[0][1] = newRight.y;   matrix.m[0][2] = newRight.z;   matrix.m[0][3] = 0.0f;
-    matrix.m[1][0] = newUp.x;      matrix.m[1][1] = newUp.y;      matrix.m[1][2] = newUp.z;      matrix.m[1][3] = 0.0f;
-    matrix.m[2][0] = newForward.x; matrix.m[2][1] = newForward.y; matrix.m[2][2] = newForward.z; matrix.m[2][3] = 0.0f;
-    matrix.m[3][0] = pos.x;        matrix.m[3][1] = pos.y;        matrix.m[3][2] = pos.z;        matrix.m[3][3] = 1.0f;
-
-    return matrix;
-}
-
-mat4x4 quickInverse(mat4x4 &m) // Only for rotation/translation matrices
-{
-    mat4x4 matrix;
-    matrix.m[0][0] = m.m[0][0]; matrix.m[0][1] = m.m[1][0]; matrix.m[0][2] = m.m[2][0]; matrix.m[0][3] = 0.0f;
-    matrix.m[1][0] = m.m[0][1]; matrix.m[1][1] = m.m[1][1]; matrix.m[1][2] = m.m[2][1]; matrix.m[1][3] = 0.0f;
-    matrix.m[2][0] = m.m[0][2]; matrix.m[2][1] = m.m[1][2]; matrix.m[2][2] = m.m[2][2]; matrix.m[2][3] = 0.0f;
-    matrix.m[3][0] = -(m.m[3][0] * matrix.m[0][0] + m.m[3][1] * matrix.m[1][0] + m.m[3][2] * matrix.m[2][0]);
-    matrix.m[3][1] = -(m.m[3][0] * matrix.m[0][1] + m.m[3][1] * matrix.m[1][1] + m.m[3][2] * matrix.m[2][1]);
-    matrix.m[3][2] = -(m.m[3][0] * matrix.m[0][2] + m.m[3][1] * matrix.m[1][2] + m.m[3][2] * matrix.m[2][2]);
-    matrix.m[3][3] = 1.0f;
-    return matrix;
-}
-
-vec3d mulMatrixByVector(mat4x4 &m, vec3d &i)
-{
-    vec3d v;
-    v.x = i.x * m.m[0][0] + i.y * m.m[1][0] + i.z * m.m[2][0] + i.w * m.m[3][0];
-    v.y = i.x * m.m[0][1] + i.y * m.m[1][1] + i.z * m.m[2][1] + i.w * m.m[3][1];
-    v.z = i.x * m.m[0][2] + i.y * m.m[1][2] + i.z * m.m[2][2] + i.w * m.m[3][2];
-    v.w = i.x * m.m[0][3] + i.y * m.m[1][3] + i.z * m.m[2][3] + i.w * m.m[3][3];
-    return v;
-}
-
-vec3d addVectors(vec3d &v1, vec3d &v2)
-{
-    return {v1.x + v2.x, v1.y + v2.y, v1.z + v2.z};
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    w.resize(n);
 }
 
-vec3d subVectors(vec3d &v1, vec3d &v2)
+void vertexStream::clear()
 {
-    return {v1.x - v2.x, v1.y - v2.y, v1.z - v2.z};
+    x.clear();
+    y.clear();
+    z.clear();
+    w.clear();
 }
 
-vec3d mulVector(vec3d &v1, float k)
+size_t vertexStream::capacityBytes() const
 {
-    return {v1.x * k, v1.y * k, v1.z * k};
+    return ::capacityBytes(x) + ::capacityBytes(y) + ::capacityBytes(z) + ::capacityBytes(w);
 }
 
-vec3d divVector(vec3d &v1, float k)
+void vertexStream::push_back(const vec3d &v)
 {
-    return {v1.x / k, v1.y / k, v1.z / k};
+    x.push_back(v.x);
+    y.push_back(v.y);
+    z.push_back(v.z);
+    w.push_back(v.w);
 }
 
-float dotProduct(vec3d &v1, vec3d &v2)
+vec3d vertexStream::get(size_t i) const
 {
-    return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
+    return { x[i], y[i], z[i], w[i] };
 }
 
-float lenVector(vec3d &v)
+vertexSpan vertexStream::span() const
 {
-    return sqrtf(dotProduct(v, v));
+    return { x.data(), y.data(), z.data(), x.size() };
 }
 
-vec3d normVector(vec3d &v)
+vertexSpan vertexSpan::slice(size_t first, size_t n) const
 {
-    float l = lenVector(v);
-    return {v.x / l, v.y / l, v.z / l};
+    return { x + first, y + first, z + first, n };
 }
 
-vec3d crossProduct(vec3d &v1, vec3d &v2)
+vec3d intersectPlane(const vec3d &planeP, const vec3d &planeNormal, const vec3d &lineStart, const vec3d &lineEnd)
 {
-    vec3d v;
-    v.x = v1.y*v2.z - v1.z*v2.y;
-    v.y = v1.z*v2.x - v1.x*v2.z;
-    v.z = v1.x*v2.y - v1.y*v2.x;
-    return v;
-}
-
-vec3d intersectPlane(vec3d &planeP, vec3d &planeN, vec3d &lineStart, vec3d&lineEnd)
-{
-    planeN = normVector(planeN);
+    vec3d planeN = normVector(planeNormal);
     float planeD = -dotProduct(planeN, planeP);
     float ad = dotProduct(lineStart, planeN);
     float bd = dotProduct(lineEnd, planeN);
     float t = (-planeD - ad) / (bd - ad);
-    vec3d lineStartToEnd = subVectors(lineEnd, lineStart);
-    vec3d lineToIntersect = mulVector(lineStartToEnd, t);
-    return addVectors(lineStart, lineToIntersect);
+    return addVectors(lineStart, mulVector(subVectors(lineEnd, lineStart), t));
 }
 
 int clipAgainstPlane(vec3d planeP, vec3d planeN, triangle &inTri, triangle &outTri1, triangle &outTri2)
@@ -235,7 +77,6 @@ int clipAgainstPlane(vec3d planeP, vec3d planeN, triangle &inTri, triangle &outT
     // Return signed shortest distance from point to plane, plane normal must be normalised
     auto dist = [&](vec3d &p)
     {
-        vec3d n = normVector(p);
         return (planeN.x*p.x + planeN.y*p.y + planeN.z*p.z - dotProduct(planeN, planeP));
     };
 
@@ -322,4 +163,283 @@ int clipAgainstPlane(vec3d planeP, vec3d planeN, triangle &inTri, triangle &outT
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Scalar reference for one vertex
+static inline void transformVertex(const mat4x4 &m, const vertexSpan &in, vertexStream &out, size_t i)
+{
+    float x = in.x[i], y = in.y[i], z = in.z[i];
+    out.x[i] = x * m.m[0][0] + y * m.m[1][0] + z * m.m[2][0] + m.m[3][0];
+    out.y[i] = x * m.m[0][1] + y * m.m[1][1] + z * m.m[2][1] + m.m[3][1];
+    out.z[i] = x * m.m[0][2] + y * m.m[1][2] + z * m.m[2][2] + m.m[3][2];
+    out.w[i] = x * m.m[0][3] + y * m.m[1][3] + z * m.m[2][3] + m.m[3][3];
+}
+
+static inline void projectVertex(const viewport &vp, const vertexStream &clip, vertexStream &out, size_t i)
+{
+    // Divide, flip X/Y back and offset into pixels like the per-triangle path
+    float invW = 1.0f / clip.w[i];
+    out.x[i] = (1.0f - clip.x[i] * invW) * (0.5f * vp.width);
+    out.y[i] = (1.0f - clip.y[i] * invW) * (0.5f * vp.height);
+    out.z[i] = clip.z[i] * invW;
+    out.w[i] = clip.w[i];
+}
+
+static void transformVerticesScalar(const mat4x4 &m, const vertexSpan &in, vertexStream &out, size_t first, size_t last)
+{
+    for (size_t i = first; i < last; i++)
+        transformVertex(m, in, out, i);
+}
+
+static void projectVerticesScalar(const viewport &vp, const vertexStream &clip, vertexStream &out, size_t first, size_t last)
+{
+    for (size_t i = first; i < last; i++)
+        projectVertex(vp, clip, out, i);
+}
+
+#ifdef GEOMETRY_X86_64
+
+// Pointers to the vertices of one group of SIMD lanes. Whole groups point
+// straight into the arrays, the last few at a zero padded copy, so every
+// vertex goes through the same instructions wherever a job boundary falls
+// and results never depend on how the work was split.
+template <size_t LANES>
+struct laneBlock
+{
+    const float *x, *y, *z, *w;
+    float *ox, *oy, *oz, *ow;
+
+    // Positions, w is not read
+    laneBlock(const vertexSpan &in, vertexStream &out, size_t i, size_t last)
+        : laneBlock(in.x, in.y, in.z, nullptr, out, i, last)
+    {
+    }
+
+    // Clip space vertices, padded lanes get w = 1
+    laneBlock(const vertexStream &in, vertexStream &out, size_t i, size_t last)
+        : laneBlock(in.x.data(), in.y.data(), in.z.data(), in.w.data(), out, i, last)
+    {
+    }
+
+    laneBlock(const float *inX, const float *inY, const float *inZ, const float *inW,
+              vertexStream &out, size_t i, size_t last)
+        : n(std::min(last - i, LANES)), out(out), i(i)
+    {
+        if (n == LANES)
+        {
+            x = &inX[i]; y = &inY[i]; z = &inZ[i]; w = inW ? &inW[i] : nullptr;
+            ox = &out.x[i]; oy = &out.y[i]; oz = &out.z[i]; ow = &out.w[i];
+            return;
+        }
+        std::copy(&inX[i], &inX[i] + n, padX);
+        std::copy(&inY[i], &inY[i] + n, padY);
+        std::copy(&inZ[i], &inZ[i] + n, padZ);
+        std::fill(padX + n, padX + LANES, 0.0f);
+        std::fill(padY + n, padY + LANES, 0.0f);
+        std::fill(padZ + n, padZ + LANES, 0.0f);
+        if (inW)
+            std::copy(&inW[i], &inW[i] + n, padW);
+        std::fill(padW + n, padW + LANES, 1.0f);
+        x = padX; y = padY; z = padZ; w = inW ? padW : nullptr;
+        ox = padOut[0]; oy = padOut[1]; oz = padOut[2]; ow = padOut[3];
+    }
+
+    // Copies a padded group's results back
+    ~laneBlock()
+    {
+        if (n == LANES)
+            return;
+        std::copy(padOut[0], padOut[0] + n, &out.x[i]);
+        std::copy(padOut[1], padOut[1] + n, &out.y[i]);
+        std::copy(padOut[2], padOut[2] + n, &out.z[i]);
+        std::copy(padOut[3], padOut[3] + n, &out.w[i]);
+    }
+
+private:
+    size_t n;
+    vertexStream &out;
+    size_t i;
+    float padX[LANES], padY[LANES], padZ[LANES], padW[LANES];
+    float padOut[4][LANES];
+};
+
+static void transformVerticesSSE(const mat4x4 &m, const vertexSpan &in, vertexStream &out, size_t first, size_t last)
+{
+    __m128 c[4][4];
+    for (int r = 0; r < 4; r++)
+        for (int k = 0; k < 4; k++)
+            c[r][k] = _mm_set1_ps(m.m[r][k]);
+
+    for (size_t i = first; i < last; i += 4)
+    {
+        laneBlock<4> b(in, out, i, last);
+        __m128 x = _mm_loadu_ps(b.x);
+        __m128 y = _mm_loadu_ps(b.y);
+        __m128 z = _mm_loadu_ps(b.z);
+
+        float *dst[4] = { b.ox, b.oy, b.oz, b.ow };
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 v = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, c[0][k]), _mm_mul_ps(y, c[1][k])),
+                _mm_add_ps(_mm_mul_ps(z, c[2][k]), c[3][k]));
+            _mm_storeu_ps(dst[k], v);
+        }
+    }
+}
+
+static void projectVerticesSSE(const viewport &vp, const vertexStream &clip, vertexStream &out, size_t first, size_t last)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 halfW = _mm_set1_ps(0.5f * vp.width);
+    const __m128 halfH = _mm_set1_ps(0.5f * vp.height);
+
+    for (size_t i = first; i < last; i += 4)
+    {
+        laneBlock<4> b(clip, out, i, last);
+        __m128 w = _mm_loadu_ps(b.w);
+        __m128 invW = _mm_div_ps(one, w);
+        _mm_storeu_ps(b.ox, _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_loadu_ps(b.x), invW)), halfW));
+        _mm_storeu_ps(b.oy, _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_loadu_ps(b.y), invW)), halfH));
+        _mm_storeu_ps(b.oz, _mm_mul_ps(_mm_loadu_ps(b.z), invW));
+        _mm_storeu_ps(b.ow, w);
+    }
+}
+
+TARGET_AVX2 static void transformVerticesAVX2(const mat4x4 &m, const vertexSpan &in, vertexStream &out, size_t first, size_t last)
+{
+    __m256 c[4][4];
+    for (int r = 0; r < 4; r++)
+        for (int k = 0; k < 4; k++)
+            c[r][k] = _mm256_set1_ps(m.m[r][k]);
+
+    for (size_t i = first; i < last; i += 8)
+    {
+        laneBlock<8> b(in, out, i, last);
+        __m256 x = _mm256_loadu_ps(b.x);
+        __m256 y = _mm256_loadu_ps(b.y);
+        __m256 z = _mm256_loadu_ps(b.z);
+
+        float *dst[4] = { b.ox, b.oy, b.oz, b.ow };
+        for (int k = 0; k < 4; k++)
+        {
+            __m256 v = _mm256_fmadd_ps(z, c[2][k], c[3][k]);
+            v = _mm256_fmadd_ps(y, c[1][k], v);
+            v = _mm256_fmadd_ps(x, c[0][k], v);
+            _mm256_storeu_ps(dst[k], v);
+        }
+    }
+}
+
+TARGET_AVX2 static void projectVerticesAVX2(const viewport &vp, const vertexStream &clip, vertexStream &out, size_t first, size_t last)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 halfW = _mm256_set1_ps(0.5f * vp.width);
+    const __m256 halfH = _mm256_set1_ps(0.5f * vp.height);
+
+    for (size_t i = first; i < last; i += 8)
+    {
+        laneBlock<8> b(clip, out, i, last);
+        __m256 w = _mm256_loadu_ps(b.w);
+
+        // (1 - ndc) * half size, as halfSize - ndc * halfSize
+        __m256 invW = _mm256_div_ps(one, w);
+        _mm256_storeu_ps(b.ox, _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(b.x), invW), halfW, halfW));
+        _mm256_storeu_ps(b.oy, _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_loadu_ps(b.y), invW), halfH, halfH));
+        _mm256_storeu_ps(b.oz, _mm256_mul_ps(_mm256_loadu_ps(b.z), invW));
+        _mm256_storeu_ps(b.ow, w);
+    }
+}
+
+bool cpuHasAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // AVX and FMA support, and the OS must save the YMM registers
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#else
+
+bool cpuHasAVX2()
+{
+    return false;
+}
+
+#endif
+
+// GRAPH_VERTEX_KERNEL=scalar|sse|avx2 caps the selection, handy for
+// comparing the SIMD paths against the scalar one
+static vertexKernels selectVertexKernels()
+{
+    const char *cap = std::getenv("GRAPH_VERTEX_KERNEL");
+    vertexKernels scalar = { transformVerticesScalar, projectVerticesScalar, "scalar" };
+    if (cap && std::strcmp(cap, "scalar") == 0) return scalar;
+
+#ifdef GEOMETRY_X86_64
+    bool allowAVX2 = !cap || std::strcmp(cap, "sse") != 0;
+    if (allowAVX2 && cpuHasAVX2())
+        return { transformVerticesAVX2, projectVerticesAVX2, "avx2" };
+    return { transformVerticesSSE, projectVerticesSSE, "sse" };
+#else
+    return scalar;
+#endif
+}
+
+std::vector<vertexKernels> supportedVertexKernels()
+{
+    std::vector<vertexKernels> kernels = { { transformVerticesScalar, projectVerticesScalar, "scalar" } };
+#ifdef GEOMETRY_X86_64
+    kernels.push_back({ transformVerticesSSE, projectVerticesSSE, "sse" });
+    if (cpuHasAVX2())
+        kernels.push_back({ transformVerticesAVX2, projectVerticesAVX2, "avx2" });
+#endif
+    return kernels;
+}
+
+static const vertexKernels &vertexKernelTable()
+{
+    static const vertexKernels kernels = selectVertexKernels();
+    return kernels;
+}
+
+void transformVertices(const mat4x4 &m, const vertexSpan &in, vertexStream &out)
+{
+    out.resize(in.size());
+    vertexKernelTable().transform(m, in, out, 0, in.size());
+}
+
+void transformVertices(const mat4x4 &m, const vertexSpan &in, vertexStream &out, size_t first, size_t last)
+{
+    vertexKernelTable().transform(m, in, out, first, last);
+}
+
+void projectVertices(const viewport &vp, const vertexStream &clip, vertexStream &out)
+{
+    out.resize(clip.size());
+    vertexKernelTable().project(vp, clip, out, 0, clip.size());
+}
+
+void projectVertices(const viewport &vp, const vertexStream &clip, vertexStream &out, size_t first, size_t last)
+{
+    vertexKernelTable().project(vp, clip, out, first, last);
+}
+
+const char *vertexKernelName()
+{
+    return vertexKernelTable().name;
+}
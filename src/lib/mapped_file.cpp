@@ -0,0 +1,112 @@
+#include "../include/mapped_file.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mappedFile::~mappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool mappedFile::open(const std::string &filename)
+{
+    close();
+
+    HANDLE f = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    file = f;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(f, &fileSize))
+    {
+        close();
+        return false;
+    }
+
+    // Empty files cannot be mapped, but they are still valid files
+    size = (size_t)fileSize.QuadPart;
+    if (size == 0) return true;
+
+    HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m)
+    {
+        close();
+        return false;
+    }
+    mapping = m;
+
+    data = static_cast<const char*>(MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0));
+    if (!data)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void mappedFile::close()
+{
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    data = nullptr;
+    size = 0;
+    mapping = nullptr;
+    file = nullptr;
+}
+
+#else
+
+bool mappedFile::open(const std::string &filename)
+{
+    close();
+
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close();
+        return false;
+    }
+
+    // Empty files cannot be mapped, but they are still valid files
+    size = (size_t)st.st_size;
+    if (size == 0) return true;
+
+    void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    madvise(p, size, MADV_SEQUENTIAL);
+
+    data = static_cast<const char*>(p);
+    return true;
+}
+
+void mappedFile::close()
+{
+    if (data) munmap(const_cast<char*>(data), size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <utility>
+#include "../include/mesh.hpp"
+#include "../include/mapped_file.hpp"
+
+static uint64_t newMeshVersion()
+{
+    static std::atomic<uint64_t> next{ 1 };
+    return next++;
+}
+
+mesh::mesh()
+    : version(newMeshVersion())
+{
+}
+
+mesh::~mesh() = default;
+mesh::mesh(mesh &&) noexcept = default;
+mesh &mesh::operator=(mesh &&) noexcept = default;
+
+void mesh::clear()
+{
+    verts = {};
+    indices = {};
+    faceNormals = {};
+    nodes = {};
+    lodIndices = {};
+    lodNormals = {};
+    lodChunks = {};
+    lodLevels = {};
+    boundsMin = {};
+    boundsMax = {};
+    version = newMeshVersion();
+
+    ownedX.clear();
+    ownedY.clear();
+    ownedZ.clear();
+    ownedIndices.clear();
+    ownedNormals.clear();
+    ownedNodes.clear();
+    ownedLodIndices.clear();
+    ownedLodNormals.clear();
+    ownedLodChunks.clear();
+    ownedLodLevels.clear();
+    mapping.reset();
+}
+
+// Builds the hierarchy, points the views at the owned arrays and derives
+// per-face normals, normal cones, levels of detail and the bounding box,
+// after the owned positions and indices were filled
+void mesh::finalize()
+{
+    buildHierarchy();
+
+    verts = { ownedX.data(), ownedY.data(), ownedZ.data(), ownedX.size() };
+    indices = { ownedIndices.data(), ownedIndices.size() };
+
+    ownedNormals.resize(triangleCount());
+    for (size_t t = 0; t < ownedNormals.size(); t++)
+    {
+        vec3d p0 = verts.get(indices[t*3 + 0]);
+        vec3d p1 = verts.get(indices[t*3 + 1]);
+        vec3d p2 = verts.get(indices[t*3 + 2]);
+
+        vec3d line1 = subVectors(p1, p0);
+        vec3d line2 = subVectors(p2, p0);
+        vec3d normal = crossProduct(line1, line2);
+
+        // Degenerate triangles keep a zero normal instead of NaNs
+        float l = lenVector(normal);
+        ownedNormals[t] = l > 0.0f ? divVector(normal, l) : vec3d{ 0, 0, 0, 0 };
+        ownedNormals[t].w = 0.0f;
+    }
+    faceNormals = { ownedNormals.data(), ownedNormals.size() };
+    buildNormalCones();
+    buildLods();
+    nodes = { ownedNodes.data(), ownedNodes.size() };
+    lodIndices = { ownedLodIndices.data(), ownedLodIndices.size() };
+    lodNormals = { ownedLodNormals.data(), ownedLodNormals.size() };
+    lodChunks = { ownedLodChunks.data(), ownedLodChunks.size() };
+    lodLevels = { ownedLodLevels.data(), ownedLodLevels.size() };
+
+    boundsMin = { INFINITY, INFINITY, INFINITY };
+    boundsMax = { -INFINITY, -INFINITY, -INFINITY };
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        boundsMin = { std::min(boundsMin.x, verts.x[i]), std::min(boundsMin.y, verts.y[i]), std::min(boundsMin.z, verts.z[i]) };
+        boundsMax = { std::max(boundsMax.x, verts.x[i]), std::max(boundsMax.y, verts.y[i]), std::max(boundsMax.z, verts.z[i]) };
+    }
+    if (verts.size() == 0)
+        boundsMin = boundsMax = {};
+}
+
+bool mesh::loadFromArrays(std::vector<float> x, std::vector<float> y, std::vector<float> z,
+                          std::vector<uint32_t> triangleIndices, std::string *error)
+{
+    auto fail = [&](const std::string &message)
+    {
+        if (error) *error = message;
+        return false;
+    };
+
+    if (y.size() != x.size() || z.size() != x.size())
+        return fail("coordinate arrays differ in length");
+    if (triangleIndices.size() % 3 != 0)
+        return fail("index count is not a multiple of three");
+    for (uint32_t idx : triangleIndices)
+        if (idx >= x.size())
+            return fail("vertex index " + std::to_string(idx) + " out of range");
+
+    clear();
+    ownedX = std::move(x);
+    ownedY = std::move(y);
+    ownedZ = std::move(z);
+    ownedIndices = std::move(triangleIndices);
+    finalize();
+    return true;
+}
+
+std::string mesh::cacheFileName(const std::string &objFilename)
+{
+    return std::filesystem::path(objFilename).replace_extension(".gmesh").string();
+}
+
+bool mesh::load(const std::string &filename, std::string *error)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    std::string cacheFile = cacheFileName(filename);
+    auto cacheTime = fs::last_write_time(cacheFile, ec);
+    bool cacheExists = !ec;
+    auto objTime = fs::last_write_time(filename, ec);
+
+    // A stale or unreadable cache is not fatal, the OBJ is the source of truth
+    if (cacheExists && (ec || cacheTime >= objTime) && loadFromCacheFile(cacheFile))
+        return true;
+
+    return loadFromObjFile(filename, error);
+}
@@ -0,0 +1,225 @@
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "../include/mapped_file.hpp"
+#include "../include/mesh.hpp"
+
+static uint64_t alignSection(uint64_t offset)
+{
+    return (offset + 63) & ~(uint64_t)63;
+}
+
+uint64_t meshCacheChecksum(const char *data, size_t size)
+{
+    const uint64_t prime = 1099511628211ull;
+    uint64_t hash = 14695981039346656037ull;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ (uint8_t)data[i]) * prime;
+
+    return hash;
+}
+
+// Walks the hierarchy in its stored order and returns the first way it
+// breaks the layout traversals rely on, nullptr when it has none: nodes
+// depth first with the first child right after its parent and the
+// second right after the first's subtree, children splitting their
+// parent's triangles between them, the root holding all of them, and no
+// more than MESH_MAX_DEPTH levels. The walk's own stack is bounded the
+// same way.
+static const char *hierarchyError(const meshNode *nodes, uint32_t count, uint32_t triangles)
+{
+    if (count == 0)
+        return nullptr;
+    if (nodes[0].first != 0 || nodes[0].count != triangles)
+        return "hierarchy root does not hold every triangle";
+
+    struct entry
+    {
+        uint32_t node;
+        uint32_t depth;
+    };
+    entry stack[MESH_MAX_DEPTH];
+    int top = 0;
+    stack[top++] = { 0, 1 };
+    uint32_t next = 0;
+    while (top > 0)
+    {
+        entry e = stack[--top];
+        if (e.node != next)
+            return "hierarchy is not stored depth first";
+        next++;
+
+        const meshNode &node = nodes[e.node];
+        if (node.isLeaf())
+            continue;
+        if (e.depth == MESH_MAX_DEPTH)
+            return "hierarchy is too deep";
+        if (e.node + 1 >= count)
+            return "hierarchy is not stored depth first";
+
+        const meshNode &a = nodes[e.node + 1], &b = nodes[node.secondChild];
+        if (a.first != node.first || (uint64_t)b.first != (uint64_t)a.first + a.count
+            || (uint64_t)a.count + b.count != node.count)
+            return "hierarchy children do not split their parent's triangles";
+        stack[top++] = { node.secondChild, e.depth + 1 };
+        stack[top++] = { e.node + 1, e.depth + 1 };
+    }
+    return next == count ? nullptr : "hierarchy is not stored depth first";
+}
+
+bool mesh::saveToCacheFile(const std::string &filename, std::string *error) const
+{
+    meshCacheHeader h = {};
+    std::memcpy(h.magic, "GMSH", 4);
+    h.version = MESH_CACHE_VERSION;
+    h.vertexCount = (uint32_t)verts.size();
+    h.indexCount = (uint32_t)indices.size();
+    h.boundsMin[0] = boundsMin.x; h.boundsMin[1] = boundsMin.y; h.boundsMin[2] = boundsMin.z;
+    h.boundsMax[0] = boundsMax.x; h.boundsMax[1] = boundsMax.y; h.boundsMax[2] = boundsMax.z;
+
+    size_t positionBytes = verts.size() * sizeof(float);
+    h.xOffset = alignSection(sizeof(h));
+    h.yOffset = alignSection(h.xOffset + positionBytes);
+    h.zOffset = alignSection(h.yOffset + positionBytes);
+    h.indexOffset = alignSection(h.zOffset + positionBytes);
+    h.normalOffset = alignSection(h.indexOffset + indices.size() * sizeof(uint32_t));
+    h.nodeOffset = alignSection(h.normalOffset + faceNormals.size() * sizeof(vec3d));
+    h.nodeCount = (uint32_t)nodes.size();
+    h.lodIndexCount = (uint32_t)lodIndices.size();
+    h.lodChunkCount = (uint32_t)lodChunks.size();
+    h.lodLevelCount = (uint32_t)lodLevels.size();
+    h.lodIndexOffset = alignSection(h.nodeOffset + nodes.size() * sizeof(meshNode));
+    h.lodNormalOffset = alignSection(h.lodIndexOffset + lodIndices.size() * sizeof(uint32_t));
+    h.lodChunkOffset = alignSection(h.lodNormalOffset + lodNormals.size() * sizeof(vec3d));
+    h.lodLevelOffset = alignSection(h.lodChunkOffset + lodChunks.size() * sizeof(meshLodChunk));
+    h.fileSize = h.lodLevelOffset + lodLevels.size() * sizeof(meshLodLevel);
+
+    // Assemble the whole payload first, the checksum needs all of it
+    std::vector<char> file((size_t)h.fileSize, 0);
+    std::memcpy(file.data() + h.xOffset, verts.x, positionBytes);
+    std::memcpy(file.data() + h.yOffset, verts.y, positionBytes);
+    std::memcpy(file.data() + h.zOffset, verts.z, positionBytes);
+    std::memcpy(file.data() + h.indexOffset, indices.data(), indices.size() * sizeof(uint32_t));
+    std::memcpy(file.data() + h.normalOffset, faceNormals.data(), faceNormals.size() * sizeof(vec3d));
+    std::memcpy(file.data() + h.nodeOffset, nodes.data(), nodes.size() * sizeof(meshNode));
+    std::memcpy(file.data() + h.lodIndexOffset, lodIndices.data(), lodIndices.size() * sizeof(uint32_t));
+    std::memcpy(file.data() + h.lodNormalOffset, lodNormals.data(), lodNormals.size() * sizeof(vec3d));
+    std::memcpy(file.data() + h.lodChunkOffset, lodChunks.data(), lodChunks.size() * sizeof(meshLodChunk));
+    std::memcpy(file.data() + h.lodLevelOffset, lodLevels.data(), lodLevels.size() * sizeof(meshLodLevel));
+
+    h.checksum = meshCacheChecksum(file.data() + sizeof(h), file.size() - sizeof(h));
+    std::memcpy(file.data(), &h, sizeof(h));
+
+    std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+    if (f.is_open())
+        f.write(file.data(), file.size());
+    if (!f.is_open() || !f.good())
+    {
+        if (error) *error = filename + ": could not write cache";
+        return false;
+    }
+
+    return true;
+}
+
+bool mesh::loadFromCacheFile(const std::string &filename, std::string *error)
+{
+    auto fail = [&](const char *message)
+    {
+        if (error) *error = filename + ": " + message;
+        clear();
+        return false;
+    };
+
+    clear();
+
+    mapping.reset(new mappedFile());
+    if (!mapping->open(filename)) return fail("could not open file");
+
+    const char *data = mapping->data;
+    size_t size = mapping->size;
+
+    meshCacheHeader h;
+    if (size < sizeof(h)) return fail("truncated header");
+    std::memcpy(&h, data, sizeof(h));
+
+    if (std::memcmp(h.magic, "GMSH", 4) != 0) return fail("not a mesh cache");
+    if (h.version != MESH_CACHE_VERSION) return fail("unsupported cache version");
+    if (h.fileSize != size) return fail("size does not match header");
+    if (h.indexCount % 3 != 0 || h.lodIndexCount % 3 != 0) return fail("index count is not a multiple of three");
+
+    // Every section must sit inside the file at its aligned offset
+    auto fits = [&](uint64_t offset, uint64_t bytes)
+    {
+        return offset % 64 == 0 && offset >= sizeof(h) && offset <= size && bytes <= size - offset;
+    };
+    uint64_t positionBytes = (uint64_t)h.vertexCount * sizeof(float);
+    if (!fits(h.xOffset, positionBytes) || !fits(h.yOffset, positionBytes) || !fits(h.zOffset, positionBytes)
+        || !fits(h.indexOffset, (uint64_t)h.indexCount * sizeof(uint32_t))
+        || !fits(h.normalOffset, (uint64_t)(h.indexCount / 3) * sizeof(vec3d))
+        || !fits(h.nodeOffset, (uint64_t)h.nodeCount * sizeof(meshNode))
+        || !fits(h.lodIndexOffset, (uint64_t)h.lodIndexCount * sizeof(uint32_t))
+        || !fits(h.lodNormalOffset, (uint64_t)(h.lodIndexCount / 3) * sizeof(vec3d))
+        || !fits(h.lodChunkOffset, (uint64_t)h.lodChunkCount * sizeof(meshLodChunk))
+        || !fits(h.lodLevelOffset, (uint64_t)h.lodLevelCount * sizeof(meshLodLevel)))
+        return fail("corrupt section table");
+
+    if (meshCacheChecksum(data + sizeof(h), size - sizeof(h)) != h.checksum)
+        return fail("checksum mismatch");
+
+    // The checksum only says the file is as written, not that the writer
+    // was sound; every index is used unchecked from here on
+    auto indicesFit = [&](uint64_t offset, uint32_t count)
+    {
+        const uint32_t *p = reinterpret_cast<const uint32_t*>(data + offset);
+        for (uint32_t i = 0; i < count; i++)
+            if (p[i] >= h.vertexCount) return false;
+        return true;
+    };
+    if (!indicesFit(h.indexOffset, h.indexCount) || !indicesFit(h.lodIndexOffset, h.lodIndexCount))
+        return fail("vertex index out of range");
+
+    const meshNode *cachedNodes = reinterpret_cast<const meshNode*>(data + h.nodeOffset);
+    for (uint32_t i = 0; i < h.nodeCount; i++)
+    {
+        const meshNode &n = cachedNodes[i];
+        if ((uint64_t)n.first + n.count > h.indexCount / 3 || n.vertexFirst > n.vertexLast || n.vertexLast > h.vertexCount
+            || (!n.isLeaf() && (n.secondChild <= i || n.secondChild >= h.nodeCount)) || n.lodChunk > h.lodChunkCount)
+            return fail("node out of range");
+    }
+    if (const char *message = hierarchyError(cachedNodes, h.nodeCount, h.indexCount / 3))
+        return fail(message);
+    const meshLodChunk *cachedChunks = reinterpret_cast<const meshLodChunk*>(data + h.lodChunkOffset);
+    for (uint32_t i = 0; i < h.lodChunkCount; i++)
+        if (cachedChunks[i].node >= h.nodeCount || (uint64_t)cachedChunks[i].levelFirst + cachedChunks[i].levelCount > h.lodLevelCount)
+            return fail("LOD chunk out of range");
+    const meshLodLevel *cachedLevels = reinterpret_cast<const meshLodLevel*>(data + h.lodLevelOffset);
+    for (uint32_t i = 0; i < h.lodLevelCount; i++)
+        if ((uint64_t)cachedLevels[i].first + cachedLevels[i].count > h.lodIndexCount / 3)
+            return fail("LOD level out of range");
+
+    // Use the mapped arrays in place
+    verts.x = reinterpret_cast<const float*>(data + h.xOffset);
+    verts.y = reinterpret_cast<const float*>(data + h.yOffset);
+    verts.z = reinterpret_cast<const float*>(data + h.zOffset);
+    verts.count = h.vertexCount;
+    indices = { reinterpret_cast<const uint32_t*>(data + h.indexOffset), h.indexCount };
+    faceNormals = { reinterpret_cast<const vec3d*>(data + h.normalOffset), h.indexCount / 3 };
+    nodes = { reinterpret_cast<const meshNode*>(data + h.nodeOffset), h.nodeCount };
+    lodIndices = { reinterpret_cast<const uint32_t*>(data + h.lodIndexOffset), h.lodIndexCount };
+    lodNormals = { reinterpret_cast<const vec3d*>(data + h.lodNormalOffset), h.lodIndexCount / 3 };
+    lodChunks = { reinterpret_cast<const meshLodChunk*>(data + h.lodChunkOffset), h.lodChunkCount };
+    lodLevels = { reinterpret_cast<const meshLodLevel*>(data + h.lodLevelOffset), h.lodLevelCount };
+    boundsMin = { h.boundsMin[0], h.boundsMin[1], h.boundsMin[2] };
+    boundsMax = { h.boundsMax[0], h.boundsMax[1], h.boundsMax[2] };
+
+    return true;
+}
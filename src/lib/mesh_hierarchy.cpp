@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../include/mesh.hpp"
+
+// Bounding volume hierarchy over the triangles of a freshly loaded mesh.
+// Triangles are split at the median centroid along the longest axis until
+// at most MESH_LEAF_TRIANGLES are left (near the bottom, by orientation
+// when the normals spread too far), then the index buffer is put in
+// leaf order and vertices are renumbered by first use, which keeps every
+// leaf's vertices close together for culled transforms and the caches.
+
+namespace
+{
+
+// Spread of one normal component (out of 2) above which a small node is
+// split by orientation rather than position
+const float NORMAL_SPLIT_SPREAD = 0.7f;
+
+struct hierarchyBuilder
+{
+    std::vector<float> centroids;   // three per triangle
+    std::vector<float> normals;     // three per triangle, unit or zero
+    std::vector<uint32_t> order;    // triangle permutation, leaf order once built
+    std::vector<meshNode> &nodes;
+
+    uint32_t build(uint32_t first, uint32_t count)
+    {
+        uint32_t self = (uint32_t)nodes.size();
+        nodes.push_back({});
+        nodes[self].first = first;
+        nodes[self].count = count;
+
+        if (count <= MESH_LEAF_TRIANGLES)
+            return self;
+
+        float lo[3] = { INFINITY, INFINITY, INFINITY };
+        float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                lo[k] = std::min(lo[k], centroids[order[i]*3 + k]);
+                hi[k] = std::max(hi[k], centroids[order[i]*3 + k]);
+            }
+        }
+
+        int axis = 0;
+        for (int k = 1; k < 3; k++)
+            if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+        const std::vector<float> *key = &centroids;
+
+        // Close to cluster size, triangles facing very different ways are
+        // split apart first so the clusters get tight normal cones
+        if (count <= 16 * MESH_LEAF_TRIANGLES)
+        {
+            float nlo[3] = { 1, 1, 1 }, nhi[3] = { -1, -1, -1 };
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    nlo[k] = std::min(nlo[k], normals[order[i]*3 + k]);
+                    nhi[k] = std::max(nhi[k], normals[order[i]*3 + k]);
+                }
+            }
+
+            int normalAxis = 0;
+            for (int k = 1; k < 3; k++)
+                if (nhi[k] - nlo[k] > nhi[normalAxis] - nlo[normalAxis]) normalAxis = k;
+            if (nhi[normalAxis] - nlo[normalAxis] > NORMAL_SPLIT_SPREAD)
+            {
+                axis = normalAxis;
+                key = &normals;
+            }
+        }
+
+        uint32_t mid = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count,
+            [&](uint32_t a, uint32_t b) { return (*key)[a*3 + axis] < (*key)[b*3 + axis]; });
+
+        build(first, mid - first);
+        uint32_t second = build(mid, first + count - mid);
+        nodes[self].secondChild = second;
+        return self;
+    }
+};
+
+// Fills in bounds and vertex ranges bottom up
+void fitNode(std::vector<meshNode> &nodes, uint32_t n, const std::vector<float> &x, const std::vector<float> &y,
+             const std::vector<float> &z, const std::vector<uint32_t> &indices)
+{
+    meshNode &node = nodes[n];
+
+    float lo[3] = { INFINITY, INFINITY, INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    uint32_t vertexFirst = UINT32_MAX, vertexLast = 0;
+
+    if (node.isLeaf())
+    {
+        for (size_t i = (size_t)node.first * 3; i < ((size_t)node.first + node.count) * 3; i++)
+        {
+            uint32_t v = indices[i];
+            lo[0] = std::min(lo[0], x[v]); hi[0] = std::max(hi[0], x[v]);
+            lo[1] = std::min(lo[1], y[v]); hi[1] = std::max(hi[1], y[v]);
+            lo[2] = std::min(lo[2], z[v]); hi[2] = std::max(hi[2], z[v]);
+            vertexFirst = std::min(vertexFirst, v);
+            vertexLast = std::max(vertexLast, v + 1);
+        }
+    }
+    else
+    {
+        uint32_t children[2] = { n + 1, node.secondChild };
+        for (uint32_t c : children)
+        {
+            fitNode(nodes, c, x, y, z, indices);
+            const meshNode &child = nodes[c];
+            for (int k = 0; k < 3; k++)
+            {
+                lo[k] = std::min(lo[k], child.boundsMin[k]);
+                hi[k] = std::max(hi[k], child.boundsMax[k]);
+            }
+            vertexFirst = std::min(vertexFirst, child.vertexFirst);
+            vertexLast = std::max(vertexLast, child.vertexLast);
+        }
+    }
+
+    meshNode &out = nodes[n];
+    for (int k = 0; k < 3; k++)
+    {
+        out.boundsMin[k] = lo[k];
+        out.boundsMax[k] = hi[k];
+    }
+    out.vertexFirst = vertexFirst;
+    out.vertexLast = vertexLast;
+}
+
+}
+
+void mesh::buildHierarchy()
+{
+    ownedNodes.clear();
+
+    uint32_t triCount = (uint32_t)(ownedIndices.size() / 3);
+    if (triCount == 0)
+        return;
+
+    hierarchyBuilder builder = { {}, {}, {}, ownedNodes };
+    builder.centroids.resize((size_t)triCount * 3);
+    builder.normals.resize((size_t)triCount * 3);
+    builder.order.resize(triCount);
+    for (uint32_t t = 0; t < triCount; t++)
+    {
+        builder.order[t] = t;
+
+        vec3d p[3];
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t v = ownedIndices[(size_t)t*3 + c];
+            p[c] = { ownedX[v], ownedY[v], ownedZ[v] };
+            builder.centroids[(size_t)t*3 + 0] += p[c].x / 3.0f;
+            builder.centroids[(size_t)t*3 + 1] += p[c].y / 3.0f;
+            builder.centroids[(size_t)t*3 + 2] += p[c].z / 3.0f;
+        }
+
+        vec3d line1 = subVectors(p[1], p[0]);
+        vec3d line2 = subVectors(p[2], p[0]);
+        vec3d normal = crossProduct(line1, line2);
+        float l = lenVector(normal);
+        if (l > 0.0f)
+        {
+            builder.normals[(size_t)t*3 + 0] = normal.x / l;
+            builder.normals[(size_t)t*3 + 1] = normal.y / l;
+            builder.normals[(size_t)t*3 + 2] = normal.z / l;
+        }
+    }
+    builder.build(0, triCount);
+
+    // Triangles in leaf order, vertices renumbered by first use. Vertices
+    // no triangle uses end up behind all the others.
+    std::vector<uint32_t> remap(ownedX.size(), UINT32_MAX);
+    std::vector<uint32_t> sortedIndices(ownedIndices.size());
+    uint32_t nextVertex = 0;
+    for (uint32_t t = 0; t < triCount; t++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t v = ownedIndices[(size_t)builder.order[t]*3 + c];
+            if (remap[v] == UINT32_MAX)
+                remap[v] = nextVertex++;
+            sortedIndices[(size_t)t*3 + c] = remap[v];
+        }
+    }
+    for (auto &r : remap)
+        if (r == UINT32_MAX)
+            r = nextVertex++;
+
+    std::vector<float> sortedX(ownedX.size()), sortedY(ownedY.size()), sortedZ(ownedZ.size());
+    for (size_t v = 0; v < remap.size(); v++)
+    {
+        sortedX[remap[v]] = ownedX[v];
+        sortedY[remap[v]] = ownedY[v];
+        sortedZ[remap[v]] = ownedZ[v];
+    }
+    ownedX.swap(sortedX);
+    ownedY.swap(sortedY);
+    ownedZ.swap(sortedZ);
+    ownedIndices.swap(sortedIndices);
+
+    fitNode(ownedNodes, 0, ownedX, ownedY, ownedZ, ownedIndices);
+}
+
+// Normal cone of every node from the face normals of its triangles. The
+// axis is the normalized mean normal and the cone just wide enough to hold
+// all of them. Degenerate triangles have no normal and are never drawn,
+// so they are left out.
+void mesh::buildNormalCones()
+{
+    for (auto &node : ownedNodes)
+    {
+        vec3d sum = { 0, 0, 0, 0 };
+        for (uint32_t t = node.first; t < node.first + node.count; t++)
+            sum = addVectors(sum, ownedNormals[t]);
+
+        float length = lenVector(sum);
+        node.coneAxis[0] = node.coneAxis[1] = node.coneAxis[2] = 0.0f;
+        node.coneCos = -1.0f;
+        if (length <= 0.0f)
+            continue;
+
+        vec3d axis = divVector(sum, length);
+        float minCos = 1.0f;
+        for (uint32_t t = node.first; t < node.first + node.count; t++)
+        {
+            vec3d n = ownedNormals[t];
+            if (n.x != 0.0f || n.y != 0.0f || n.z != 0.0f)
+                minCos = std::min(minCos, dotProduct(axis, n));
+        }
+
+        node.coneAxis[0] = axis.x;
+        node.coneAxis[1] = axis.y;
+        node.coneAxis[2] = axis.z;
+        // Widened a little so rounding can never make the cone too tight
+        node.coneCos = std::max(-1.0f, minCos - 1e-4f);
+    }
+}
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../include/mesh.hpp"
+
+// Levels of detail by quadric error edge collapse (Garland and Heckbert).
+// Every vertex carries the sum of the squared distance quadrics of the
+// planes of its original triangles. The cheapest edge is collapsed into
+// one of its two end points, so no new vertices are ever made and the
+// coarser levels are nothing but extra index buffers. The error stored
+// with a level is the largest square root of a collapse cost so far. A
+// cost is the sum, not the mean, of the squared distances of the kept
+// vertex to the (unit normal) planes of every triangle it absorbed, so
+// its square root is at least each of those distances and bounds how far
+// the surface moved there.
+
+namespace
+{
+
+// Owner markers for vertexChunk in buildLods
+const uint32_t UNUSED_VERTEX = UINT32_MAX - 1;
+const uint32_t SHARED_VERTEX = UINT32_MAX;
+
+// Symmetric 4x4 matrix, upper triangle only
+struct quadric
+{
+    double q[10] = { 0 };
+
+    void addPlane(double a, double b, double c, double d)
+    {
+        q[0] += a*a; q[1] += a*b; q[2] += a*c; q[3] += a*d;
+        q[4] += b*b; q[5] += b*c; q[6] += b*d;
+        q[7] += c*c; q[8] += c*d;
+        q[9] += d*d;
+    }
+
+    void add(const quadric &o)
+    {
+        for (int i = 0; i < 10; i++)
+            q[i] += o.q[i];
+    }
+
+    double evaluate(double x, double y, double z) const
+    {
+        return x*x*q[0] + 2*x*y*q[1] + 2*x*z*q[2] + 2*x*q[3]
+             + y*y*q[4] + 2*y*z*q[5] + 2*y*q[6]
+             + z*z*q[7] + 2*z*q[8]
+             + q[9];
+    }
+};
+
+struct collapse
+{
+    double cost;
+    uint32_t from, to;              // local vertices
+    uint32_t fromVersion, toVersion;
+
+    bool operator<(const collapse &o) const { return cost > o.cost; }
+};
+
+// Triangles around a vertex, as singly linked lists in one pool
+struct fanEntry
+{
+    uint32_t tri;
+    uint32_t next;
+};
+
+// Simplifies one chunk level by level, with vertices renumbered locally.
+// One simplifier is reused for every chunk so its buffers are only grown.
+struct chunkSimplifier
+{
+    const std::vector<float> &x, &y, &z;
+
+    std::vector<uint32_t> global;               // local -> global vertex
+    std::vector<bool> locked, removed;
+    std::vector<uint32_t> version;
+    std::vector<quadric> quadrics;
+    std::vector<uint32_t> fanHead;              // first fan entry per vertex
+    std::vector<fanEntry> fans;
+    std::vector<uint32_t> tris;                 // three local vertices each
+    std::vector<bool> alive;
+    size_t aliveCount = 0;
+    double maxCost = 0.0;
+    std::vector<collapse> heap;                 // min heap by cost
+
+    vec3d position(uint32_t v) const
+    {
+        uint32_t g = global[v];
+        return { x[g], y[g], z[g] };
+    }
+
+    vec3d faceNormal(uint32_t a, uint32_t b, uint32_t c) const
+    {
+        vec3d p0 = position(a), p1 = position(b), p2 = position(c);
+        vec3d line1 = subVectors(p1, p0);
+        vec3d line2 = subVectors(p2, p0);
+        return crossProduct(line1, line2);
+    }
+
+    chunkSimplifier(const std::vector<float> &x, const std::vector<float> &y, const std::vector<float> &z)
+        : x(x), y(y), z(z)
+    {
+    }
+
+    void reset()
+    {
+        global.clear();
+        locked.clear();
+        tris.clear();
+        fans.clear();
+        maxCost = 0.0;
+    }
+
+    void addToFan(uint32_t v, uint32_t t)
+    {
+        fans.push_back({ t, fanHead[v] });
+        fanHead[v] = (uint32_t)(fans.size() - 1);
+    }
+
+    void pushEdge(uint32_t a, uint32_t b)
+    {
+        if (!locked[a]) pushCollapse(a, b);
+        if (!locked[b]) pushCollapse(b, a);
+    }
+
+    // Every edge leaving v in winding order. Around an inner vertex that is
+    // each neighbour once; the one edge missed at a border vertex joins two
+    // locked vertices and could not be collapsed anyway.
+    void pushEdges(uint32_t v)
+    {
+        for (uint32_t f = fanHead[v]; f != UINT32_MAX; f = fans[f].next)
+        {
+            uint32_t t = fans[f].tri;
+            if (!alive[t]) continue;
+            for (int k = 0; k < 3; k++)
+                if (tris[t*3 + k] == v)
+                    pushEdge(v, tris[t*3 + (k + 1) % 3]);
+        }
+    }
+
+    void pushCollapse(uint32_t from, uint32_t to)
+    {
+        quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        vec3d p = position(to);
+        double cost = std::max(0.0, q.evaluate(p.x, p.y, p.z));
+        heap.push_back({ cost, from, to, version[from], version[to] });
+        std::push_heap(heap.begin(), heap.end());
+    }
+
+    // Moving from onto to must not flip or squash any triangle that stays
+    bool collapseKeepsShape(uint32_t from, uint32_t to) const
+    {
+        for (uint32_t f = fanHead[from]; f != UINT32_MAX; f = fans[f].next)
+        {
+            uint32_t t = fans[f].tri;
+            if (!alive[t]) continue;
+            uint32_t v[3] = { tris[t*3], tris[t*3 + 1], tris[t*3 + 2] };
+            if (v[0] == to || v[1] == to || v[2] == to) continue;
+
+            vec3d before = faceNormal(v[0], v[1], v[2]);
+            for (auto &corner : v)
+                if (corner == from) corner = to;
+            vec3d after = faceNormal(v[0], v[1], v[2]);
+
+            float lb = lenVector(before), la = lenVector(after);
+            if (la <= 1e-12f * std::max(1.0f, lb)) return false;
+            if (dotProduct(before, after) < 0.2f * lb * la) return false;
+        }
+        return true;
+    }
+
+    void applyCollapse(const collapse &c)
+    {
+        for (uint32_t f = fanHead[c.from]; f != UINT32_MAX; f = fans[f].next)
+        {
+            uint32_t t = fans[f].tri;
+            if (!alive[t]) continue;
+            uint32_t *v = &tris[t*3];
+            if (v[0] == c.to || v[1] == c.to || v[2] == c.to)
+            {
+                alive[t] = false;
+                aliveCount--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+                if (v[k] == c.from) v[k] = c.to;
+            addToFan(c.to, t);
+        }
+
+        removed[c.from] = true;
+        quadrics[c.to].add(quadrics[c.from]);
+        version[c.to]++;
+        maxCost = std::max(maxCost, c.cost);
+        pushEdges(c.to);
+    }
+
+    // Collapses until about half the triangles are left or nothing can go
+    void simplifyLevel()
+    {
+        // Every inner edge shows up in two triangles, once in each direction
+        heap.clear();
+        for (uint32_t t = 0; t < alive.size(); t++)
+        {
+            if (!alive[t]) continue;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = tris[t*3 + k], b = tris[t*3 + (k + 1) % 3];
+                if (a < b) pushEdge(a, b);
+            }
+        }
+
+        size_t target = aliveCount / 2;
+        while (aliveCount > target && !heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end());
+            collapse c = heap.back();
+            heap.pop_back();
+
+            if (removed[c.from] || removed[c.to]) continue;
+            if (version[c.from] != c.fromVersion || version[c.to] != c.toVersion) continue;
+            if (!collapseKeepsShape(c.from, c.to)) continue;
+
+            applyCollapse(c);
+        }
+    }
+};
+
+}
+
+void mesh::buildLods()
+{
+    ownedLodIndices.clear();
+    ownedLodNormals.clear();
+    ownedLodChunks.clear();
+    ownedLodLevels.clear();
+
+    // Chunks are the highest nodes that are small enough
+    std::vector<uint32_t> stack;
+    if (!ownedNodes.empty())
+        stack.push_back(0);
+    while (!stack.empty())
+    {
+        uint32_t n = stack.back();
+        stack.pop_back();
+
+        meshNode &node = ownedNodes[n];
+        node.lodChunk = 0;
+        if (node.count <= MESH_LOD_CHUNK_TRIANGLES || node.isLeaf())
+        {
+            ownedLodChunks.push_back({ n, 0, 0, 0 });
+            node.lodChunk = (uint32_t)ownedLodChunks.size();
+            continue;
+        }
+        stack.push_back(node.secondChild);
+        stack.push_back(n + 1);
+    }
+
+    // Vertices used by more than one chunk stay where they are
+    std::vector<uint32_t> vertexChunk(ownedX.size(), UNUSED_VERTEX);
+    for (uint32_t c = 0; c < ownedLodChunks.size(); c++)
+    {
+        const meshNode &node = ownedNodes[ownedLodChunks[c].node];
+        for (size_t i = (size_t)node.first * 3; i < ((size_t)node.first + node.count) * 3; i++)
+        {
+            uint32_t &owner = vertexChunk[ownedIndices[i]];
+            if (owner == UNUSED_VERTEX) owner = c;
+            else if (owner != c) owner = SHARED_VERTEX;
+        }
+    }
+
+    std::vector<uint32_t> localVertex(ownedX.size(), UINT32_MAX);
+    std::vector<uint64_t> edges;
+    chunkSimplifier s(ownedX, ownedY, ownedZ);
+    for (uint32_t c = 0; c < ownedLodChunks.size(); c++)
+    {
+        meshLodChunk &chunk = ownedLodChunks[c];
+        const meshNode &node = ownedNodes[chunk.node];
+        chunk.levelFirst = (uint32_t)ownedLodLevels.size();
+
+        s.reset();
+        s.tris.resize((size_t)node.count * 3);
+        for (uint32_t t = 0; t < node.count; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t g = ownedIndices[((size_t)node.first + t) * 3 + k];
+                if (localVertex[g] == UINT32_MAX)
+                {
+                    localVertex[g] = (uint32_t)s.global.size();
+                    s.global.push_back(g);
+                    s.locked.push_back(vertexChunk[g] == SHARED_VERTEX);
+                }
+                s.tris[(size_t)t*3 + k] = localVertex[g];
+            }
+        }
+        for (uint32_t g : s.global)
+            localVertex[g] = UINT32_MAX;
+
+        size_t vertexCount = s.global.size();
+        s.removed.assign(vertexCount, false);
+        s.version.assign(vertexCount, 0);
+        s.quadrics.assign(vertexCount, quadric());
+        s.fanHead.assign(vertexCount, UINT32_MAX);
+        s.alive.assign(node.count, true);
+        s.aliveCount = node.count;
+
+        for (uint32_t t = 0; t < node.count; t++)
+        {
+            uint32_t *v = &s.tris[(size_t)t*3];
+            vec3d n = ownedNormals[node.first + t];
+            vec3d p = s.position(v[0]);
+            double d = -(n.x * p.x + n.y * p.y + n.z * p.z);
+            for (int k = 0; k < 3; k++)
+            {
+                s.quadrics[v[k]].addPlane(n.x, n.y, n.z, d);
+                s.addToFan(v[k], t);
+
+                uint32_t a = std::min(v[k], v[(k + 1) % 3]), b = std::max(v[k], v[(k + 1) % 3]);
+                edges.push_back((uint64_t)a << 32 | b);
+            }
+        }
+
+        // Open edges are the mesh border, moving them would change the outline
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0, j; i < edges.size(); i = j)
+        {
+            for (j = i + 1; j < edges.size() && edges[j] == edges[i]; j++) {}
+            if (j - i == 1)
+            {
+                s.locked[(uint32_t)(edges[i] >> 32)] = true;
+                s.locked[(uint32_t)edges[i]] = true;
+            }
+        }
+        edges.clear();
+
+        size_t previous = node.count;
+        while (chunk.levelCount < MESH_LOD_MAX_LEVELS)
+        {
+            s.simplifyLevel();
+
+            // Not worth a level of its own
+            if (s.aliveCount == 0 || s.aliveCount * 10 > previous * 9)
+                break;
+            previous = s.aliveCount;
+
+            meshLodLevel level;
+            level.first = (uint32_t)(ownedLodIndices.size() / 3);
+            level.count = (uint32_t)s.aliveCount;
+            level.error = (float)std::sqrt(s.maxCost);
+            level.padding = 0;
+
+            for (uint32_t t = 0; t < node.count; t++)
+            {
+                if (!s.alive[t]) continue;
+                const uint32_t *v = &s.tris[(size_t)t*3];
+                for (int k = 0; k < 3; k++)
+                    ownedLodIndices.push_back(s.global[v[k]]);
+
+                vec3d n = s.faceNormal(v[0], v[1], v[2]);
+                float l = lenVector(n);
+                n = l > 0.0f ? divVector(n, l) : vec3d{ 0, 0, 0 };
+                n.w = 0.0f;
+                ownedLodNormals.push_back(n);
+            }
+
+            ownedLodLevels.push_back(level);
+            chunk.levelCount++;
+        }
+    }
+}
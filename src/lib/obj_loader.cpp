@@ -0,0 +1,239 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../include/mapped_file.hpp"
+#include "../include/mesh.hpp"
+
+// Wavefront OBJ reader working directly on the memory mapped file. Only
+// positions and faces are kept, texture coordinates and normals are
+// counted so face references to them can be validated. Polygons with
+// more than three corners are split into a triangle fan.
+
+namespace
+{
+
+struct objParser
+{
+    const char *cur;
+    const char *end;
+    size_t line = 1;
+
+    bool atLineEnd() const
+    {
+        return cur >= end || *cur == '\n' || *cur == '\r' || *cur == '#';
+    }
+
+    void skipSpaces()
+    {
+        while (cur < end && (*cur == ' ' || *cur == '\t'))
+            cur++;
+    }
+
+    void skipLine()
+    {
+        while (cur < end && *cur != '\n')
+            cur++;
+        if (cur < end)
+        {
+            cur++;
+            line++;
+        }
+    }
+
+    bool parseFloat(float &out)
+    {
+        skipSpaces();
+        const char *p = cur;
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+
+        // Up to 19 significant digits fit in the mantissa, further ones
+        // only shift the decimal exponent
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0;
+        bool any = false;
+
+        for (; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+        {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+            else exponent++;
+        }
+        if (p < end && *p == '.')
+        {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+            {
+                if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; exponent--; }
+            }
+        }
+        if (!any) return false;
+
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            const char *e = p + 1;
+            bool negativeExp = false;
+            if (e < end && (*e == '-' || *e == '+'))
+                negativeExp = *e++ == '-';
+            if (e < end && *e >= '0' && *e <= '9')
+            {
+                int value = 0;
+                for (; e < end && *e >= '0' && *e <= '9'; e++)
+                    if (value < 10000) value = value * 10 + (*e - '0');
+                exponent += negativeExp ? -value : value;
+                p = e;
+            }
+        }
+
+        static const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+            1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        double value = (double)mantissa;
+        while (exponent > 22) { value *= 1e22; exponent -= 22; }
+        while (exponent < -22) { value /= 1e22; exponent += 22; }
+        value = exponent >= 0 ? value * powers[exponent] : value / powers[-exponent];
+
+        out = (float)(negative ? -value : value);
+        cur = p;
+        return true;
+    }
+
+    bool parseInt(int64_t &out)
+    {
+        const char *p = cur;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = *p++ == '-';
+        if (p >= end || *p < '0' || *p > '9') return false;
+
+        int64_t value = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            if (value < (int64_t)1 << 40) value = value * 10 + (*p - '0');
+
+        out = negative ? -value : value;
+        cur = p;
+        return true;
+    }
+
+    // Matches a keyword followed by whitespace or the end of the line
+    bool keyword(const char *word)
+    {
+        const char *p = cur;
+        for (; *word; word++, p++)
+            if (p >= end || *p != *word) return false;
+        if (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') return false;
+        cur = p;
+        return true;
+    }
+};
+
+// Turns a 1-based or negative (relative) OBJ reference into a 0-based index
+bool resolveIndex(int64_t ref, size_t count, uint32_t &out)
+{
+    int64_t idx = ref < 0 ? (int64_t)count + ref : ref - 1;
+    if (ref == 0 || idx < 0 || idx >= (int64_t)count) return false;
+    out = (uint32_t)idx;
+    return true;
+}
+
+}
+
+bool mesh::loadFromObjFile(const std::string &filename, std::string *error)
+{
+    auto fail = [&](size_t line, const std::string &message)
+    {
+        if (error)
+        {
+            *error = filename;
+            if (line) *error += ":" + std::to_string(line);
+            *error += ": " + message;
+        }
+        return false;
+    };
+
+    mappedFile file;
+    if (!file.open(filename)) return fail(0, "could not open file");
+
+    clear();
+
+    size_t texCoordCount = 0, normalCount = 0;
+    std::vector<uint32_t> polygon;
+
+    objParser p = { file.data, file.data + file.size };
+    while (p.cur < p.end)
+    {
+        p.skipSpaces();
+
+        if (p.keyword("v"))
+        {
+            vec3d v;
+            if (!p.parseFloat(v.x) || !p.parseFloat(v.y) || !p.parseFloat(v.z))
+                return fail(p.line, "expected three coordinates after 'v'");
+            ownedX.push_back(v.x);
+            ownedY.push_back(v.y);
+            ownedZ.push_back(v.z);
+        }
+        else if (p.keyword("vt"))
+        {
+            texCoordCount++;
+        }
+        else if (p.keyword("vn"))
+        {
+            normalCount++;
+        }
+        else if (p.keyword("f"))
+        {
+            polygon.clear();
+
+            for (p.skipSpaces(); !p.atLineEnd(); p.skipSpaces())
+            {
+                // v, v/vt, v//vn or v/vt/vn
+                int64_t ref;
+                uint32_t idx, unused;
+                if (!p.parseInt(ref))
+                    return fail(p.line, "malformed face vertex");
+                if (!resolveIndex(ref, ownedX.size(), idx))
+                    return fail(p.line, "vertex index " + std::to_string(ref) + " out of range");
+
+                if (p.cur < p.end && *p.cur == '/')
+                {
+                    p.cur++;
+                    if (p.parseInt(ref) && !resolveIndex(ref, texCoordCount, unused))
+                        return fail(p.line, "texture coordinate index " + std::to_string(ref) + " out of range");
+                    if (p.cur < p.end && *p.cur == '/')
+                    {
+                        p.cur++;
+                        if (!p.parseInt(ref))
+                            return fail(p.line, "malformed face vertex");
+                        if (!resolveIndex(ref, normalCount, unused))
+                            return fail(p.line, "normal index " + std::to_string(ref) + " out of range");
+                    }
+                }
+
+                if (!p.atLineEnd() && *p.cur != ' ' && *p.cur != '\t')
+                    return fail(p.line, "malformed face vertex");
+
+                polygon.push_back(idx);
+            }
+
+            if (polygon.size() < 3)
+                return fail(p.line, "face needs at least three vertices");
+
+            // Fan triangulation around the first corner
+            for (size_t k = 1; k + 1 < polygon.size(); k++)
+            {
+                ownedIndices.push_back(polygon[0]);
+                ownedIndices.push_back(polygon[k]);
+                ownedIndices.push_back(polygon[k + 1]);
+            }
+        }
+
+        // Anything else (comments, groups, materials, ...) is ignored
+        p.skipLine();
+    }
+
+    finalize();
+    return true;
+}
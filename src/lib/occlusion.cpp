@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "../include/occlusion.hpp"
+#include "../include/rasterizer.hpp"
+
+const float TEXEL = (float)HIZ_TEXEL_PIXELS;
+const float EMPTY = std::numeric_limits<float>::infinity();
+const int TEXEL_BITS = HIZ_TEXEL_PIXELS * HIZ_TEXEL_PIXELS;
+const uint16_t FULL_MASK = 0xffff;
+
+// Added to occluder depths to cover the rounding of the rasterizer's own
+// depth interpolation
+const float DEPTH_SLACK = 1e-6f;
+
+void depthPyramid::reset(const viewport &vp)
+{
+    pixelWidth = std::max(1, (int)std::ceil(vp.width));
+    pixelHeight = std::max(1, (int)std::ceil(vp.height));
+    int width = (pixelWidth + HIZ_TEXEL_PIXELS - 1) / HIZ_TEXEL_PIXELS;
+    int height = (pixelHeight + HIZ_TEXEL_PIXELS - 1) / HIZ_TEXEL_PIXELS;
+
+    levels.clear();
+    size_t total = 0;
+    for (;;)
+    {
+        levels.push_back({ width, height, total });
+        total += (size_t)width * height;
+        if (width == 1 && height == 1)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    size_t count = (size_t)levels[0].width * levels[0].height;
+    covered.resize(count);
+    partMask.resize(count);
+    partDepth.resize(count);
+    texels.resize(total);
+    std::fill(covered.begin(), covered.end(), EMPTY);
+    std::fill(partDepth.begin(), partDepth.end(), 0.0f);
+    std::fill(partMask.begin(), partMask.end(), 0);
+
+    // Only the last row and column can reach past the screen
+    int lastX = levels[0].width - 1, lastY = levels[0].height - 1;
+    for (int ty = 0; ty <= lastY; ty++)
+        partMask[(size_t)ty * levels[0].width + lastX] = offscreenMask(lastX, ty);
+    for (int tx = 0; tx <= lastX; tx++)
+        partMask[(size_t)lastY * levels[0].width + tx] = offscreenMask(tx, lastY);
+}
+
+// Pixels of a texel past the right or bottom edge of the screen. Nothing is
+// ever drawn there, so they count as covered from the start.
+uint16_t depthPyramid::offscreenMask(int tx, int ty) const
+{
+    uint16_t mask = 0;
+    for (int r = 0; r < HIZ_TEXEL_PIXELS; r++)
+        for (int c = 0; c < HIZ_TEXEL_PIXELS; c++)
+            if (tx * HIZ_TEXEL_PIXELS + c >= pixelWidth || ty * HIZ_TEXEL_PIXELS + r >= pixelHeight)
+                mask |= (uint16_t)(1u << (r * HIZ_TEXEL_PIXELS + c));
+    return mask;
+}
+
+void depthPyramid::addCoverage(size_t texel, int tx, int ty, uint16_t mask, float z)
+{
+    // Coverage at or behind a full texel changes nothing
+    float &full = covered[texel];
+    if (!(z < full))
+        return;
+    if (mask == FULL_MASK)
+    {
+        full = z;
+        return;
+    }
+
+    mask |= partMask[texel];
+    float farthest = std::max(partDepth[texel], z);
+    if (mask != FULL_MASK)
+    {
+        partMask[texel] = mask;
+        partDepth[texel] = farthest;
+        return;
+    }
+    full = std::min(full, farthest);
+    partMask[texel] = offscreenMask(tx, ty);
+    partDepth[texel] = 0.0f;
+}
+
+void depthPyramid::drawTriangle(const triangle &tri, int firstRow, int lastRow)
+{
+    triangleSetup s;
+    if (!setupTriangle(tri, s))
+        return;
+
+    // Depth is a plane in screen space, so over a texel it goes at most
+    // half a texel's worth of each slope past the value at its center, and
+    // never past the farthest vertex
+    float spread = 0.5f * TEXEL * (std::fabs(s.dzdx) + std::fabs(s.dzdy));
+    float farthest = std::max({ tri.p[0].z, tri.p[1].z, tri.p[2].z }) + DEPTH_SLACK;
+
+    int tx0 = std::max(s.minX, 0) / HIZ_TEXEL_PIXELS;
+    int tx1 = std::min(s.maxX, pixelWidth - 1) / HIZ_TEXEL_PIXELS;
+    int ty0 = std::max(std::max(s.minY, 0) / HIZ_TEXEL_PIXELS, firstRow);
+    int ty1 = std::min(std::min(s.maxY, pixelHeight - 1) / HIZ_TEXEL_PIXELS, lastRow);
+    if (tx0 > tx1 || ty0 > ty1)
+        return;
+
+    // How far each edge function can rise and fall across a texel from
+    // its first pixel
+    const int64_t across = HIZ_TEXEL_PIXELS - 1;
+    int64_t rise[3], fall[3];
+    for (int e = 0; e < 3; e++)
+    {
+        rise[e] = std::max<int64_t>(s.stepX[e], 0) * across + std::max<int64_t>(s.stepY[e], 0) * across;
+        fall[e] = std::min<int64_t>(s.stepX[e], 0) * across + std::min<int64_t>(s.stepY[e], 0) * across;
+    }
+
+    // And how far it is at each pixel, in coverage bit order. Edges that
+    // cross a texel are within that of zero there, so 32 bits hold them.
+    int32_t offset[3][TEXEL_BITS];
+    for (int e = 0; e < 3; e++)
+        for (int bit = 0; bit < TEXEL_BITS; bit++)
+            offset[e][bit] = (bit % HIZ_TEXEL_PIXELS) * s.stepX[e] + (bit / HIZ_TEXEL_PIXELS) * s.stepY[e];
+
+    const level &l = levels[0];
+    for (int ty = ty0; ty <= ty1; ty++)
+    {
+        int top = ty * HIZ_TEXEL_PIXELS, left = tx0 * HIZ_TEXEL_PIXELS;
+        int64_t edge[3];
+        for (int e = 0; e < 3; e++)
+            edge[e] = s.edge[e] + (int64_t)(left - s.minX) * s.stepX[e] + (int64_t)(top - s.minY) * s.stepY[e];
+        float z = s.zAnchor + s.dzdx * (left + 0.5f * (TEXEL - 1.0f) - s.minX) +
+                  s.dzdy * (top + 0.5f * (TEXEL - 1.0f) - s.minY) + spread + DEPTH_SLACK;
+
+        for (int tx = tx0; tx <= tx1; tx++, z += TEXEL * s.dzdx)
+        {
+            // Edge values at the texel's first pixel, and the next one's
+            int64_t here[3];
+            for (int e = 0; e < 3; e++)
+            {
+                here[e] = edge[e];
+                edge[e] += (int64_t)HIZ_TEXEL_PIXELS * s.stepX[e];
+            }
+
+            size_t texel = (size_t)ty * l.width + tx;
+            float depth = std::min(farthest, z);
+            if (!(depth < covered[texel]))
+                continue;
+
+            bool inside = true, outside = false;
+            for (int e = 0; e < 3; e++)
+            {
+                inside = inside && here[e] + fall[e] >= 0;
+                outside = outside || here[e] + rise[e] < 0;
+            }
+            if (outside)
+                continue;
+
+            // Texels an edge crosses test their pixels one by one
+            uint16_t mask = FULL_MASK;
+            if (!inside)
+            {
+                for (int e = 0; e < 3; e++)
+                {
+                    if (here[e] + fall[e] >= 0)
+                        continue;
+                    int32_t start = (int32_t)here[e];
+                    uint32_t edgeMask = 0;
+                    for (int bit = 0; bit < TEXEL_BITS; bit++)
+                        edgeMask |= (uint32_t)(start + offset[e][bit] >= 0) << bit;
+                    mask &= (uint16_t)edgeMask;
+                }
+                if (!mask)
+                    continue;
+            }
+            addCoverage(texel, tx, ty, mask, depth);
+        }
+    }
+}
+
+void depthPyramid::build()
+{
+    std::copy(covered.begin(), covered.end(), texels.begin());
+
+    // Odd sizes repeat the last row and column below
+    for (size_t i = 1; i < levels.size(); i++)
+    {
+        const level &fine = levels[i - 1], &coarse = levels[i];
+        const float *below = &texels[fine.offset];
+        float *out = &texels[coarse.offset];
+        for (int y = 0; y < coarse.height; y++)
+        {
+            int ya = 2 * y, yb = std::min(2 * y + 1, fine.height - 1);
+            for (int x = 0; x < coarse.width; x++)
+            {
+                int xa = 2 * x, xb = std::min(2 * x + 1, fine.width - 1);
+                out[(size_t)y * coarse.width + x] = std::max({
+                    below[(size_t)ya * fine.width + xa], below[(size_t)ya * fine.width + xb],
+                    below[(size_t)yb * fine.width + xa], below[(size_t)yb * fine.width + xb] });
+            }
+        }
+    }
+}
+
+bool depthPyramid::occluded(float minX, float minY, float maxX, float maxY, float minZ) const
+{
+    if (levels.empty())
+        return false;
+    const level &l0 = levels[0];
+    minX /= TEXEL; maxX /= TEXEL;
+    minY /= TEXEL; maxY /= TEXEL;
+    if (!(maxX >= 0.0f && maxY >= 0.0f && minX < l0.width && minY < l0.height))
+        return false;
+    int x0 = (int)std::max(minX, 0.0f), x1 = (int)std::min(maxX, (float)(l0.width - 1));
+    int y0 = (int)std::max(minY, 0.0f), y1 = (int)std::min(maxY, (float)(l0.height - 1));
+
+    // The finest level where the rectangle touches at most 2x2 texels
+    size_t i = 0;
+    while ((x1 >> i) - (x0 >> i) > 1 || (y1 >> i) - (y0 >> i) > 1)
+        i++;
+
+    const level &l = levels[i];
+    const float *t = &texels[l.offset];
+    float farthest = 0.0f;
+    for (int y = y0 >> i; y <= y1 >> i; y++)
+        for (int x = x0 >> i; x <= x1 >> i; x++)
+            farthest = std::max(farthest, t[(size_t)y * l.width + x]);
+    return minZ > farthest;
+}
+
+size_t depthPyramid::scratchBytes() const
+{
+    return capacityBytes(levels) + capacityBytes(covered) + capacityBytes(partMask) + capacityBytes(partDepth) +
+           capacityBytes(texels);
+}
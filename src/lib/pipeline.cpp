@@ -0,0 +1,591 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include "../include/pipeline.hpp"
+#include "../include/profiler.hpp"
+#include "../include/thread_pool.hpp"
+
+// Smallest amount of work worth handing to another thread
+const size_t MIN_VERTS_PER_CHUNK = 4096;
+const size_t MIN_TRIS_PER_CHUNK = 1024;
+
+// A chunk goes to a coarser level once its error is this fraction of the
+// allowed one
+const float LOD_HYSTERESIS = 0.75f;
+
+// Most triangles drawn into the depth pyramid per run, and fewest texel
+// rows per drawing job
+const uint32_t OCCLUDER_TRIANGLES = 16384;
+const size_t OCCLUDER_BAND_ROWS = 16;
+
+// Triangles the pyramid must hide per occluder triangle to be worth
+// drawing, and most runs it is skipped for after failing to
+const uint64_t OCCLUSION_PAYOFF = 2;
+const uint32_t OCCLUSION_MAX_BACKOFF = 16;
+
+using stageClock = profileClock;
+
+// Ends the stage that began at start, which becomes the start of the next
+static double finishStage(const char *name, stageClock::time_point &start)
+{
+    stageClock::time_point now = stageClock::now();
+    PROFILE_EVENT(name, start, now);
+    std::chrono::duration<double, std::milli> took = now - start;
+    start = now;
+    return took.count();
+}
+
+// A stamp of 0 is never current
+static bool sameVersion(uint64_t a, uint64_t b)
+{
+    return a != 0 && a == b;
+}
+
+bool geometryStage::upToDate(const mesh &m, const frameParams &params) const
+{
+    return m.version == meshVersion && sameVersion(params.worldVersion, worldVersion) &&
+           sameVersion(params.viewVersion, viewVersion) && sameVersion(params.projVersion, projVersion);
+}
+
+void geometryStage::run(const mesh &m, const frameParams &params, std::vector<triangle> &out)
+{
+    stageClock::time_point stageStart = stageClock::now();
+
+    // Nothing changed, the bins still hold the last result
+    if (upToDate(m, params))
+    {
+        timeCounters = stageTimes();
+        appendBins(out);
+        timeCounters.clip = finishStage("clip", stageStart);
+        return;
+    }
+    bool worldChanged = m.version != meshVersion || !sameVersion(params.worldVersion, worldVersion);
+    meshVersion = m.version;
+    worldVersion = params.worldVersion;
+    viewVersion = params.viewVersion;
+    projVersion = params.projVersion;
+
+    // Post-transform vertex cache, every unique visible vertex is
+    // transformed exactly once per frame, into clip space, and its pixel
+    // position divided out of that. World and view are affine, so only
+    // the projection needs a full 4x4 product.
+    affineMatrix matWorld = toAffine(params.matWorld);
+    mat4x4 matWorldViewProj = mulAffineByMatrix(mulAffine(matWorld, toAffine(params.matView)), params.matProj);
+
+    // Camera and light in object space, so neither the face normals nor
+    // any vertex have to be taken to world space
+    if (worldChanged)
+    {
+        matWorldInv = quickInverse(matWorld);
+        objectLight = transformDirection(matWorldInv, normVector(params.lightDirection));
+    }
+    objectCamera = transformPoint(matWorldInv, params.cameraPos);
+
+    // Pixels covered by one object space unit seen from distance 1
+    lodPixelsPerUnit = 0.5f * params.vp.height * params.matProj.m[1][1];
+    lodErrorPixels = params.lodErrorPixels;
+
+    // Only vertices of nodes inside the frustum and facing the camera go on
+    cullCounters = cullStats();
+    cullNodes(m, makeFrustum(matWorldViewProj));
+    collectVertexRanges(m);
+    planJobs(vertexRanges, MIN_VERTS_PER_CHUNK, vertexJobs);
+    timeCounters.cull = finishStage("cull", stageStart);
+
+    size_t vertexCount = m.verts.size();
+    clipVerts.resize(vertexCount);
+    screenVerts.resize(vertexCount);
+    outcodes.resize(vertexCount);
+
+    parallelFor(pool, vertexJobs.size(), [&](size_t j)
+    {
+        size_t first = vertexJobs[j].first, last = vertexJobs[j].last;
+        transformVertices(matWorldViewProj, m.verts, clipVerts, first, last);
+        projectVertices(params.vp, clipVerts, screenVerts, first, last);
+        for (size_t i = first; i < last; i++)
+            outcodes[i] = clipOutcode(clipVerts.x[i], clipVerts.y[i], clipVerts.z[i], clipVerts.w[i]);
+    });
+    timeCounters.transform = finishStage("transform", stageStart);
+
+    // Only triangles of nodes not hidden behind the nearer ones go on. A
+    // pyramid that hides too little for what it cost to draw is left out
+    // for a while, longer each time it fails again.
+    if (params.occlusionCulling && occlusionIdle == 0)
+    {
+        cullOccluded(m, matWorldViewProj, params.vp);
+        if (cullCounters.trianglesOccluded < OCCLUSION_PAYOFF * cullCounters.occluderTriangles)
+        {
+            occlusionBackoff = std::min(std::max(2 * occlusionBackoff, 1u), OCCLUSION_MAX_BACKOFF);
+            occlusionIdle = occlusionBackoff;
+        }
+        else
+        {
+            occlusionBackoff = 0;
+        }
+    }
+    else if (occlusionIdle > 0)
+    {
+        occlusionIdle--;
+    }
+    collectTriangleRanges(m);
+    planJobs(triangleRanges, MIN_TRIS_PER_CHUNK, triangleJobs);
+    planJobs(lodRanges, MIN_TRIS_PER_CHUNK, lodJobs);
+    timeCounters.occlusion = finishStage("occlusion", stageStart);
+
+    // Assemble, cull and clip triangles, one output bin per job, full
+    // detail jobs first
+    size_t baseChunks = triangleJobs.size();
+    size_t triChunks = baseChunks + lodJobs.size();
+    if (bins.size() < triChunks)
+    {
+        bins.resize(triChunks);
+        binStats.resize(triChunks);
+    }
+
+    transformedVertices transformed = { m.verts, &clipVerts, &screenVerts, outcodes.data(), objectCamera, objectLight, params.vp };
+    parallelFor(pool, triChunks, [&](size_t c)
+    {
+        bins[c].clear();
+        binStats[c] = clipStats();
+        if (c < baseChunks)
+            assembleTriangles(transformed, m.indices.data(), m.faceNormals.data(),
+                              triangleJobs[c].first, triangleJobs[c].last, bins[c], binStats[c]);
+        else
+            assembleTriangles(transformed, m.lodIndices.data(), m.lodNormals.data(),
+                              lodJobs[c - baseChunks].first, lodJobs[c - baseChunks].last, bins[c], binStats[c]);
+    });
+
+    clipCounters = clipStats();
+    for (size_t c = 0; c < triChunks; c++)
+        clipCounters.add(binStats[c]);
+
+    binCount = triChunks;
+    cullCounters.trianglesDrawn = appendBins(out);
+    timeCounters.clip = finishStage("clip", stageStart);
+}
+
+// Merges the bins of the last run onto out in chunk order
+size_t geometryStage::appendBins(std::vector<triangle> &out) const
+{
+    size_t total = 0;
+    for (size_t c = 0; c < binCount; c++)
+        total += bins[c].size();
+    out.reserve(out.size() + total);
+    for (size_t c = 0; c < binCount; c++)
+        out.insert(out.end(), bins[c].begin(), bins[c].end());
+    return total;
+}
+
+// Squared distance from point to the nearest point of the node's box, 0
+// inside it
+static float boxDistance2(const meshNode &node, const vec3d &point)
+{
+    const float p[3] = { point.x, point.y, point.z };
+    float d2 = 0.0f;
+    for (int k = 0; k < 3; k++)
+    {
+        float d = std::max({ node.boundsMin[k] - p[k], 0.0f, p[k] - node.boundsMax[k] });
+        d2 += d * d;
+    }
+    return d2;
+}
+
+// Triangles drawn for a visible node, at its level of detail
+uint32_t geometryStage::nodeTriangles(const mesh &m, const visibleNode &v)
+{
+    return v.lod ? m.lodLevels[v.lod - 1].count : m.nodes[v.node].count;
+}
+
+// How large the node's box looks from the camera for each triangle it
+// draws, infinite from inside the box
+float geometryStage::occluderScore(const mesh &m, const visibleNode &v) const
+{
+    const meshNode &node = m.nodes[v.node];
+    float d2 = boxDistance2(node, objectCamera);
+    float size2 = 0.0f;
+    for (int k = 0; k < 3; k++)
+        size2 += (node.boundsMax[k] - node.boundsMin[k]) * (node.boundsMax[k] - node.boundsMin[k]);
+    return d2 > 0.0f ? size2 / (d2 * std::max(nodeTriangles(m, v), 1u)) : std::numeric_limits<float>::infinity();
+}
+
+void geometryStage::cullNodes(const mesh &m, const frustum &f)
+{
+    visibleNodes.clear();
+    if (m.nodes.empty())
+        return;
+    if (chunkLevels.size() != m.lodChunks.size())
+        chunkLevels.assign(m.lodChunks.size(), 0);
+
+    // Depth first, the stack never holds more than one entry per level
+    struct entry
+    {
+        uint32_t node;
+        uint32_t planeMask;
+    };
+    entry stack[MESH_MAX_DEPTH];
+    int top = 0;
+    stack[top++] = { 0, FRUSTUM_ALL_PLANES };
+
+    while (top > 0)
+    {
+        entry e = stack[--top];
+        const meshNode &node = m.nodes[e.node];
+
+        // Boxes already known to be inside every plane skip the test
+        if (e.planeMask)
+        {
+            cullCounters.nodesTested++;
+            if (testBox(f, node.boundsMin, node.boundsMax, e.planeMask) == CULL_OUTSIDE)
+            {
+                cullCounters.nodesCulled++;
+                cullCounters.trianglesSkipped += node.count;
+                continue;
+            }
+        }
+
+        // A coarser level replaces the whole subtree. Its triangles are not
+        // the ones the normal cone was built from, so it is not used.
+        if (node.lodChunk)
+        {
+            uint32_t level = selectLevel(m, node);
+            if (level > 0)
+            {
+                uint32_t lod = m.lodChunks[node.lodChunk - 1].levelFirst + level - 1;
+                cullCounters.lodChunksCoarse++;
+                cullCounters.trianglesSavedByLod += node.count - m.lodLevels[lod].count;
+                visibleNodes.push_back({ e.node, lod + 1, 0.0f, false });
+                continue;
+            }
+        }
+
+        if (nodeBackfacing(node))
+        {
+            cullCounters.nodesBackfacing++;
+            cullCounters.trianglesBackfacing += node.count;
+            continue;
+        }
+
+        if (!node.isLeaf())
+        {
+            stack[top++] = { node.secondChild, e.planeMask };
+            stack[top++] = { e.node + 1, e.planeMask };
+            continue;
+        }
+
+        visibleNodes.push_back({ e.node, 0, 0.0f, false });
+    }
+}
+
+// Draws the front facing triangles of the visible nodes that look largest
+// for their triangle count into the depth pyramid, then marks every
+// visible node whose box is behind it as occluded
+void geometryStage::cullOccluded(const mesh &m, const mat4x4 &matWorldViewProj, const viewport &vp)
+{
+    if (visibleNodes.size() < 2)
+        return;
+
+    occluderOrder.resize(visibleNodes.size());
+    for (size_t i = 0; i < occluderOrder.size(); i++)
+    {
+        visibleNodes[i].occluderScore = occluderScore(m, visibleNodes[i]);
+        occluderOrder[i] = (uint32_t)i;
+    }
+    std::sort(occluderOrder.begin(), occluderOrder.end(),
+              [&](uint32_t a, uint32_t b) { return visibleNodes[a].occluderScore > visibleNodes[b].occluderScore; });
+
+    occluders.clear();
+    uint32_t budget = OCCLUDER_TRIANGLES;
+    for (uint32_t o : occluderOrder)
+    {
+        const visibleNode &v = visibleNodes[o];
+        if (nodeTriangles(m, v) > budget)
+            break;
+        budget -= nodeTriangles(m, v);
+
+        const uint32_t *indices = v.lod ? m.lodIndices.data() : m.indices.data();
+        const vec3d *normals = v.lod ? m.lodNormals.data() : m.faceNormals.data();
+        uint32_t first = v.lod ? m.lodLevels[v.lod - 1].first : m.nodes[v.node].first;
+        uint32_t last = first + nodeTriangles(m, v);
+
+        for (uint32_t t = first; t < last; t++)
+        {
+            uint32_t idx[3] = { indices[t*3], indices[t*3 + 1], indices[t*3 + 2] };
+            // Triangles the clipper will cut are not drawn from these
+            // screen positions
+            if ((outcodes[idx[0]] | outcodes[idx[1]] | outcodes[idx[2]]) & CLIP_GUARD_MASK)
+                continue;
+
+            // Only what the drawing pass keeps may hide anything
+            if (dotProduct(normals[t], subVectors(m.verts.get(idx[0]), objectCamera)) >= 0.0f)
+                continue;
+
+            occluders.push_back({ { screenVerts.get(idx[0]), screenVerts.get(idx[1]), screenVerts.get(idx[2]) }, sf::Color() });
+        }
+    }
+    cullCounters.occluderTriangles = occluders.size();
+
+    // Every job owns a band of texel rows and draws what falls into it
+    occlusion.reset(vp);
+    int rows = occlusion.rows();
+    size_t bands = chunkCount(pool, rows, OCCLUDER_BAND_ROWS);
+    parallelFor(pool, bands, [&](size_t band)
+    {
+        int firstRow = (int)(rows * band / bands), lastRow = (int)(rows * (band + 1) / bands) - 1;
+        float top = (float)(firstRow * HIZ_TEXEL_PIXELS) - 1.0f, bottom = (float)((lastRow + 1) * HIZ_TEXEL_PIXELS) + 1.0f;
+        for (const triangle &t : occluders)
+        {
+            if (std::max({ t.p[0].y, t.p[1].y, t.p[2].y }) < top || std::min({ t.p[0].y, t.p[1].y, t.p[2].y }) > bottom)
+                continue;
+            occlusion.drawTriangle(t, firstRow, lastRow);
+        }
+    });
+    occlusion.build();
+
+    // Screen rectangle and nearest depth of every box, from its corners
+    auto toClip = [&](float x, float y, float z)
+    {
+        return mulMatrixByVector(matWorldViewProj, { x, y, z, 1.0f });
+    };
+    for (visibleNode &v : visibleNodes)
+    {
+        const meshNode &node = m.nodes[v.node];
+        float minX = std::numeric_limits<float>::max(), maxX = -minX, minY = minX, maxY = -minX, minZ = minX;
+        bool usable = true;
+        for (int corner = 0; corner < 8 && usable; corner++)
+        {
+            vec3d c = toClip(corner & 1 ? node.boundsMax[0] : node.boundsMin[0],
+                             corner & 2 ? node.boundsMax[1] : node.boundsMin[1],
+                             corner & 4 ? node.boundsMax[2] : node.boundsMin[2]);
+            usable = !(clipOutcode(c.x, c.y, c.z, c.w) & (1u << CLIP_NEAR));
+            vec3d s = clipToScreen(c, vp);
+            minX = std::min(minX, s.x); maxX = std::max(maxX, s.x);
+            minY = std::min(minY, s.y); maxY = std::max(maxY, s.y);
+            minZ = std::min(minZ, s.z);
+        }
+        if (!usable || !occlusion.occluded(minX, minY, maxX, maxY, minZ))
+            continue;
+
+        v.occluded = true;
+        cullCounters.nodesOccluded++;
+        cullCounters.trianglesOccluded += nodeTriangles(m, v);
+    }
+}
+
+// Vertex ranges of every visible node
+void geometryStage::collectVertexRanges(const mesh &m)
+{
+    vertexRanges.clear();
+    for (const visibleNode &v : visibleNodes)
+        vertexRanges.push_back({ m.nodes[v.node].vertexFirst, m.nodes[v.node].vertexLast });
+
+    // Leaf vertex ranges can overlap, merge them so every vertex is
+    // written by exactly one job
+    std::sort(vertexRanges.begin(), vertexRanges.end(), [](const itemRange &a, const itemRange &b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t i = 1; i < vertexRanges.size(); i++)
+    {
+        if (vertexRanges[i].first <= vertexRanges[merged].last)
+            vertexRanges[merged].last = std::max(vertexRanges[merged].last, vertexRanges[i].last);
+        else
+            vertexRanges[++merged] = vertexRanges[i];
+    }
+    if (!vertexRanges.empty())
+        vertexRanges.resize(merged + 1);
+}
+
+// Triangle ranges of the visible nodes left after occlusion culling
+void geometryStage::collectTriangleRanges(const mesh &m)
+{
+    triangleRanges.clear();
+    lodRanges.clear();
+
+    for (const visibleNode &v : visibleNodes)
+    {
+        if (v.occluded)
+            continue;
+        const meshNode &node = m.nodes[v.node];
+        if (v.lod)
+        {
+            const meshLodLevel &lod = m.lodLevels[v.lod - 1];
+            cullCounters.trianglesTested += lod.count;
+            lodRanges.push_back({ lod.first, lod.first + lod.count });
+            continue;
+        }
+
+        // Leaves come in triangle order, neighbours join up
+        cullCounters.trianglesTested += node.count;
+        if (!triangleRanges.empty() && triangleRanges.back().last == node.first)
+            triangleRanges.back().last = node.first + node.count;
+        else
+            triangleRanges.push_back({ node.first, node.first + node.count });
+    }
+}
+
+// True when every triangle under the node is certain to fail the backface
+// test. With all normals within angle a of the cone axis and all points
+// within radius r of the box center, a triangle faces away whenever
+// |d| * cos(b + a) >= r, where d runs from the camera to the center and b
+// is the angle between d and the axis.
+bool geometryStage::nodeBackfacing(const meshNode &node) const
+{
+    if (node.coneCos <= 0.0f)
+        return false;
+
+    vec3d center = {
+        0.5f * (node.boundsMin[0] + node.boundsMax[0]),
+        0.5f * (node.boundsMin[1] + node.boundsMax[1]),
+        0.5f * (node.boundsMin[2] + node.boundsMax[2])
+    };
+    vec3d halfSize = {
+        0.5f * (node.boundsMax[0] - node.boundsMin[0]),
+        0.5f * (node.boundsMax[1] - node.boundsMin[1]),
+        0.5f * (node.boundsMax[2] - node.boundsMin[2])
+    };
+    float radius = std::sqrt(halfSize.x*halfSize.x + halfSize.y*halfSize.y + halfSize.z*halfSize.z);
+
+    float dx = center.x - objectCamera.x, dy = center.y - objectCamera.y, dz = center.z - objectCamera.z;
+    float distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+    if (distance <= radius)
+        return false;
+
+    float cosB = (dx * node.coneAxis[0] + dy * node.coneAxis[1] + dz * node.coneAxis[2]) / distance;
+    if (cosB <= 0.0f)
+        return false;
+
+    float sinB = std::sqrt(std::max(0.0f, 1.0f - cosB * cosB));
+    float sinA = std::sqrt(std::max(0.0f, 1.0f - node.coneCos * node.coneCos));
+    return distance * (cosB * node.coneCos - sinB * sinA) >= radius;
+}
+
+// Level of detail for the chunk at node, 0 for full detail. The error of a
+// level is in object space, it shrinks with the distance to the nearest
+// point of the node's box.
+uint32_t geometryStage::selectLevel(const mesh &m, const meshNode &node)
+{
+    const meshLodChunk &chunk = m.lodChunks[node.lodChunk - 1];
+    uint32_t &level = chunkLevels[node.lodChunk - 1];
+    level = std::min(level, chunk.levelCount);
+
+    float d2 = boxDistance2(node, objectCamera);
+    if (lodErrorPixels <= 0.0f || d2 <= 0.0f)
+        return level = 0;
+
+    float pixelsPerUnit = lodPixelsPerUnit / std::sqrt(d2);
+    auto levelPixels = [&](uint32_t l) { return m.lodLevels[chunk.levelFirst + l - 1].error * pixelsPerUnit; };
+
+    // Finer right away once the error shows, coarser only with some margin
+    while (level > 0 && levelPixels(level) > lodErrorPixels)
+        level--;
+    while (level < chunk.levelCount && levelPixels(level + 1) <= LOD_HYSTERESIS * lodErrorPixels)
+        level++;
+    return level;
+}
+
+void geometryStage::forgetHistory()
+{
+    std::fill(chunkLevels.begin(), chunkLevels.end(), 0);
+    occlusionIdle = occlusionBackoff = 0;
+    meshVersion = worldVersion = viewVersion = projVersion = 0;
+}
+
+size_t geometryStage::scratchBytes() const
+{
+    size_t bytes = capacityBytes(vertexRanges) + capacityBytes(triangleRanges) + capacityBytes(lodRanges) +
+                   capacityBytes(vertexJobs) + capacityBytes(triangleJobs) + capacityBytes(lodJobs) +
+                   capacityBytes(chunkLevels) + capacityBytes(outcodes) + capacityBytes(bins) +
+                   capacityBytes(binStats) + capacityBytes(visibleNodes) + capacityBytes(occluderOrder) + capacityBytes(occluders) +
+                   occlusion.scratchBytes() + clipVerts.capacityBytes() + screenVerts.capacityBytes();
+    for (const auto &bin : bins)
+        bytes += capacityBytes(bin);
+    return bytes;
+}
+
+// Cuts ranges into jobs of roughly even size for the pool
+void geometryStage::planJobs(const std::vector<itemRange> &ranges, size_t minPerJob, std::vector<itemRange> &jobs) const
+{
+    size_t total = 0;
+    for (const auto &r : ranges)
+        total += r.last - r.first;
+
+    size_t jobsWanted = chunkCount(pool, total, minPerJob);
+    size_t perJob = std::max<size_t>((total + jobsWanted - 1) / jobsWanted, 1);
+
+    jobs.clear();
+    for (const auto &r : ranges)
+        for (size_t first = r.first; first < r.last; first += perJob)
+            jobs.push_back({ (uint32_t)first, (uint32_t)std::min<size_t>(r.last, first + perJob) });
+}
+
+void assembleTriangles(const transformedVertices &v, const uint32_t *indices, const vec3d *normals,
+                       size_t first, size_t last, std::vector<triangle> &out, clipStats &stats)
+{
+    const uint32_t *outcodes = v.outcodes;
+    const vec3d &objectCamera = v.objectCamera, &objectLight = v.objectLight;
+    for (size_t t = first; t < last; t++)
+    {
+        triangle triProjected;
+        uint32_t idx[3] = { indices[t*3], indices[t*3 + 1], indices[t*3 + 2] };
+
+        // Whole triangle outside one frustum plane, nothing to draw
+        uint32_t codes0 = outcodes[idx[0]], codes1 = outcodes[idx[1]], codes2 = outcodes[idx[2]];
+        if (codes0 & codes1 & codes2 & CLIP_OUTSIDE_MASK)
+        {
+            stats.rejected++;
+            continue;
+        }
+
+        // Precomputed normal against the ray from the camera, both in
+        // object space
+        const vec3d &normal = normals[t];
+        vec3d cameraRay = subVectors(v.verts.get(idx[0]), objectCamera);
+
+        if (dotProduct(normal, cameraRay) < 0.0f)
+        {
+            // Shading
+            float dp = std::max(0.1f, dotProduct(objectLight, normal));
+
+            triProjected.color = {
+                static_cast<sf::Uint8>(255*dp),
+                static_cast<sf::Uint8>(255*dp),
+                static_cast<sf::Uint8>(255*dp)
+            };
+
+            // Inside the near and far planes and the guard band, the
+            // projected vertices can be used as they are
+            uint32_t codes = (codes0 | codes1 | codes2) & CLIP_GUARD_MASK;
+            if (!codes)
+            {
+                triProjected.p[0] = v.screenVerts->get(idx[0]);
+                triProjected.p[1] = v.screenVerts->get(idx[1]);
+                triProjected.p[2] = v.screenVerts->get(idx[2]);
+                out.push_back(triProjected);
+                stats.accepted++;
+                continue;
+            }
+
+            // Clip in homogeneous space and fan the convex result back
+            // into triangles
+            vec3d clipIn[3] = { v.clipVerts->get(idx[0]), v.clipVerts->get(idx[1]), v.clipVerts->get(idx[2]) };
+            vec3d polygon[MAX_CLIP_VERTS];
+            int count = clipTriangle(clipIn, codes, polygon, stats);
+            stats.clipped++;
+            stats.clipResults[std::min(std::max(count - 2, 0), CLIP_RESULT_BUCKETS - 1)]++;
+
+            for (int i = 0; i < count; i++)
+                polygon[i] = clipToScreen(polygon[i], v.vp);
+
+            for (int i = 1; i + 1 < count; i++)
+            {
+                triProjected.p[0] = polygon[0];
+                triProjected.p[1] = polygon[i];
+                triProjected.p[2] = polygon[i + 1];
+                out.push_back(triProjected);
+            }
+        }
+        else
+        {
+            stats.backfacing++;
+        }
+    }
+}
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include "../include/profiler.hpp"
+
+profiler frameProfiler;
+
+namespace
+{
+
+const char *const COUNTER_NAMES[PROFILE_COUNTER_COUNT] = {
+    "triangles_occluded",
+    "triangles_in",
+    "backface_culled",
+    "near_clipped",
+    "screen_clipped",
+    "clipped_to_0",
+    "clipped_to_1",
+    "clipped_to_2",
+    "clipped_to_more",
+    "triangles_drawn",
+    "allocations",
+    "bytes_allocated",
+    "scratch_bytes"
+};
+
+std::atomic<uint32_t> nextThreadIndex{ 0 };
+thread_local uint32_t threadIndex = nextThreadIndex++;
+thread_local uint32_t scopeDepth = 0;
+
+std::atomic<uint64_t> allocations{ 0 };
+std::atomic<uint64_t> allocationBytes{ 0 };
+
+bool sameName(const char *a, const char *b)
+{
+    return a == b || std::strcmp(a, b) == 0;
+}
+
+}
+
+const char *profileCounterName(profileCounter c)
+{
+    return COUNTER_NAMES[c];
+}
+
+uint64_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t allocatedBytes()
+{
+    return allocationBytes.load(std::memory_order_relaxed);
+}
+
+double profileFrame::stageMilliseconds(const char *name) const
+{
+    double total = 0.0;
+    for (const auto &e : events)
+        if (sameName(e.name, name))
+            total += e.duration;
+    return total / 1000.0;
+}
+
+profiler::profiler()
+    : origin(profileClock::now()), ring(PROFILE_HISTORY_FRAMES)
+{
+    if (!GRAPH_PROFILE)
+        return;
+    current.events.reserve(PROFILE_FRAME_EVENTS);
+    for (auto &frame : ring)
+        frame.events.reserve(PROFILE_FRAME_EVENTS);
+}
+
+profiler::~profiler()
+{
+    close();
+}
+
+double profiler::microseconds(profileClock::time_point t) const
+{
+    return std::chrono::duration<double, std::micro>(t - origin).count();
+}
+
+void profiler::beginFrame()
+{
+    std::lock_guard<std::mutex> lk(lock);
+    current.index = frameCount;
+    current.start = microseconds(profileClock::now());
+    current.duration = 0.0;
+    current.thread = threadIndex;
+    std::fill(current.counters, current.counters + PROFILE_COUNTER_COUNT, 0);
+    current.events.clear();
+    inFrame = true;
+    allocationsAtStart = allocationCount();
+    bytesAtStart = allocatedBytes();
+}
+
+void profiler::endFrame()
+{
+    std::lock_guard<std::mutex> lk(lock);
+    if (!inFrame) return;
+    inFrame = false;
+
+    current.duration = microseconds(profileClock::now()) - current.start;
+    current.counters[PROFILE_ALLOCATIONS] = allocationCount() - allocationsAtStart;
+    current.counters[PROFILE_BYTES_ALLOCATED] = allocatedBytes() - bytesAtStart;
+
+    // Swapped into the ring so both event buffers keep their storage
+    std::swap(ring[ringNext], current);
+    const profileFrame &done = ring[ringNext];
+    ringNext = (ringNext + 1) % PROFILE_HISTORY_FRAMES;
+    frameCount++;
+
+    if (log.is_open()) writeLog(done);
+    if (trace.is_open()) writeTrace(done);
+}
+
+void profiler::addEvent(const char *name, profileClock::time_point start, profileClock::time_point end)
+{
+    double from = microseconds(start), to = microseconds(end);
+    std::lock_guard<std::mutex> lk(lock);
+    if (inFrame)
+        current.events.push_back({ name, from, to - from, threadIndex, scopeDepth });
+}
+
+void profiler::count(profileCounter c, uint64_t n)
+{
+    std::lock_guard<std::mutex> lk(lock);
+    if (inFrame)
+        current.counters[c] += n;
+}
+
+size_t profiler::historySize() const
+{
+    return (size_t)std::min<uint64_t>(frameCount, PROFILE_HISTORY_FRAMES);
+}
+
+const profileFrame &profiler::history(size_t i) const
+{
+    return ring[(ringNext + PROFILE_HISTORY_FRAMES - historySize() + i) % PROFILE_HISTORY_FRAMES];
+}
+
+bool profiler::openLog(const std::string &filename, std::string *error)
+{
+    std::lock_guard<std::mutex> lk(lock);
+    log.close();
+    log.open(filename, std::ios::out | std::ios::trunc);
+    if (!log)
+    {
+        if (error) *error = filename + ": could not open for writing";
+        return false;
+    }
+
+    logName = filename;
+    logCsv = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+    logFrames = 0;
+    logStages.clear();
+    log << std::fixed << std::setprecision(3);
+    return true;
+}
+
+bool profiler::openTrace(const std::string &filename, std::string *error)
+{
+    std::lock_guard<std::mutex> lk(lock);
+    trace.close();
+    trace.open(filename, std::ios::out | std::ios::trunc);
+    if (!trace)
+    {
+        if (error) *error = filename + ": could not open for writing";
+        return false;
+    }
+
+    trace << std::fixed << std::setprecision(3);
+    trace << "{\"traceEvents\":[";
+    traceFirst = true;
+    return true;
+}
+
+void profiler::close()
+{
+    std::lock_guard<std::mutex> lk(lock);
+    log.close();
+    if (trace.is_open())
+    {
+        trace << "\n]}\n";
+        trace.close();
+    }
+}
+
+void profiler::writeLog(const profileFrame &frame)
+{
+    // Start over in a fresh file once this one is long enough
+    if (logFrames == PROFILE_LOG_MAX_FRAMES)
+    {
+        log.close();
+        std::string previous = logName + ".1";
+        std::remove(previous.c_str());
+        std::rename(logName.c_str(), previous.c_str());
+        log.open(logName, std::ios::out | std::ios::trunc);
+        log << std::fixed << std::setprecision(3);
+        logFrames = 0;
+    }
+
+    if (logCsv)
+    {
+        // Columns come from the stages of the first frame logged
+        if (logStages.empty())
+            for (const auto &e : frame.events)
+                if (std::none_of(logStages.begin(), logStages.end(), [&](const char *n) { return sameName(n, e.name); }))
+                    logStages.push_back(e.name);
+
+        if (logFrames == 0)
+        {
+            log << "frame,frame_ms";
+            for (const char *name : logStages)
+                log << "," << name << "_ms";
+            for (const char *name : COUNTER_NAMES)
+                log << "," << name;
+            log << "\n";
+        }
+
+        log << frame.index << "," << frame.duration / 1000.0;
+        for (const char *name : logStages)
+            log << "," << frame.stageMilliseconds(name);
+        for (uint64_t value : frame.counters)
+            log << "," << value;
+        log << "\n";
+    }
+    else
+    {
+        log << "{\"frame\":" << frame.index << ",\"frame_ms\":" << frame.duration / 1000.0 << ",\"stages\":{";
+        for (size_t i = 0; i < frame.events.size(); i++)
+        {
+            const char *name = frame.events[i].name;
+            bool seen = false;
+            for (size_t j = 0; j < i && !seen; j++)
+                seen = sameName(frame.events[j].name, name);
+            if (seen) continue;
+            log << (i ? "," : "") << "\"" << name << "\":" << frame.stageMilliseconds(name);
+        }
+        log << "},\"counters\":{";
+        for (int c = 0; c < PROFILE_COUNTER_COUNT; c++)
+            log << (c ? "," : "") << "\"" << COUNTER_NAMES[c] << "\":" << frame.counters[c];
+        log << "}}\n";
+    }
+    logFrames++;
+}
+
+void profiler::writeTrace(const profileFrame &frame)
+{
+    auto separator = [&]()
+    {
+        trace << (traceFirst ? "\n" : ",\n");
+        traceFirst = false;
+    };
+
+    // The frame itself, every event as a complete event on its thread and
+    // the counters as one counter sample at the frame start
+    separator();
+    trace << "{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":" << frame.thread << ",\"ts\":" << frame.start
+          << ",\"dur\":" << frame.duration << ",\"args\":{\"index\":" << frame.index << "}}";
+    for (const auto &e : frame.events)
+    {
+        separator();
+        trace << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+              << ",\"ts\":" << e.start << ",\"dur\":" << e.duration << "}";
+    }
+    separator();
+    trace << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":" << frame.start << ",\"args\":{";
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; c++)
+        trace << (c ? "," : "") << "\"" << COUNTER_NAMES[c] << "\":" << frame.counters[c];
+    trace << "}}";
+}
+
+profileScope::profileScope(const char *n)
+    : name(n), start(profileClock::now())
+{
+    scopeDepth++;
+}
+
+profileScope::~profileScope()
+{
+    scopeDepth--;
+    frameProfiler.addEvent(name, start, profileClock::now());
+}
+
+#if GRAPH_PROFILE
+
+// Replaceable global allocation functions, counting every allocation made
+// through plain new. Over-aligned allocations go through the library's own
+// aligned versions and are not counted.
+static void *countedAlloc(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    for (;;)
+    {
+        if (void *p = std::malloc(size))
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+static void *countedAllocNothrow(std::size_t size) noexcept
+{
+    try
+    {
+        return countedAlloc(size);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new(std::size_t size) { return countedAlloc(size); }
+void *operator new[](std::size_t size) { return countedAlloc(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return countedAllocNothrow(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return countedAllocNothrow(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+
+#endif
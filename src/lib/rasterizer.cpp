@@ -0,0 +1,576 @@
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include "../include/rasterizer.hpp"
+#include "../include/thread_pool.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RASTER_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+void framebuffer::resize(unsigned int w, unsigned int h)
+{
+    width = w;
+    height = h;
+    color.assign((size_t)w * h, 0);
+    depth.assign((size_t)w * h, std::numeric_limits<float>::infinity());
+}
+
+void framebuffer::clear(sf::Color c)
+{
+    std::fill(color.begin(), color.end(), packColor(c));
+    std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::infinity());
+}
+
+const sf::Uint8 *framebuffer::pixels() const
+{
+    return reinterpret_cast<const sf::Uint8*>(color.data());
+}
+
+bool framebuffer::saveToFile(const std::string &filename) const
+{
+    bool isPPM = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0;
+
+    if (!isPPM)
+    {
+        // Let SFML pick the encoder (png, bmp, tga, jpg) from the extension
+        sf::Image image;
+        image.create(width, height, pixels());
+        return image.saveToFile(filename);
+    }
+
+    // Binary PPM needs no image library at all, which keeps headless
+    // boxes free of any extra dependency
+    std::ofstream f(filename, std::ios::binary);
+    if (!f.is_open()) return false;
+
+    f << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<sf::Uint8> row((size_t)width * 3);
+    const sf::Uint8 *src = pixels();
+    for (unsigned int y = 0; y < height; y++)
+    {
+        for (unsigned int x = 0; x < width; x++)
+        {
+            const sf::Uint8 *px = src + ((size_t)y * width + x) * 4;
+            row[x*3 + 0] = px[0];
+            row[x*3 + 1] = px[1];
+            row[x*3 + 2] = px[2];
+        }
+        f.write(reinterpret_cast<const char*>(row.data()), row.size());
+    }
+
+    return f.good();
+}
+
+sf::Uint32 packColor(sf::Color c)
+{
+    // sf::Color is laid out as r, g, b, a bytes, which is exactly the
+    // RGBA8 order SFML uploads from, regardless of host endianness
+    sf::Uint8 bytes[4] = { c.r, c.g, c.b, c.a };
+    sf::Uint32 packed;
+    std::memcpy(&packed, bytes, sizeof(packed));
+    return packed;
+}
+
+void rasterizeTriangle(framebuffer &fb, const triangle &tri)
+{
+    rasterizeTriangle(fb, tri, { 0, 0, (int)fb.width - 1, (int)fb.height - 1 });
+}
+
+// Vertices further out than this are clamped, the clipper's guard band
+// keeps real ones far inside. It bounds the edge functions: their steps
+// fit 32 bits with room for a block, and their values fit 64.
+const float MAX_SCREEN_COORD = 65536.0f;
+
+const int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;
+
+static int32_t toFixed(float v)
+{
+    v = std::min(std::max(v, -MAX_SCREEN_COORD), MAX_SCREEN_COORD);
+    return (int32_t)std::lrint(v * SUBPIXEL_SCALE);
+}
+
+bool setupTriangle(const triangle &tri, triangleSetup &s)
+{
+    int64_t x[3], y[3];
+    float z[3];
+    for (int i = 0; i < 3; i++)
+    {
+        if (!std::isfinite(tri.p[i].x) || !std::isfinite(tri.p[i].y)) return false;
+        x[i] = toFixed(tri.p[i].x);
+        y[i] = toFixed(tri.p[i].y);
+        z[i] = tri.p[i].z;
+    }
+
+    // Twice the signed area in subpixels, winding may come in either
+    // direction so it is made positive
+    int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) return false;
+    if (area < 0)
+    {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    // Pixel centers sit at x * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2
+    const int64_t half = SUBPIXEL_SCALE / 2;
+    int64_t loX = std::min({ x[0], x[1], x[2] }), hiX = std::max({ x[0], x[1], x[2] });
+    int64_t loY = std::min({ y[0], y[1], y[2] }), hiY = std::max({ y[0], y[1], y[2] });
+    s.minX = (int)((loX - half + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS);
+    s.minY = (int)((loY - half + SUBPIXEL_SCALE - 1) >> SUBPIXEL_BITS);
+    s.maxX = (int)((hiX - half) >> SUBPIXEL_BITS);
+    s.maxY = (int)((hiY - half) >> SUBPIXEL_BITS);
+    if (s.minX > s.maxX || s.minY > s.maxY) return false;
+
+    int64_t px = (int64_t)s.minX * SUBPIXEL_SCALE + half;
+    int64_t py = (int64_t)s.minY * SUBPIXEL_SCALE + half;
+    for (int i = 0; i < 3; i++)
+    {
+        // Edge from vertex i to the next one, positive inside. With this
+        // winding and y pointing down, top edges run right and left edges up.
+        int j = (i + 1) % 3;
+        int64_t dx = x[j] - x[i], dy = y[j] - y[i];
+        bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+        s.edge[i] = dx * (py - y[i]) - dy * (px - x[i]) - (topLeft ? 0 : 1);
+        s.stepX[i] = (int32_t)(-dy * SUBPIXEL_SCALE);
+        s.stepY[i] = (int32_t)(dx * SUBPIXEL_SCALE);
+    }
+
+    // Depth plane through the snapped vertices, in pixels
+    double ux = (double)(x[1] - x[0]) / SUBPIXEL_SCALE, uy = (double)(y[1] - y[0]) / SUBPIXEL_SCALE;
+    double vx = (double)(x[2] - x[0]) / SUBPIXEL_SCALE, vy = (double)(y[2] - y[0]) / SUBPIXEL_SCALE;
+    double uz = (double)z[1] - z[0], vz = (double)z[2] - z[0];
+    double det = ux * vy - uy * vx;
+    double dzdx = (uz * vy - uy * vz) / det;
+    double dzdy = (ux * vz - uz * vx) / det;
+    double cx = (double)px / SUBPIXEL_SCALE - (double)x[0] / SUBPIXEL_SCALE;
+    double cy = (double)py / SUBPIXEL_SCALE - (double)y[0] / SUBPIXEL_SCALE;
+    s.zAnchor = (float)(z[0] + dzdx * cx + dzdy * cy);
+    s.dzdx = (float)dzdx;
+    s.dzdy = (float)dzdy;
+    s.color = packColor(tri.color);
+    return true;
+}
+
+// Depth at the center of the block's first pixel, and of pixel (ox, oy)
+// within it. Every kernel computes depth with exactly these operations,
+// in this order, so they all agree to the last bit.
+static float blockDepth(const triangleSetup &s, int bx, int by)
+{
+    return s.zAnchor + ((float)(bx - s.minX) * s.dzdx + (float)(by - s.minY) * s.dzdy);
+}
+
+static float pixelDepth(const triangleSetup &s, float zBlock, int ox, int oy)
+{
+    return zBlock + ((float)ox * s.dzdx + (float)oy * s.dzdy);
+}
+
+static void writePixel(framebuffer &fb, size_t i, float z, sf::Uint32 color)
+{
+    if (z < fb.depth[i])
+    {
+        fb.depth[i] = z;
+        fb.color[i] = color;
+    }
+}
+
+// Edge values at the first pixel of a block for the edges in the partial
+// mask, the only ones still tested per pixel. They fit 32 bits because
+// the edge changes sign within the block.
+struct blockEdges
+{
+    int32_t value[3];
+    unsigned partial;
+};
+
+// Pixels [x0, x1] x [y0, y1] of the block at (bx, by), one at a time.
+// Used for every block without SIMD and for blocks the clip rectangle
+// cuts on the others.
+static void fillBlockScalar(framebuffer &fb, const triangleSetup &s, int bx, int by, float zBlock,
+                            const blockEdges &e, int x0, int y0, int x1, int y1)
+{
+    for (int y = y0; y <= y1; y++)
+    {
+        size_t row = (size_t)y * fb.width;
+        for (int x = x0; x <= x1; x++)
+        {
+            int ox = x - bx, oy = y - by;
+            bool covered = true;
+            for (int i = 0; i < 3; i++)
+                if (e.partial & (1u << i))
+                    covered = covered && e.value[i] + ox * s.stepX[i] + oy * s.stepY[i] >= 0;
+            if (covered)
+                writePixel(fb, row + x, pixelDepth(s, zBlock, ox, oy), s.color);
+        }
+    }
+}
+
+// The block kernels fill rows [oy0, oy1] of a block, the ones the
+// triangle's bounds reach
+struct scalarBlocks
+{
+    static void fill(framebuffer &fb, const triangleSetup &s, int bx, int by, float zBlock, const blockEdges &e,
+                     int oy0, int oy1)
+    {
+        fillBlockScalar(fb, s, bx, by, zBlock, e, bx, by + oy0, bx + RASTER_BLOCK - 1, by + oy1);
+    }
+};
+
+#ifdef RASTER_X86_64
+
+// Four pixels of a block row per step
+struct sseBlocks
+{
+    static void fill(framebuffer &fb, const triangleSetup &s, int bx, int by, float zBlock, const blockEdges &e,
+                     int oy0, int oy1)
+    {
+        const __m128i minusOne = _mm_set1_epi32(-1);
+        const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+        const __m128 dzdx = _mm_set1_ps(s.dzdx);
+        const __m128 zBase = _mm_set1_ps(zBlock);
+        const __m128i color = _mm_set1_epi32((int)s.color);
+
+        // Per lane edge steps, {0, 1, 2, 3} * stepX
+        __m128i laneStep[3];
+        for (int i = 0; i < 3; i++)
+            laneStep[i] = _mm_setr_epi32(0, s.stepX[i], 2 * s.stepX[i], 3 * s.stepX[i]);
+
+        for (int oy = oy0; oy <= oy1; oy++)
+        {
+            size_t row = (size_t)(by + oy) * fb.width + bx;
+            __m128 rowZ = _mm_set1_ps((float)oy * s.dzdy);
+            for (int ox = 0; ox < RASTER_BLOCK; ox += 4)
+            {
+                __m128i covered = minusOne;
+                for (int i = 0; i < 3; i++)
+                {
+                    if (!(e.partial & (1u << i))) continue;
+                    __m128i v = _mm_add_epi32(_mm_set1_epi32(e.value[i] + ox * s.stepX[i] + oy * s.stepY[i]), laneStep[i]);
+                    covered = _mm_and_si128(covered, _mm_cmpgt_epi32(v, minusOne));
+                }
+
+                __m128 offsetX = _mm_cvtepi32_ps(_mm_add_epi32(lanes, _mm_set1_epi32(ox)));
+                __m128 z = _mm_add_ps(zBase, _mm_add_ps(_mm_mul_ps(offsetX, dzdx), rowZ));
+                float *depth = &fb.depth[row + ox];
+                sf::Uint32 *pixels = &fb.color[row + ox];
+                __m128 oldZ = _mm_loadu_ps(depth);
+                __m128i pass = _mm_and_si128(covered, _mm_castps_si128(_mm_cmplt_ps(z, oldZ)));
+                if (_mm_movemask_epi8(pass) == 0) continue;
+
+                __m128 passF = _mm_castsi128_ps(pass);
+                _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(passF, z), _mm_andnot_ps(passF, oldZ)));
+                __m128i oldColor = _mm_loadu_si128((const __m128i *)pixels);
+                _mm_storeu_si128((__m128i *)pixels, _mm_or_si128(_mm_and_si128(pass, color), _mm_andnot_si128(pass, oldColor)));
+            }
+        }
+    }
+};
+
+// A whole block row per step
+struct avx2Blocks
+{
+    TARGET_AVX2 static void fill(framebuffer &fb, const triangleSetup &s, int bx, int by, float zBlock,
+                                 const blockEdges &e, int oy0, int oy1)
+    {
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256 offsetX = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        const __m256 dzdx = _mm256_set1_ps(s.dzdx);
+        const __m256 zBase = _mm256_set1_ps(zBlock);
+        const __m256i color = _mm256_set1_epi32((int)s.color);
+
+        __m256i laneStep[3];
+        for (int i = 0; i < 3; i++)
+            laneStep[i] = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(s.stepX[i]));
+
+        // Kept apart from the row term so no multiply and add fuse
+        __m256 offsetZ = _mm256_mul_ps(offsetX, dzdx);
+
+        for (int oy = oy0; oy <= oy1; oy++)
+        {
+            size_t row = (size_t)(by + oy) * fb.width + bx;
+            __m256i covered = minusOne;
+            for (int i = 0; i < 3; i++)
+            {
+                if (!(e.partial & (1u << i))) continue;
+                __m256i v = _mm256_add_epi32(_mm256_set1_epi32(e.value[i] + oy * s.stepY[i]), laneStep[i]);
+                covered = _mm256_and_si256(covered, _mm256_cmpgt_epi32(v, minusOne));
+            }
+
+            __m256 z = _mm256_add_ps(zBase, _mm256_add_ps(offsetZ, _mm256_set1_ps((float)oy * s.dzdy)));
+            float *depth = &fb.depth[row];
+            sf::Uint32 *pixels = &fb.color[row];
+            __m256 oldZ = _mm256_loadu_ps(depth);
+            __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(covered), _mm256_cmp_ps(z, oldZ, _CMP_LT_OQ));
+            if (_mm256_movemask_ps(pass) == 0) continue;
+
+            _mm256_storeu_ps(depth, _mm256_blendv_ps(oldZ, z, pass));
+            __m256 oldColor = _mm256_loadu_ps((const float *)pixels);
+            _mm256_storeu_ps((float *)pixels, _mm256_blendv_ps(oldColor, _mm256_castsi256_ps(color), pass));
+        }
+    }
+};
+
+#endif
+
+// Walks the blocks of s inside clip. Blocks wholly inside clip go to
+// Blocks::fill, the ones it cuts are filled pixel by pixel.
+template <typename Blocks>
+static void fillTriangle(framebuffer &fb, const triangleSetup &s, const pixelRect &clip)
+{
+    int minX = std::max(clip.minX, s.minX), minY = std::max(clip.minY, s.minY);
+    int maxX = std::min(clip.maxX, s.maxX), maxY = std::min(clip.maxY, s.maxY);
+    if (minX > maxX || minY > maxY) return;
+
+    const int last = RASTER_BLOCK - 1;
+    int bx0 = minX & ~last, by0 = minY & ~last;
+
+    // Smallest and largest change of each edge across a block, from its
+    // first pixel
+    int64_t lowest[3], highest[3], rowEdge[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int64_t sx = (int64_t)s.stepX[i] * last, sy = (int64_t)s.stepY[i] * last;
+        lowest[i] = std::min<int64_t>(sx, 0) + std::min<int64_t>(sy, 0);
+        highest[i] = std::max<int64_t>(sx, 0) + std::max<int64_t>(sy, 0);
+        rowEdge[i] = s.edge[i] + (int64_t)(bx0 - s.minX) * s.stepX[i] + (int64_t)(by0 - s.minY) * s.stepY[i];
+    }
+
+    for (int by = by0; by <= maxY; by += RASTER_BLOCK)
+    {
+        int64_t edge[3] = { rowEdge[0], rowEdge[1], rowEdge[2] };
+        for (int bx = bx0; bx <= maxX; bx += RASTER_BLOCK)
+        {
+            blockEdges e = { { 0, 0, 0 }, 0 };
+            bool outside = false;
+            for (int i = 0; i < 3; i++)
+            {
+                if (edge[i] + highest[i] < 0)
+                    outside = true;
+                else if (edge[i] + lowest[i] < 0)
+                {
+                    e.value[i] = (int32_t)edge[i];
+                    e.partial |= 1u << i;
+                }
+            }
+
+            if (!outside)
+            {
+                float zBlock = blockDepth(s, bx, by);
+                if (bx >= clip.minX && by >= clip.minY && bx + last <= clip.maxX && by + last <= clip.maxY)
+                    Blocks::fill(fb, s, bx, by, zBlock, e, std::max(by, minY) - by, std::min(by + last, maxY) - by);
+                else
+                    fillBlockScalar(fb, s, bx, by, zBlock, e, std::max(bx, minX), std::max(by, minY),
+                                    std::min(bx + last, maxX), std::min(by + last, maxY));
+            }
+
+            for (int i = 0; i < 3; i++)
+                edge[i] += (int64_t)s.stepX[i] * RASTER_BLOCK;
+        }
+        for (int i = 0; i < 3; i++)
+            rowEdge[i] += (int64_t)s.stepY[i] * RASTER_BLOCK;
+    }
+}
+
+struct rasterKernel
+{
+    void (*fill)(framebuffer &, const triangleSetup &, const pixelRect &);
+    const char *name;
+};
+
+static rasterKernel selectRasterKernel()
+{
+    const char *cap = std::getenv("GRAPH_RASTER_KERNEL");
+    rasterKernel scalar = { fillTriangle<scalarBlocks>, "scalar" };
+    if (cap && std::strcmp(cap, "scalar") == 0) return scalar;
+
+#ifdef RASTER_X86_64
+    bool allowAVX2 = !cap || std::strcmp(cap, "sse") != 0;
+    if (allowAVX2 && cpuHasAVX2())
+        return { fillTriangle<avx2Blocks>, "avx2" };
+    return { fillTriangle<sseBlocks>, "sse" };
+#else
+    return scalar;
+#endif
+}
+
+static const rasterKernel &rasterKernelTable()
+{
+    static const rasterKernel kernel = selectRasterKernel();
+    return kernel;
+}
+
+const char *rasterKernelName()
+{
+    return rasterKernelTable().name;
+}
+
+void rasterizeTriangle(framebuffer &fb, const triangle &tri, const pixelRect &clip)
+{
+    triangleSetup s;
+    if (setupTriangle(tri, s))
+        rasterKernelTable().fill(fb, s, clip);
+}
+
+// The reference shares only the rules with setupTriangle and the kernels,
+// none of their code: vertices snap the same way, but edges keep the
+// winding they came with, the fill rule is decided from each edge's
+// outward normal, and depth is interpolated per pixel in double
+static int64_t referenceFixed(float v)
+{
+    double clamped = std::min(std::max((double)v, -(double)MAX_SCREEN_COORD), (double)MAX_SCREEN_COORD);
+    return (int64_t)std::nearbyint(clamped * SUBPIXEL_SCALE);
+}
+
+void rasterizeTriangleReference(framebuffer &fb, const triangle &tri, const pixelRect &clip)
+{
+    int64_t x[3], y[3];
+    for (int i = 0; i < 3; i++)
+    {
+        if (!std::isfinite(tri.p[i].x) || !std::isfinite(tri.p[i].y)) return;
+        x[i] = referenceFixed(tri.p[i].x);
+        y[i] = referenceFixed(tri.p[i].y);
+    }
+
+    // Edge i runs between the two vertices other than i. Its function is
+    // 0 on it and, at vertex i, twice the signed area.
+    int64_t dx[3], dy[3], ax[3], ay[3], area[3];
+    bool owns[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int a = (i + 1) % 3, b = (i + 2) % 3;
+        ax[i] = x[a];
+        ay[i] = y[a];
+        dx[i] = x[b] - x[a];
+        dy[i] = y[b] - y[a];
+        area[i] = dx[i] * (y[i] - ay[i]) - dy[i] * (x[i] - ax[i]);
+        if (area[i] == 0) return;
+
+        // Pixels right on an edge belong to the triangle when the edge's
+        // outward normal points left, or straight up on a horizontal edge
+        int64_t outX = area[i] > 0 ? dy[i] : -dy[i];
+        int64_t outY = area[i] > 0 ? -dx[i] : dx[i];
+        owns[i] = outX < 0 || (dy[i] == 0 && outY < 0);
+    }
+
+    int64_t loX = std::min({ x[0], x[1], x[2] }), hiX = std::max({ x[0], x[1], x[2] });
+    int64_t loY = std::min({ y[0], y[1], y[2] }), hiY = std::max({ y[0], y[1], y[2] });
+    int x0 = (int)std::max<int64_t>(clip.minX, (loX >> SUBPIXEL_BITS) - 1);
+    int x1 = (int)std::min<int64_t>(clip.maxX, (hiX >> SUBPIXEL_BITS) + 1);
+    int y0 = (int)std::max<int64_t>(clip.minY, (loY >> SUBPIXEL_BITS) - 1);
+    int y1 = (int)std::min<int64_t>(clip.maxY, (hiY >> SUBPIXEL_BITS) + 1);
+    sf::Uint32 color = packColor(tri.color);
+
+    for (int py = y0; py <= y1; py++)
+    {
+        for (int px = x0; px <= x1; px++)
+        {
+            // Pixel center in subpixels
+            int64_t cx = (int64_t)px * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+            int64_t cy = (int64_t)py * SUBPIXEL_SCALE + SUBPIXEL_SCALE / 2;
+            double z = 0.0;
+            bool covered = true;
+            for (int i = 0; i < 3 && covered; i++)
+            {
+                int64_t e = dx[i] * (cy - ay[i]) - dy[i] * (cx - ax[i]);
+                covered = (area[i] > 0 ? e > 0 : e < 0) || (e == 0 && owns[i]);
+                z += (double)e / (double)area[i] * tri.p[i].z;
+            }
+            if (covered)
+                writePixel(fb, (size_t)py * fb.width + px, (float)z, color);
+        }
+    }
+}
+
+const size_t MIN_TRIS_PER_BIN_CHUNK = 2048;
+
+size_t tiledRasterizer::scratchBytes() const
+{
+    size_t bytes = capacityBytes(bins);
+    for (const auto &chunk : bins)
+    {
+        bytes += capacityBytes(chunk);
+        for (const auto &tile : chunk)
+            bytes += capacityBytes(tile);
+    }
+    return bytes;
+}
+
+void tiledRasterizer::draw(framebuffer &fb, const std::vector<triangle> &tris)
+{
+    int tilesX = ((int)fb.width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = ((int)fb.height + TILE_SIZE - 1) / TILE_SIZE;
+    size_t tileCount = (size_t)tilesX * tilesY;
+
+    size_t chunks = chunkCount(pool, tris.size(), MIN_TRIS_PER_BIN_CHUNK);
+    if (bins.size() < chunks)
+        bins.resize(chunks);
+
+    // Binning, every chunk of triangles writes its own set of tile lists
+    parallelFor(pool, chunks, [&](size_t c)
+    {
+        auto &chunkBins = bins[c];
+        chunkBins.resize(tileCount);
+        for (auto &bin : chunkBins)
+            bin.clear();
+
+        size_t first = tris.size() * c / chunks;
+        size_t last = tris.size() * (c + 1) / chunks;
+        for (size_t i = first; i < last; i++)
+        {
+            const triangle &t = tris[i];
+            float minX = std::min({ t.p[0].x, t.p[1].x, t.p[2].x });
+            float minY = std::min({ t.p[0].y, t.p[1].y, t.p[2].y });
+            float maxX = std::max({ t.p[0].x, t.p[1].x, t.p[2].x });
+            float maxY = std::max({ t.p[0].y, t.p[1].y, t.p[2].y });
+            if (maxX < 0.0f || maxY < 0.0f || minX >= (float)fb.width || minY >= (float)fb.height)
+                continue;
+
+            int tx0 = std::max(0, (int)std::floor(minX) / TILE_SIZE);
+            int ty0 = std::max(0, (int)std::floor(minY) / TILE_SIZE);
+            int tx1 = std::min(tilesX - 1, (int)std::ceil(maxX) / TILE_SIZE);
+            int ty1 = std::min(tilesY - 1, (int)std::ceil(maxY) / TILE_SIZE);
+
+            for (int ty = ty0; ty <= ty1; ty++)
+                for (int tx = tx0; tx <= tx1; tx++)
+                    chunkBins[(size_t)ty * tilesX + tx].push_back((uint32_t)i);
+        }
+    });
+
+    // Clear and fill every tile, the chunk lists are walked in order so
+    // the result does not depend on how the work was split
+    sf::Uint32 clear = packColor(clearColor);
+    parallelFor(pool, tileCount, [&](size_t tile)
+    {
+        int tx = (int)(tile % tilesX), ty = (int)(tile / tilesX);
+        pixelRect rect = {
+            tx * TILE_SIZE,
+            ty * TILE_SIZE,
+            std::min((int)fb.width, (tx + 1) * TILE_SIZE) - 1,
+            std::min((int)fb.height, (ty + 1) * TILE_SIZE) - 1
+        };
+
+        for (int y = rect.minY; y <= rect.maxY; y++)
+        {
+            size_t row = (size_t)y * fb.width;
+            std::fill(fb.color.begin() + row + rect.minX, fb.color.begin() + row + rect.maxX + 1, clear);
+            std::fill(fb.depth.begin() + row + rect.minX, fb.depth.begin() + row + rect.maxX + 1, std::numeric_limits<float>::infinity());
+        }
+
+        for (size_t c = 0; c < chunks; c++)
+            for (uint32_t i : bins[c][tile])
+                rasterizeTriangle(fb, tris[i], rect);
+    });
+}
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "../include/resolution.hpp"
+
+void resolutionController::setOutputSize(unsigned width, unsigned height)
+{
+    outputWidth = std::max(1u, width);
+    outputHeight = std::max(1u, height);
+    resize(currentScale);
+    samples = 0;
+}
+
+void resolutionController::setScale(float s)
+{
+    resize(s);
+    samples = 0;
+    settle = 0;
+}
+
+bool resolutionController::resize(float s)
+{
+    currentScale = std::min(std::max(s, minScale), maxScale);
+
+    // Whole width steps, the height following the output's aspect ratio
+    unsigned steps = (unsigned)std::lround(outputWidth * currentScale / RESOLUTION_WIDTH_STEP);
+    unsigned w = std::min(outputWidth, std::max(1u, steps) * RESOLUTION_WIDTH_STEP);
+    unsigned h = std::max(1u, (unsigned)std::lround((double)w * outputHeight / outputWidth));
+    bool changed = w != renderWidth || h != renderHeight;
+    renderWidth = w;
+    renderHeight = h;
+    return changed;
+}
+
+bool resolutionController::update(float frameMs)
+{
+    if (targetMs <= 0.0f)
+        return false;
+    if (settle > 0)
+    {
+        settle--;
+        return false;
+    }
+
+    // Newest last, the oldest dropped once the history is full
+    if (samples == RESOLUTION_HISTORY)
+    {
+        std::copy(history + 1, history + RESOLUTION_HISTORY, history);
+        samples--;
+    }
+    history[samples++] = frameMs;
+
+    // Means rather than single frames, one stall is not worth the sharpness
+    size_t recent = std::min(samples, RESOLUTION_RECENT);
+    float recentMs = std::accumulate(history + samples - recent, history + samples, 0.0f) / recent;
+    float aim = targetMs * headroom;
+    float s = currentScale;
+    if (recentMs > targetMs)
+        s = currentScale * std::sqrt(aim / recentMs);
+    else if (samples == RESOLUTION_HISTORY && currentScale < maxScale)
+    {
+        float meanMs = std::accumulate(history, history + samples, 0.0f) / samples;
+        if (meanMs < aim)
+            s = std::min(currentScale * std::sqrt(aim / meanMs), currentScale + maxStepUp);
+    }
+    if (s == currentScale)
+        return false;
+
+    float before = currentScale;
+    bool changed = resize(s);
+    if (!changed)
+    {
+        // Too small a step to move the width, try again with more frames
+        currentScale = before;
+        return false;
+    }
+    samples = 0;
+    settle = settleFrames;
+    return true;
+}
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include "../include/profiler.hpp"
+#include "../include/scene.hpp"
+#include "../include/thread_pool.hpp"
+
+// Fewest triangles worth a batch of its own
+const size_t MIN_TRIS_PER_BATCH = 4096;
+
+// Most triangles a batch starts on, which bounds the bins
+const size_t MAX_TRIS_PER_BATCH = 16384;
+
+// Batches run at once per thread, so uneven ones balance out
+const size_t BATCHES_PER_THREAD = 4;
+
+uint32_t scene::addAsset(const mesh &m)
+{
+    sceneAsset a;
+    a.m = &m;
+    float radius2 = 0.0f;
+    const float lo[3] = { m.boundsMin.x, m.boundsMin.y, m.boundsMin.z };
+    const float hi[3] = { m.boundsMax.x, m.boundsMax.y, m.boundsMax.z };
+    for (int k = 0; k < 3; k++)
+    {
+        a.center[k] = 0.5f * (lo[k] + hi[k]);
+        radius2 += 0.25f * (hi[k] - lo[k]) * (hi[k] - lo[k]);
+    }
+    a.radius = std::sqrt(radius2);
+    assets.push_back(a);
+    return (uint32_t)assets.size() - 1;
+}
+
+bool scene::addInstance(uint32_t asset, const float position[3], float yaw, float scale)
+{
+    if (asset >= assets.size() || scale == 0.0f || !std::isfinite(scale))
+        return false;
+    instances.push_back({ asset, { position[0], position[1], position[2] }, yaw, scale });
+    return true;
+}
+
+size_t scene::bytes() const
+{
+    return capacityBytes(assets) + capacityBytes(instances);
+}
+
+// Rotation and translation of an instance, its scale left out
+static affineMatrix rigidMatrix(const meshInstance &instance)
+{
+    affineMatrix m = toAffine(makeRotatedMatrixY(instance.yaw));
+    m.m[3][0] = instance.position[0];
+    m.m[3][1] = instance.position[1];
+    m.m[3][2] = instance.position[2];
+    return m;
+}
+
+void sceneStage::run(const scene &s, const frameParams &params, std::vector<triangle> &out)
+{
+    counters = sceneStats();
+    clipCounters = clipStats();
+
+    mat4x4 matViewProj = mulAffineByMatrix(toAffine(params.matView), params.matProj);
+
+    // Spheres against the world space frustum, taken through each
+    // instance's transform without building its matrix
+    {
+        PROFILE_SCOPE("instance cull");
+        frustum f = makeFrustum(matViewProj);
+        visible.clear();
+        for (size_t i = 0; i < s.instances.size(); i++)
+        {
+            const meshInstance &instance = s.instances[i];
+            const sceneAsset &a = s.assets[instance.asset];
+            float c = std::cos(instance.yaw), n = std::sin(instance.yaw);
+            float x = a.center[0] * instance.scale, y = a.center[1] * instance.scale, z = a.center[2] * instance.scale;
+            const float center[3] = { x * c - z * n + instance.position[0], y + instance.position[1],
+                                      x * n + z * c + instance.position[2] };
+            counters.instancesTested++;
+            if (testSphere(f, center, a.radius * std::fabs(instance.scale)) == CULL_OUTSIDE)
+            {
+                counters.instancesCulled++;
+                continue;
+            }
+            visible.push_back((uint32_t)i);
+            counters.trianglesTested += a.m->triangleCount();
+        }
+    }
+
+    // Consecutive visible instances, a few batches per thread unless that
+    // leaves them too small, and none so large its bin grows with the scene
+    size_t threads = pool ? pool->size() : 1;
+    size_t chunks = chunkCount(pool, counters.trianglesTested, MIN_TRIS_PER_BATCH);
+    size_t perBatch = std::min((counters.trianglesTested + chunks - 1) / chunks, MAX_TRIS_PER_BATCH);
+    size_t slots = threads * BATCHES_PER_THREAD;
+    if (batches.size() < slots)
+        batches.resize(slots);
+
+    // Rounds of at most one batch per slot, each round's bins appended
+    // before the next one reuses them
+    PROFILE_SCOPE("instances");
+    uint32_t next = 0;
+    while (next < visible.size())
+    {
+        size_t count = 0;
+        while (count < slots && next < visible.size())
+        {
+            batch &b = batches[count++];
+            b.first = next;
+            size_t tris = 0;
+            while (next < visible.size() && tris < perBatch)
+                tris += s.assets[s.instances[visible[next++]].asset].m->triangleCount();
+            b.last = next;
+        }
+        parallelFor(pool, count, [&](size_t i)
+        {
+            batch &b = batches[i];
+            b.bin.clear();
+            b.stats = clipStats();
+            for (uint32_t v = b.first; v < b.last; v++)
+                drawInstance(s, s.instances[visible[v]], params, matViewProj, b);
+        });
+
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            clipCounters.add(batches[i].stats);
+            total += batches[i].bin.size();
+        }
+        for (size_t i = 0; i < count; i++)
+            out.insert(out.end(), batches[i].bin.begin(), batches[i].bin.end());
+        counters.trianglesDrawn += total;
+    }
+}
+
+void sceneStage::drawInstance(const scene &s, const meshInstance &instance, const frameParams &params,
+                              const mat4x4 &matViewProj, batch &b)
+{
+    const mesh &m = *s.assets[instance.asset].m;
+
+    // World matrix: the rigid part with the scale folded into its rotation
+    affineMatrix matRigid = rigidMatrix(instance);
+    affineMatrix matWorld = matRigid;
+    for (int r = 0; r < 3; r++)
+        for (int k = 0; k < 3; k++)
+            matWorld.m[r][k] *= instance.scale;
+    mat4x4 matWorldViewProj = mulAffineByMatrix(matWorld, matViewProj);
+
+    // Every vertex of the asset, straight from object space
+    size_t vertexCount = m.verts.size();
+    if (b.outcodes.size() < vertexCount)
+    {
+        b.clipVerts.resize(vertexCount);
+        b.screenVerts.resize(vertexCount);
+        b.outcodes.resize(vertexCount);
+    }
+    transformVertices(matWorldViewProj, m.verts, b.clipVerts, 0, vertexCount);
+    projectVertices(params.vp, b.clipVerts, b.screenVerts, 0, vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+        b.outcodes[i] = clipOutcode(b.clipVerts.x[i], b.clipVerts.y[i], b.clipVerts.z[i], b.clipVerts.w[i]);
+
+    // Camera and light in object space. A uniform scale changes neither
+    // the face normals nor which side of a face the camera is on.
+    affineMatrix matRigidInv = quickInverse(matRigid);
+    vec3d objectCamera = divVector(transformPoint(matRigidInv, params.cameraPos), instance.scale);
+    vec3d objectLight = transformDirection(matRigidInv, normVector(params.lightDirection));
+
+    transformedVertices transformed = { m.verts, &b.clipVerts, &b.screenVerts, b.outcodes.data(), objectCamera, objectLight, params.vp };
+    assembleTriangles(transformed, m.indices.data(), m.faceNormals.data(), 0, m.triangleCount(), b.bin, b.stats);
+}
+
+size_t sceneStage::scratchBytes() const
+{
+    size_t bytes = capacityBytes(visible) + capacityBytes(batches);
+    for (const batch &b : batches)
+        bytes += b.clipVerts.capacityBytes() + b.screenVerts.capacityBytes() + capacityBytes(b.outcodes) +
+                 capacityBytes(b.bin);
+    return bytes;
+}
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include "../include/terrain_stream.hpp"
+
+bool writeTerrainTiles(const mesh &m, int tilesPerSide, const std::string &dir, std::string *error)
+{
+    namespace fs = std::filesystem;
+    auto fail = [&](const std::string &message)
+    {
+        if (error) *error = message;
+        return false;
+    };
+
+    if (tilesPerSide < 1)
+        return fail("need at least one tile per side");
+    if (tilesPerSide > MAX_TERRAIN_TILES_PER_SIDE)
+        return fail("need at most " + std::to_string(MAX_TERRAIN_TILES_PER_SIDE) + " tiles per side");
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+        return fail(dir + ": could not create directory");
+
+    // Cell of every triangle, by its centroid
+    float originX = m.boundsMin.x, originZ = m.boundsMin.z;
+    float cellX = std::max(m.boundsMax.x - originX, 1e-6f) / tilesPerSide;
+    float cellZ = std::max(m.boundsMax.z - originZ, 1e-6f) / tilesPerSide;
+    std::vector<std::vector<uint32_t>> cells((size_t)tilesPerSide * tilesPerSide);
+    for (size_t t = 0; t < m.triangleCount(); t++)
+    {
+        const uint32_t *idx = &m.indices[t * 3];
+        float cx = (m.verts.x[idx[0]] + m.verts.x[idx[1]] + m.verts.x[idx[2]]) / 3.0f;
+        float cz = (m.verts.z[idx[0]] + m.verts.z[idx[1]] + m.verts.z[idx[2]]) / 3.0f;
+        int col = std::min(std::max((int)((cx - originX) / cellX), 0), tilesPerSide - 1);
+        int row = std::min(std::max((int)((cz - originZ) / cellZ), 0), tilesPerSide - 1);
+        cells[(size_t)row * tilesPerSide + col].push_back((uint32_t)t);
+    }
+
+    std::string manifestName = (fs::path(dir) / TERRAIN_MANIFEST).string();
+    std::ofstream manifest(manifestName, std::ios::trunc);
+    if (!manifest.is_open())
+        return fail(manifestName + ": could not write manifest");
+    manifest << "# col row file minX minY minZ maxX maxY maxZ bytes" << std::endl;
+    manifest << std::setprecision(9);
+
+    // Every tile gets its own copy of the vertices its triangles use
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(m.verts.size(), unused);
+    for (int row = 0; row < tilesPerSide; row++)
+    {
+        for (int col = 0; col < tilesPerSide; col++)
+        {
+            const std::vector<uint32_t> &cell = cells[(size_t)row * tilesPerSide + col];
+            if (cell.empty())
+                continue;
+
+            std::vector<float> x, y, z;
+            std::vector<uint32_t> indices;
+            std::vector<uint32_t> used;
+            indices.reserve(cell.size() * 3);
+            for (uint32_t t : cell)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    uint32_t v = m.indices[t * 3 + k];
+                    if (remap[v] == unused)
+                    {
+                        remap[v] = (uint32_t)x.size();
+                        used.push_back(v);
+                        x.push_back(m.verts.x[v]);
+                        y.push_back(m.verts.y[v]);
+                        z.push_back(m.verts.z[v]);
+                    }
+                    indices.push_back(remap[v]);
+                }
+            }
+            for (uint32_t v : used)
+                remap[v] = unused;
+
+            mesh tile;
+            std::string file = "tile_" + std::to_string(col) + "_" + std::to_string(row) + ".gmesh";
+            std::string path = (fs::path(dir) / file).string();
+            if (!tile.loadFromArrays(std::move(x), std::move(y), std::move(z), std::move(indices), error)
+                || !tile.saveToCacheFile(path, error))
+                return false;
+
+            uint64_t bytes = fs::file_size(path, ec);
+            manifest << col << " " << row << " " << file << " "
+                     << tile.boundsMin.x << " " << tile.boundsMin.y << " " << tile.boundsMin.z << " "
+                     << tile.boundsMax.x << " " << tile.boundsMax.y << " " << tile.boundsMax.z << " "
+                     << bytes << std::endl;
+        }
+    }
+
+    if (!manifest.good())
+        return fail(manifestName + ": could not write manifest");
+    return true;
+}
+
+bool readTerrainManifest(const std::string &dir, std::vector<terrainTileInfo> &tiles, std::string *error)
+{
+    std::string manifestName = (std::filesystem::path(dir) / TERRAIN_MANIFEST).string();
+    std::ifstream manifest(manifestName);
+    if (!manifest.is_open())
+    {
+        if (error) *error = manifestName + ": could not open manifest";
+        return false;
+    }
+
+    tiles.clear();
+    std::string line;
+    for (int lineNumber = 1; std::getline(manifest, line); lineNumber++)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        terrainTileInfo info;
+        fields >> info.col >> info.row >> info.file
+               >> info.boundsMin[0] >> info.boundsMin[1] >> info.boundsMin[2]
+               >> info.boundsMax[0] >> info.boundsMax[1] >> info.boundsMax[2] >> info.bytes;
+        if (fields.fail())
+        {
+            if (error) *error = manifestName + ":" + std::to_string(lineNumber) + ": malformed tile";
+            return false;
+        }
+        tiles.push_back(info);
+    }
+
+    if (tiles.empty())
+    {
+        if (error) *error = manifestName + ": no tiles";
+        return false;
+    }
+    return true;
+}
+
+terrainStreamer::terrainStreamer() = default;
+
+terrainStreamer::~terrainStreamer()
+{
+    close();
+}
+
+bool terrainStreamer::open(const std::string &dir, std::string *error)
+{
+    close();
+    if (!readTerrainManifest(dir, tiles, error))
+        return false;
+
+    directory = dir;
+    states.assign(tiles.size(), TILE_ABSENT);
+    wantedFrame.assign(tiles.size(), 0);
+    tileSize = 0.0f;
+    for (const terrainTileInfo &t : tiles)
+        tileSize = std::max({ tileSize, t.boundsMax[0] - t.boundsMin[0], t.boundsMax[2] - t.boundsMin[2] });
+    tileSize = std::max(tileSize, 1e-6f);
+
+    frame = 0;
+    counters.pendingBytes = 0;
+    residentChanged = true;
+    counters = terrainStreamStats();
+    stopping = false;
+    worker = std::thread(&terrainStreamer::ioLoop, this);
+    return true;
+}
+
+void terrainStreamer::close()
+{
+    if (worker.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+    requests.clear();
+    finished.clear();
+    loading = false;
+    resident.clear();
+    spare.clear();
+    counters.residentBytes = 0;
+    counters.pendingBytes = 0;
+    tiles.clear();
+    states.clear();
+    wantedFrame.clear();
+}
+
+void terrainStreamer::ioLoop()
+{
+    for (;;)
+    {
+        uint32_t tile;
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            wake.wait(lk, [&]{ return stopping || !requests.empty(); });
+            if (stopping) return;
+            tile = requests.front();
+            requests.pop_front();
+            loading = true;
+        }
+
+        // Checking the checksum reads every page of the mapping, so the
+        // tile is in memory before the render thread touches it
+        std::unique_ptr<mesh> m(new mesh());
+        if (!m->loadFromCacheFile((std::filesystem::path(directory) / tiles[tile].file).string()))
+            m.reset();
+
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            finished.push_back({ tile, std::move(m) });
+            loading = false;
+        }
+        idle.notify_all();
+    }
+}
+
+void terrainStreamer::waitIdle()
+{
+    std::unique_lock<std::mutex> lk(lock);
+    idle.wait(lk, [&]{ return requests.empty() && !loading; });
+}
+
+// Every tile within loadRadius of point, its distance plus extra
+void terrainStreamer::want(const vec3d &point, float extra)
+{
+    float radius = loadRadius > 0.0f ? loadRadius : 3.0f * tileSize;
+    for (uint32_t t = 0; t < tiles.size(); t++)
+    {
+        if (wantedFrame[t] == frame || states[t] == TILE_FAILED)
+            continue;
+        const terrainTileInfo &info = tiles[t];
+        float dx = std::max({ info.boundsMin[0] - point.x, 0.0f, point.x - info.boundsMax[0] });
+        float dz = std::max({ info.boundsMin[2] - point.z, 0.0f, point.z - info.boundsMax[2] });
+        float distance = std::sqrt(dx * dx + dz * dz);
+        if (distance > radius)
+            continue;
+        wantedFrame[t] = frame;
+        wanted.push_back({ t, distance + extra });
+    }
+}
+
+// Evicts tiles not wanted now, least recently used first, until bytes
+// more fit the budget. False when they cannot.
+bool terrainStreamer::makeRoom(uint64_t bytes)
+{
+    while (counters.residentBytes + counters.pendingBytes + bytes > budgetBytes)
+    {
+        size_t victim = resident.size();
+        for (size_t i = 0; i < resident.size(); i++)
+            if (wantedFrame[resident[i]->tile] != frame &&
+                (victim == resident.size() || resident[i]->lastUsed < resident[victim]->lastUsed))
+                victim = i;
+        if (victim == resident.size())
+            return false;
+
+        std::unique_ptr<residentTile> slot = std::move(resident[victim]);
+        resident.erase(resident.begin() + victim);
+        states[slot->tile] = TILE_ABSENT;
+        counters.residentBytes -= tiles[slot->tile].bytes;
+        counters.evictions++;
+        slot->m.reset();
+        spare.push_back(std::move(slot));
+        residentChanged = true;
+    }
+    return true;
+}
+
+void terrainStreamer::update(const vec3d &camera, const vec3d &lookDir)
+{
+    if (tiles.empty())
+        return;
+    frame++;
+
+    // Finished loads, swapped out so the lock is held only briefly
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        arrived.swap(finished);
+    }
+    for (finishedLoad &load : arrived)
+    {
+        counters.pendingBytes -= tiles[load.tile].bytes;
+        if (!load.m)
+        {
+            states[load.tile] = TILE_FAILED;
+            counters.loadsFailed++;
+            continue;
+        }
+
+        std::unique_ptr<residentTile> slot;
+        if (!spare.empty())
+        {
+            slot = std::move(spare.back());
+            spare.pop_back();
+        }
+        else
+        {
+            slot.reset(new residentTile());
+        }
+        slot->tile = load.tile;
+        slot->m = std::move(load.m);
+        slot->stage.pool = pool;
+        slot->stage.forgetHistory();
+        slot->lastUsed = frame;
+        resident.push_back(std::move(slot));
+        states[load.tile] = TILE_RESIDENT;
+        counters.residentBytes += tiles[load.tile].bytes;
+        counters.loadsFinished++;
+        residentChanged = true;
+    }
+    arrived.clear();
+
+    // Around the camera first, then ahead along the look direction and
+    // along the way the camera moved since the last update
+    wanted.clear();
+    want(camera, 0.0f);
+    float ahead = prefetchDistance > 0.0f ? prefetchDistance : 2.0f * tileSize;
+    if (frame == 1)
+        lastCamera = camera;
+    vec3d moved = { camera.x - lastCamera.x, 0.0f, camera.z - lastCamera.z, 0.0f };
+    const vec3d directions[2] = { lookDir, moved };
+    for (const vec3d &d : directions)
+    {
+        float length = std::sqrt(d.x * d.x + d.z * d.z);
+        if (length <= 0.0f)
+            continue;
+        vec3d point = camera;
+        point.x += d.x / length * ahead;
+        point.z += d.z / length * ahead;
+        want(point, ahead);
+    }
+    lastCamera = camera;
+    std::sort(wanted.begin(), wanted.end(), [](const wantedTile &a, const wantedTile &b) { return a.distance < b.distance; });
+
+    for (auto &slot : resident)
+        if (wantedFrame[slot->tile] == frame)
+            slot->lastUsed = frame;
+
+    // Queued loads that are still wanted go back in the new order, the
+    // rest are dropped. The one being loaded stays pending until it lands.
+    counters.deferred = 0;
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        for (uint32_t t : requests)
+        {
+            states[t] = TILE_ABSENT;
+            counters.pendingBytes -= tiles[t].bytes;
+        }
+        requests.clear();
+
+        for (const wantedTile &w : wanted)
+        {
+            if (states[w.tile] != TILE_ABSENT)
+                continue;
+            if (!makeRoom(tiles[w.tile].bytes))
+            {
+                counters.deferred++;
+                continue;
+            }
+            states[w.tile] = TILE_PENDING;
+            counters.pendingBytes += tiles[w.tile].bytes;
+            requests.push_back(w.tile);
+        }
+        counters.pending = (uint32_t)requests.size() + (loading ? 1 : 0);
+    }
+    if (!requests.empty())
+        wake.notify_one();
+    counters.resident = (uint32_t)resident.size();
+}
+
+bool terrainStreamer::upToDate(const frameParams &params) const
+{
+    if (residentChanged)
+        return false;
+    for (const auto &slot : resident)
+        if (!slot->stage.upToDate(*slot->m, params))
+            return false;
+    return true;
+}
+
+void terrainStreamer::run(const frameParams &params, std::vector<triangle> &out)
+{
+    residentChanged = false;
+    cullCounters = cullStats();
+    clipCounters = clipStats();
+    for (auto &slot : resident)
+    {
+        slot->stage.run(*slot->m, params, out);
+
+        const cullStats &c = slot->stage.cullCounters;
+        cullCounters.nodesTested += c.nodesTested;
+        cullCounters.nodesCulled += c.nodesCulled;
+        cullCounters.nodesBackfacing += c.nodesBackfacing;
+        cullCounters.trianglesSkipped += c.trianglesSkipped;
+        cullCounters.trianglesBackfacing += c.trianglesBackfacing;
+        cullCounters.trianglesTested += c.trianglesTested;
+        cullCounters.trianglesDrawn += c.trianglesDrawn;
+        cullCounters.lodChunksCoarse += c.lodChunksCoarse;
+        cullCounters.trianglesSavedByLod += c.trianglesSavedByLod;
+        cullCounters.nodesOccluded += c.nodesOccluded;
+        cullCounters.trianglesOccluded += c.trianglesOccluded;
+        cullCounters.occluderTriangles += c.occluderTriangles;
+        clipCounters.add(slot->stage.clipCounters);
+    }
+}
+
+size_t terrainStreamer::scratchBytes() const
+{
+    size_t bytes = capacityBytes(wanted) + capacityBytes(arrived) + capacityBytes(resident) + capacityBytes(spare);
+    for (const auto &slot : resident)
+        bytes += slot->stage.scratchBytes();
+    for (const auto &slot : spare)
+        bytes += slot->stage.scratchBytes();
+    return bytes;
+}
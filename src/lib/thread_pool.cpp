@@ -0,0 +1,156 @@
+#include <algorithm>
+#include "../include/thread_pool.hpp"
+
+static uint64_t packRange(uint32_t begin, uint32_t end)
+{
+    return ((uint64_t)end << 32) | begin;
+}
+
+static uint32_t rangeBegin(uint64_t r) { return (uint32_t)r; }
+static uint32_t rangeEnd(uint64_t r) { return (uint32_t)(r >> 32); }
+
+threadPool::threadPool(unsigned threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, MAX_POOL_THREADS);
+
+    ranges = std::vector<taskRange>(threadCount);
+    for (unsigned i = 1; i < threadCount; i++)
+        workers.emplace_back(&threadPool::workerLoop, this, i);
+}
+
+threadPool::~threadPool()
+{
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto &t : workers)
+        t.join();
+}
+
+void threadPool::parallelFor(size_t taskCount, taskFunction fn)
+{
+    if (taskCount == 0) return;
+
+    // Nothing to share, skip the wake up round trip
+    if (workers.empty() || taskCount == 1)
+    {
+        for (size_t t = 0; t < taskCount; t++)
+            fn(t);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        job = &fn;
+
+        // Even initial shares, thread 0 is the caller
+        size_t threads = ranges.size();
+        for (size_t i = 0; i < threads; i++)
+            ranges[i].range = packRange((uint32_t)(taskCount * i / threads), (uint32_t)(taskCount * (i + 1) / threads));
+
+        busyWorkers = (unsigned)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lk(lock);
+    done.wait(lk, [this]{ return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void threadPool::workerLoop(unsigned self)
+{
+    uint64_t seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            wake.wait(lk, [&]{ return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+
+        runTasks(self);
+
+        std::lock_guard<std::mutex> lk(lock);
+        if (--busyWorkers == 0)
+            done.notify_one();
+    }
+}
+
+void threadPool::runTasks(unsigned self)
+{
+    uint32_t task;
+    do
+    {
+        while (popTask(self, task))
+            (*job)(task);
+    }
+    while (stealTasks(self));
+}
+
+bool threadPool::popTask(unsigned self, uint32_t &task)
+{
+    std::atomic<uint64_t> &r = ranges[self].range;
+    uint64_t cur = r.load();
+    while (rangeBegin(cur) < rangeEnd(cur))
+    {
+        if (r.compare_exchange_weak(cur, packRange(rangeBegin(cur) + 1, rangeEnd(cur))))
+        {
+            task = rangeBegin(cur);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves the back half of some other thread's share into ours. Tasks are
+// only ever moved, never duplicated, so giving up after one empty sweep
+// is safe: anything in flight is run by whoever holds it.
+bool threadPool::stealTasks(unsigned self)
+{
+    size_t threads = ranges.size();
+    for (size_t k = 1; k < threads; k++)
+    {
+        std::atomic<uint64_t> &victim = ranges[(self + k) % threads].range;
+        uint64_t cur = victim.load();
+        while (rangeBegin(cur) < rangeEnd(cur))
+        {
+            uint32_t begin = rangeBegin(cur), end = rangeEnd(cur);
+            uint32_t mid = begin + (end - begin) / 2;
+            if (victim.compare_exchange_weak(cur, packRange(begin, mid)))
+            {
+                // Our own share is empty, so no thief can race this store
+                ranges[self].range = packRange(mid, end);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+size_t chunkCount(threadPool *pool, size_t count, size_t minPerChunk)
+{
+    size_t threads = pool ? pool->size() : 1;
+    size_t chunks = std::min(threads * 4, (count + minPerChunk - 1) / minPerChunk);
+    return std::max<size_t>(chunks, 1);
+}
+
+void parallelFor(threadPool *pool, size_t taskCount, taskFunction fn)
+{
+    if (pool)
+    {
+        pool->parallelFor(taskCount, fn);
+        return;
+    }
+
+    for (size_t t = 0; t < taskCount; t++)
+        fn(t);
+}
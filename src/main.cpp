@@ -1,81 +1,141 @@
 #include <SFML/Graphics.hpp>
-#include <fstream>
-#include <strstream>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
 #include <vector>
-#include <list>
+#include "include/command_line.hpp"
+#include "include/depth_sort.hpp"
+#include "include/frame_pipeline.hpp"
 #include "include/geometry.hpp"
+#include "include/mesh.hpp"
+#include "include/pipeline.hpp"
+#include "include/profiler.hpp"
+#include "include/thread_pool.hpp"
+#include "include/rasterizer.hpp"
+#include "include/resolution.hpp"
+#include "include/scene.hpp"
+#include "include/terrain_stream.hpp"
 
 const unsigned int SCREEN_WIDTH = 920;
 const unsigned int SCREEN_HEIGHT = 640;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 1000.0f;
 
 float theta = 0.0f;
 mesh meshCube;
 mat4x4 projMatrix;
 vec3d camera, lookDir;
 float yaw;
+framebuffer frame;
+
+// Size the framebuffer is rendered at, scaled down from the window when
+// frames run over budget and stretched back up when shown. The options
+// take budgets up to a second and scales down to a tenth.
+const float MAX_FRAME_BUDGET_MS = 1000.0f;
+const float LOWEST_RENDER_SCALE = 0.1f;
+resolutionController resolution;
+std::unique_ptr<threadPool> workers;
+geometryStage geometry;
+
+// With a tile set the terrain is streamed around the camera instead of
+// being loaded whole into meshCube. --tile-budget and --tile-radius go
+// up to these.
+const unsigned MAX_TILE_BUDGET_MIB = 1 << 20;
+const unsigned MAX_TILE_RADIUS = 1000000;
+terrainStreamer terrain;
+bool streamTerrain = false;
+
+// Copies of one small mesh scattered over the terrain, drawn after it.
+// --props takes at most MAX_PROPS of them.
+const unsigned MAX_PROPS = 1000000;
+mesh propMesh;
+scene props;
+sceneStage propStage;
+
+// With a latency budget the geometry stage runs on its own thread and
+// pool, frames ahead of rasterizing and presenting
+std::unique_ptr<threadPool> geometryWorkers;
+std::unique_ptr<framePipeline> pipeline;
+tiledRasterizer raster;
+depthSorter sorter;
+
+// Persistent batches for the SFML path. They are cleared, not freed, when
+// the scene changes so their storage is reused and each frame costs one
+// draw call for the fill plus one for the optional wireframe.
+sf::VertexArray fillBatch(sf::Triangles);
+sf::VertexArray lineBatch(sf::Lines);
+
+// Triangles of the frame, kept like the batches. Together with the stages'
+// own scratch buffers this leaves steady state frames without allocations,
+// and while nothing moves the sorted list from the last change is reused.
+std::vector<triangle> frameTriangles;
+bool drawWireframe = false;
+
+// Screen space error allowed for coarser mesh levels, 0 for full detail
+float lodErrorPixels = 1.0f;
+
+// Drop hierarchy leaves hidden behind nearer terrain before their
+// triangles are assembled, off unless asked for
+bool occlusionCulling = false;
+
+// Last matrices handed to the geometry stage and their version stamps
+mat4x4 lastWorld, lastView, lastProj;
+viewport lastViewport;
+uint64_t worldVersion = 0, viewVersion = 0, projVersion = 0;
+
+// Frame time graph drawn over the window, toggled with F3
+sf::VertexArray overlayBatch(sf::Triangles);
+bool showProfileOverlay = false;
 
 void drawTriangleLine(
-        sf::RenderWindow &w,
-        int x1, int y1,
-        int x2, int y2,
-        int x3, int y3,
+        sf::VertexArray &batch,
+        float x1, float y1,
+        float x2, float y2,
+        float x3, float y3,
         sf::Color color = sf::Color::White
     )
 {
-    sf::VertexArray v1(sf::Lines, 2);
-    sf::VertexArray v2(sf::Lines, 2);
-    sf::VertexArray v3(sf::Lines, 2);
+    batch.append(sf::Vertex(sf::Vector2f(x1, y1), color));
+    batch.append(sf::Vertex(sf::Vector2f(x2, y2), color));
 
-    v1[0].position = sf::Vector2f(x1, y1);
-    v1[1].position = sf::Vector2f(x2, y2);
+    batch.append(sf::Vertex(sf::Vector2f(x2, y2), color));
+    batch.append(sf::Vertex(sf::Vector2f(x3, y3), color));
 
-    v2[0].position = sf::Vector2f(x2, y2);
-    v2[1].position = sf::Vector2f(x3, y3);
-
-    v3[0].position = sf::Vector2f(x3, y3);
-    v3[1].position = sf::Vector2f(x1, y1);
-
-    v1[0].color = color;
-    v1[1].color = color;
-    v2[0].color = color;
-    v2[1].color = color;
-    v3[0].color = color;
-    v3[1].color = color;
-
-    w.draw(v1);
-    w.draw(v2);
-    w.draw(v3);
+    batch.append(sf::Vertex(sf::Vector2f(x3, y3), color));
+    batch.append(sf::Vertex(sf::Vector2f(x1, y1), color));
 }
 
 void drawFilledTriangle(
-        sf::RenderWindow &w,
-        int x1, int y1,
-        int x2, int y2,
-        int x3, int y3,
+        sf::VertexArray &batch,
+        float x1, float y1,
+        float x2, float y2,
+        float x3, float y3,
         sf::Color color
     )
 {
-    sf::ConvexShape triangle;
-    triangle.setPointCount(4);
-
-    triangle.setPoint(0, sf::Vector2f(x1, y1));
-    triangle.setPoint(1, sf::Vector2f(x2, y2));
-    triangle.setPoint(2, sf::Vector2f(x3, y3));
-    triangle.setPoint(3, sf::Vector2f(x1, y1));
-
-    triangle.setFillColor(color);
-
-    w.draw(triangle);
+    batch.append(sf::Vertex(sf::Vector2f(x1, y1), color));
+    batch.append(sf::Vertex(sf::Vector2f(x2, y2), color));
+    batch.append(sf::Vertex(sf::Vector2f(x3, y3), color));
 }
 
+// Bumps version when value differs from the last one seen
+void stampMatrix(const mat4x4 &value, mat4x4 &last, uint64_t &version)
+{
+    if (version == 0 || std::memcmp(&value, &last, sizeof(mat4x4)) != 0)
+    {
+        last = value;
+        version++;
+    }
+}
 
-void drawObj(sf::RenderWindow &w, sf::Time elapsed)
+mat4x4 makeWorldMatrix()
 {
     // Set up rotation matrices
     mat4x4 matRotZ, matRotX;
-    // theta += 1.0f * elapsed.asSeconds();
-
     matRotZ = makeRotatedMatrixZ(theta);
     matRotX = makeRotatedMatrixX(theta*0.5f);
 
@@ -84,7 +144,14 @@ void drawObj(sf::RenderWindow &w, sf::Time elapsed)
 
     mat4x4 matWorld;
     matWorld = mulMatrices(matRotZ, matRotX);
-    matWorld = mulMatrices(matWorld, matTrans);
+    return mulMatrices(matWorld, matTrans);
+}
+
+// Geometry stage inputs for the current time, camera and window
+frameParams makeFrameParams(sf::Time elapsed)
+{
+    // theta += 1.0f * elapsed.asSeconds();
+    mat4x4 matWorld = makeWorldMatrix();
 
     vec3d up = { 0,1,0 };
     vec3d forward = { 0,0,1 };
@@ -96,166 +163,260 @@ void drawObj(sf::RenderWindow &w, sf::Time elapsed)
     // Make view matrix from camera
     mat4x4 matView = quickInverse(matCamera);
 
-    std::vector<triangle> vecTrianglesToRaster;
-
-    for (auto tri : meshCube.tris)
+    frameParams params;
+    params.matWorld = matWorld;
+    params.matView = matView;
+    params.matProj = projMatrix;
+    params.cameraPos = camera;
+    params.vp = { (float)resolution.width(), (float)resolution.height() };
+    params.lodErrorPixels = lodErrorPixels;
+    params.occlusionCulling = occlusionCulling;
+
+    // The camera position is part of the view matrix, the light, the LOD
+    // error and occlusion culling never change
+    stampMatrix(matWorld, lastWorld, worldVersion);
+    stampMatrix(matView, lastView, viewVersion);
+    stampMatrix(projMatrix, lastProj, projVersion);
+
+    // The viewport takes the projection on to pixels, a new render size
+    // makes every screen position stale like a new projection would
+    if (params.vp.width != lastViewport.width || params.vp.height != lastViewport.height)
     {
-        triangle triProjected, triTransformed, triViewed;
+        lastViewport = params.vp;
+        projVersion++;
+    }
+    params.worldVersion = worldVersion;
+    params.viewVersion = viewVersion;
+    params.projVersion = projVersion;
+    return params;
+}
 
-        triTransformed.p[0] = mulMatrixByVector(matWorld, tri.p[0]);
-        triTransformed.p[1] = mulMatrixByVector(matWorld, tri.p[1]);
-        triTransformed.p[2] = mulMatrixByVector(matWorld, tri.p[2]);
+void countGeometry(const cullStats &cull, const clipStats &clip)
+{
+    PROFILE_COUNT(PROFILE_TRIANGLES_OCCLUDED, cull.trianglesOccluded);
+    PROFILE_COUNT(PROFILE_TRIANGLES_IN, cull.trianglesTested);
+    PROFILE_COUNT(PROFILE_BACKFACE_CULLED, clip.backfacing);
+    PROFILE_COUNT(PROFILE_NEAR_CLIPPED, clip.planeClips[CLIP_NEAR]);
+    PROFILE_COUNT(PROFILE_SCREEN_CLIPPED, clip.planeClips[CLIP_LEFT] + clip.planeClips[CLIP_RIGHT]
+                                        + clip.planeClips[CLIP_BOTTOM] + clip.planeClips[CLIP_TOP]);
+    PROFILE_COUNT(PROFILE_CLIPPED_TO_0, clip.clipResults[0]);
+    PROFILE_COUNT(PROFILE_CLIPPED_TO_1, clip.clipResults[1]);
+    PROFILE_COUNT(PROFILE_CLIPPED_TO_2, clip.clipResults[2]);
+    PROFILE_COUNT(PROFILE_CLIPPED_TO_MORE, clip.clipResults[3]);
+    PROFILE_COUNT(PROFILE_TRIANGLES_DRAWN, cull.trianglesDrawn);
+}
 
-        // Use cross-product to get surface normal
-        vec3d normal, line1, line2;
-        line1 = subVectors(triTransformed.p[1], triTransformed.p[0]);
-        line2 = subVectors(triTransformed.p[2], triTransformed.p[0]);
-        normal = crossProduct(line1, line2);
-        normal = normVector(normal);
+// Hands the camera, in the terrain's object space, to the streamer, which
+// loads tiles around it and ahead along lookDir
+void updateTerrain(const frameParams &params)
+{
+    affineMatrix matWorldInv = quickInverse(toAffine(params.matWorld));
+    terrain.update(transformPoint(matWorldInv, camera), transformDirection(matWorldInv, lookDir));
+}
 
-        // Get Ray from triangle to camera
-        vec3d cameraRay = subVectors(triTransformed.p[0], camera);
+// Transform, light, clip and project the mesh into screen space. Returns
+// false, leaving vecTrianglesToRaster alone, when nothing changed since
+// the last frame, so what was made from it then is still good.
+bool projectObj(const frameParams &params, std::vector<triangle> &vecTrianglesToRaster)
+{
+    if (streamTerrain)
+    {
+        PROFILE_SCOPE("stream");
+        updateTerrain(params);
+    }
+    if (streamTerrain ? terrain.upToDate(params) : geometry.upToDate(meshCube, params))
+        return false;
 
-        if (dotProduct(normal, cameraRay) < 0.0f)
+    vecTrianglesToRaster.clear();
+    clipStats clip;
+    {
+        PROFILE_SCOPE("geometry");
+        if (streamTerrain)
+            terrain.run(params, vecTrianglesToRaster);
+        else
+            geometry.run(meshCube, params, vecTrianglesToRaster);
+        clip = streamTerrain ? terrain.clipCounters : geometry.clipCounters;
+        if (!props.instances.empty())
         {
-            // Shading
-            vec3d lightDirection = {0.0f, 1.0f, -1.0f};
-            lightDirection = normVector(lightDirection);
-            float dp = std::max(0.1f, dotProduct(lightDirection, normal));
-
-            triTransformed.color = {
-                static_cast<sf::Uint8>(255*dp),
-                static_cast<sf::Uint8>(255*dp),
-                static_cast<sf::Uint8>(255*dp)
-            };
-
-            // Convert world space -> view space
-            triViewed.p[0] = mulMatrixByVector(matView, triTransformed.p[0]);
-            triViewed.p[1] = mulMatrixByVector(matView, triTransformed.p[1]);
-            triViewed.p[2] = mulMatrixByVector(matView, triTransformed.p[2]);
-            triViewed.color = triTransformed.color;
-
-            // Clip Viewed Triangle against near plane, this could form two additional triangles.
-            triangle clipped[2];
-            int nClippedTriangles = clipAgainstPlane({ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f }, triViewed, clipped[0], clipped[1]);
-
-            for (int n = 0; n < nClippedTriangles; n++)
-            {
-                // Project triangles from 3D -> 2D
-                triProjected.p[0] = mulMatrixByVector(projMatrix, clipped[n].p[0]);
-                triProjected.p[1] = mulMatrixByVector(projMatrix, clipped[n].p[1]);
-                triProjected.p[2] = mulMatrixByVector(projMatrix, clipped[n].p[2]);
-                triProjected.color = clipped[n].color;
-
-                // Scale into view
-                triProjected.p[0] = divVector(triProjected.p[0], triProjected.p[0].w);
-                triProjected.p[1] = divVector(triProjected.p[1], triProjected.p[1].w);
-                triProjected.p[2] = divVector(triProjected.p[2], triProjected.p[2].w);
-
-                // X/Y are inverted so put them back
-                triProjected.p[0].x *= -1.0f;
-                triProjected.p[1].x *= -1.0f;
-                triProjected.p[2].x *= -1.0f;
-                triProjected.p[0].y *= -1.0f;
-                triProjected.p[1].y *= -1.0f;
-                triProjected.p[2].y *= -1.0f;
-
-                // Offset verts into visible normalised space
-                vec3d offsetView = { 1,1,0 };
-                triProjected.p[0] = addVectors(triProjected.p[0], offsetView);
-                triProjected.p[1] = addVectors(triProjected.p[1], offsetView);
-                triProjected.p[2] = addVectors(triProjected.p[2], offsetView);
-                triProjected.p[0].x *= 0.5f * (float)SCREEN_WIDTH;
-                triProjected.p[0].y *= 0.5f * (float)SCREEN_HEIGHT;
-                triProjected.p[1].x *= 0.5f * (float)SCREEN_WIDTH;
-                triProjected.p[1].y *= 0.5f * (float)SCREEN_HEIGHT;
-                triProjected.p[2].x *= 0.5f * (float)SCREEN_WIDTH;
-                triProjected.p[2].y *= 0.5f * (float)SCREEN_HEIGHT;
-
-                // Store triangle for sorting
-                vecTrianglesToRaster.push_back(triProjected);
-            }
+            propStage.run(props, params, vecTrianglesToRaster);
+            clip.add(propStage.clipCounters);
         }
     }
+    countGeometry(streamTerrain ? terrain.cullCounters : geometry.cullCounters, clip);
+    return true;
+}
 
-    std::sort(vecTrianglesToRaster.begin(), vecTrianglesToRaster.end(), [](triangle &t1, triangle &t2){
-        float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
-        float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
-        return z1 > z2;
-    });
+const scene *propScene()
+{
+    return props.instances.empty() ? nullptr : &props;
+}
 
-    // Loop through all transformed, viewed, projected, and sorted triangles
-    for (auto &triToRaster : vecTrianglesToRaster)
+// Triangles of the frame to draw now, or null when nothing changed since
+// the last one, and in vp the render size they were made for. Without a
+// pipeline the geometry runs right here. With one this takes the oldest
+// frame it holds and queues the inputs of the frame latency frames from
+// now, whose geometry then overlaps drawing this one.
+std::vector<triangle> *nextFrame(sf::Time elapsed, viewport &vp)
+{
+    if (!pipeline)
     {
-        // Clip triangles against all four screen edges, this could yield
-        // a bunch of triangles, so create a queue that we traverse to 
-        // ensure we only test new triangles generated against planes
-        triangle clipped[2];
-        std::list<triangle> listTriangles;
+        frameParams params = makeFrameParams(elapsed);
+        vp = params.vp;
+        return projectObj(params, frameTriangles) ? &frameTriangles : nullptr;
+    }
 
-        // Add initial triangle
-        listTriangles.push_back(triToRaster);
-        int nNewTriangles = 1;
+    framePipeline::frame *f;
+    {
+        PROFILE_SCOPE("wait");
+        f = &pipeline->take();
+    }
+    pipeline->submit(meshCube, makeFrameParams(elapsed), propScene());
+    vp = f->vp;
+    if (!f->changed)
+        return nullptr;
+    countGeometry(f->cull, f->clip);
+    return &f->triangles;
+}
 
-        for (int p = 0; p < 4; p++)
-        {
-            int nTrisToAdd = 0;
-            while (nNewTriangles > 0)
-            {
-                // Take triangle from front of queue
-                triangle test = listTriangles.front();
-                listTriangles.pop_front();
-                nNewTriangles--;
-
-                // Clip it against a plane. We only need to test each 
-                // subsequent plane, against subsequent new triangles
-                // as all triangles after a plane clip are guaranteed
-                // to lie on the inside of the plane.
-                switch (p)
-                {
-                    case 0:
-                        nTrisToAdd = clipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]);
-                        break;
-                    case 1:
-                        nTrisToAdd = clipAgainstPlane({ 0.0f, (float)SCREEN_HEIGHT - 1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]);
-                        break;
-                    case 2:
-                        nTrisToAdd = clipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]);
-                        break;
-                    case 3:
-                        nTrisToAdd = clipAgainstPlane({ (float)SCREEN_WIDTH - 1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]);
-                        break;
-                }
+// Sorts the frame's triangles back to front and rebuilds the SFML batches
+void batchObj(std::vector<triangle> &tris)
+{
+    fillBatch.clear();
+    lineBatch.clear();
 
-                // Clipping may yield a variable number of triangles, so
-                // add these new ones to the back of the queue for subsequent
-                // clipping against next planes
-                for (int w = 0; w < nTrisToAdd; w++)
-                    listTriangles.push_back(clipped[w]);
-            }
-            nNewTriangles = listTriangles.size();
-        }
+    // Back to front
+    {
+        PROFILE_SCOPE("sort");
+        sorter.sort(tris);
+    }
 
-        // Draw the transformed, viewed, clipped, projected, sorted, clipped triangles
-        for (auto &t : listTriangles)
-        {
-            // Rasterize triangle
-            drawFilledTriangle(
-                w,
+    // Triangles arrive clipped to the guard band, SFML takes care of the
+    // parts that are still off screen
+    PROFILE_SCOPE("batch");
+    for (auto &t : tris)
+    {
+        // Queue triangle, drawObj submits the batches as a whole
+        drawFilledTriangle(
+            fillBatch,
+            t.p[0].x, t.p[0].y,
+            t.p[1].x, t.p[1].y,
+            t.p[2].x, t.p[2].y,
+            t.color
+        );
+        if (drawWireframe)
+            drawTriangleLine(
+                lineBatch,
                 t.p[0].x, t.p[0].y,
                 t.p[1].x, t.p[1].y,
                 t.p[2].x, t.p[2].y,
-                t.color
+                sf::Color::Black
             );
-            // drawTriangleLine(
-            //     w,
-            //     t.p[0].x, t.p[0].y,
-            //     t.p[1].x, t.p[1].y,
-            //     t.p[2].x, t.p[2].y,
-            //     sf::Color::Black
-            // );
+    }
+
+    PROFILE_COUNT(PROFILE_SCRATCH_BYTES, geometry.scratchBytes() + terrain.scratchBytes() + propStage.scratchBytes() + sorter.scratchBytes() + capacityBytes(tris));
+}
+
+// Painter's algorithm path, batched into SFML vertex arrays. The batches
+// are only rebuilt when the scene changed.
+void drawObj(sf::RenderWindow &w, sf::Time elapsed)
+{
+    viewport vp;
+    if (std::vector<triangle> *tris = nextFrame(elapsed, vp))
+        batchObj(*tris);
+
+    w.draw(fillBatch);
+    if (drawWireframe)
+        w.draw(lineBatch);
+}
+
+// Software path, rasterize into the CPU framebuffer with per-pixel depth test,
+// tile by tile across the worker threads. fb takes the size the frame was
+// made for. Returns false when the scene did not change and fb still holds
+// the last frame.
+bool rasterObj(framebuffer &fb, sf::Time elapsed)
+{
+    viewport vp;
+    std::vector<triangle> *tris = nextFrame(elapsed, vp);
+    if (!tris)
+        return false;
+
+    PROFILE_SCOPE("raster");
+    if (fb.width != (unsigned)vp.width || fb.height != (unsigned)vp.height)
+        fb.resize((unsigned)vp.width, (unsigned)vp.height);
+    raster.draw(fb, *tris);
+    PROFILE_COUNT(PROFILE_SCRATCH_BYTES, geometry.scratchBytes() + terrain.scratchBytes() + propStage.scratchBytes() + raster.scratchBytes() + capacityBytes(*tris));
+    return true;
+}
+
+void appendRect(sf::VertexArray &batch, float x, float y, float w, float h, sf::Color color)
+{
+    drawFilledTriangle(batch, x, y, x + w, y, x, y + h, color);
+    drawFilledTriangle(batch, x + w, y, x + w, y + h, x, y + h, color);
+}
+
+// One column per recent frame in the bottom left corner, stacked by top
+// level stage, under a line at the 60 Hz budget. The latest counters go in
+// the window title twice a second.
+void drawProfileOverlay(sf::RenderWindow &w)
+{
+    struct stageColor
+    {
+        const char *name;
+        sf::Color color;
+    };
+    static const stageColor stageColors[] = {
+        { "input", sf::Color(160, 160, 160) },
+        { "stream", sf::Color(120, 200, 200) },
+        { "wait", sf::Color(90, 90, 90) },
+        { "geometry", sf::Color(80, 160, 255) },
+        { "sort", sf::Color(255, 200, 60) },
+        { "batch", sf::Color(255, 120, 40) },
+        { "raster", sf::Color(80, 220, 120) },
+        { "upload", sf::Color(200, 90, 220) },
+        { "present", sf::Color(230, 60, 60) }
+    };
+    const float pixelsPerMs = 6.0f, columnWidth = 2.0f, budgetMs = 1000.0f / 60.0f;
+    const float bottom = (float)SCREEN_HEIGHT - 4.0f;
+
+    overlayBatch.clear();
+    size_t frames = frameProfiler.historySize();
+    for (size_t i = 0; i < frames; i++)
+    {
+        const profileFrame &f = frameProfiler.history(i);
+        float x = 4.0f + i * columnWidth, y = bottom;
+        for (const auto &e : f.events)
+        {
+            // Pipelined geometry overlaps the frame on another thread
+            if (e.depth != 0 || e.thread != f.thread) continue;
+            sf::Color color = sf::Color::White;
+            for (const auto &sc : stageColors)
+                if (std::strcmp(sc.name, e.name) == 0) color = sc.color;
+            float h = (float)e.duration / 1000.0f * pixelsPerMs;
+            appendRect(overlayBatch, x, y - h, columnWidth, h, color);
+            y -= h;
         }
     }
+    float budgetY = bottom - budgetMs * pixelsPerMs;
+    appendRect(overlayBatch, 4.0f, budgetY, PROFILE_HISTORY_FRAMES * columnWidth, 1.0f, sf::Color::White);
+    w.draw(overlayBatch);
+
+    if (frames > 0 && frameProfiler.history(frames - 1).index % 30 == 0)
+    {
+        const profileFrame &f = frameProfiler.history(frames - 1);
+        std::ostringstream title;
+        title.precision(3);
+        title << "3D Graphics | " << f.duration / 1000.0 << " ms | " << frame.width << "x" << frame.height
+              << " | occluded " << f.counters[PROFILE_TRIANGLES_OCCLUDED]
+              << ", in " << f.counters[PROFILE_TRIANGLES_IN]
+              << ", backface " << f.counters[PROFILE_BACKFACE_CULLED]
+              << ", near " << f.counters[PROFILE_NEAR_CLIPPED]
+              << ", screen " << f.counters[PROFILE_SCREEN_CLIPPED]
+              << " (0/1/2/+ " << f.counters[PROFILE_CLIPPED_TO_0] << "/" << f.counters[PROFILE_CLIPPED_TO_1]
+              << "/" << f.counters[PROFILE_CLIPPED_TO_2] << "/" << f.counters[PROFILE_CLIPPED_TO_MORE] << ")"
+              << ", drawn " << f.counters[PROFILE_TRIANGLES_DRAWN]
+              << ", " << f.counters[PROFILE_BYTES_ALLOCATED] << " B in " << f.counters[PROFILE_ALLOCATIONS] << " allocs";
+        w.setTitle(title.str());
+    }
 }
 
 void handleMovement(sf::Time elapsed)
@@ -283,39 +444,348 @@ void handleMovement(sf::Time elapsed)
         yaw += speed * elapsed.asSeconds();
 }
 
-void init()
+// Scatters count copies of the OBJ in filename over random terrain
+// vertices, turned and sized at random but the same on every start
+bool scatterProps(const char *filename, unsigned count)
+{
+    std::string error;
+    if (!propMesh.load(filename, &error))
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+
+    uint32_t asset = props.addAsset(propMesh);
+    mat4x4 matWorld = makeWorldMatrix();
+    std::mt19937 random(1);
+    std::uniform_int_distribution<size_t> vertex(0, meshCube.verts.size() - 1);
+    std::uniform_real_distribution<float> yaw(0.0f, 6.2831853f), scale(0.5f, 1.5f);
+    props.instances.reserve(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        vec3d v = meshCube.verts.get(vertex(random));
+        vec3d p = mulMatrixByVector(matWorld, v);
+        float s = scale(random);
+
+        // Resting on the ground rather than buried in it
+        const float position[3] = { p.x, p.y - s * propMesh.boundsMin.y, p.z };
+        props.addInstance(asset, position, yaw(random), s);
+    }
+    return true;
+}
+
+bool init(unsigned threadCount, unsigned latency, const char *propFile, unsigned propCount, const char *tileDir)
 {
-    meshCube.loadFromObjFile("assets/mountains.obj");
+    workers.reset(new threadPool(threadCount));
+    geometry.pool = workers.get();
+    terrain.pool = workers.get();
+    propStage.pool = workers.get();
+    raster.pool = workers.get();
+    sorter.pool = workers.get();
+
+    std::string error;
+    streamTerrain = tileDir != nullptr;
+    if (streamTerrain ? !terrain.open(tileDir, &error) : !meshCube.load("assets/mountains.obj", &error))
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+
     projMatrix = makeProjectionMatrix(
         90.0f,
         (float)SCREEN_HEIGHT/(float)SCREEN_WIDTH,
-        0.1f, 
-        1000.0f
+        NEAR_PLANE,
+        FAR_PLANE
     );
+    resolution.setOutputSize(SCREEN_WIDTH, SCREEN_HEIGHT);
+    frame.resize(resolution.width(), resolution.height());
+
+    if (propFile && streamTerrain)
+    {
+        std::cerr << "--props needs the whole terrain, not tiles" << std::endl;
+        return false;
+    }
+    if (propFile && !scatterProps(propFile, propCount))
+        return false;
+
+    // Tiles can be evicted while a pipelined frame still uses them, so a
+    // streamed terrain always runs serially
+    if (latency > 0 && !streamTerrain)
+    {
+        // Both pools get every thread, the one whose stage is waiting sleeps
+        geometryWorkers.reset(new threadPool(threadCount));
+        geometry.pool = geometryWorkers.get();
+        propStage.pool = geometryWorkers.get();
+        pipeline.reset(new framePipeline(geometry, latency, &propStage));
+
+        // Frames up to the budget start out with the initial view
+        for (unsigned i = 0; i < latency; i++)
+            pipeline->submit(meshCube, makeFrameParams(sf::Time::Zero), propScene());
+    }
+    return true;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    // --headless <file>  render one frame to an image, no window needed
+    // --shapes           draw through batched SFML vertex arrays instead of the framebuffer
+    // --wireframe        also outline triangles when drawing through SFML
+    // --threads <n>      worker threads for the pipeline, 0 = one per core
+    // --lod-error <px>   screen space error allowed for mesh LODs, 0 = full detail
+    // --latency <n>      frames the geometry stage may run ahead of drawing, 0 = serial, at most 8
+    // --occlusion        skip leaves hidden behind nearer ones
+    // --props <obj> <n>  scatter n instances of a mesh over the terrain
+    // --terrain-tiles <dir>  stream the terrain from tiles written by graph_meshc --tiles
+    // --tile-budget <MiB>    most memory the resident tiles may take
+    // --tile-radius <units>  how far around the camera tiles are loaded, 0 = three tiles
+    // --frame-budget <ms>    frame time the render resolution adapts to, 0 = fixed resolution
+    // --render-scale <s>     render resolution to start at, relative to the window
+    // --min-scale <s>        lowest render resolution the budget may go down to
+    // --profile-overlay  start with the frame time overlay shown (F3 toggles it)
+    // --profile-log <file>    per frame stage times and counters, CSV for .csv, JSON lines otherwise
+    // --profile-trace <file>  Chrome trace event capture
+    const char *headlessOutput = nullptr;
+    const char *profileLog = nullptr;
+    const char *profileTrace = nullptr;
+    const char *propFile = nullptr;
+    const char *tileDir = nullptr;
+    unsigned propCount = 0;
+    bool useShapes = false;
+    unsigned threadCount = 0;
+    unsigned latency = 1;
+    float renderScale = 1.0f;
+    bool usage = false;
+
+    for (int i = 1; i < argc && !usage; i++)
+    {
+        if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+            headlessOutput = argv[++i];
+        else if (std::strcmp(argv[i], "--shapes") == 0)
+            useShapes = true;
+        else if (std::strcmp(argv[i], "--wireframe") == 0)
+            drawWireframe = true;
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            usage = !parseCount(argv[++i], MAX_POOL_THREADS, threadCount);
+            if (usage)
+                std::cerr << "--threads takes 0 (one per hardware thread) to " << MAX_POOL_THREADS << ", got \""
+                          << argv[i] << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+            lodErrorPixels = (float)std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+        {
+            usage = !parseCount(argv[++i], MAX_PIPELINE_LATENCY, latency);
+            if (usage)
+                std::cerr << "--latency takes 0 to " << MAX_PIPELINE_LATENCY << " frames, got \"" << argv[i] << "\""
+                          << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--occlusion") == 0)
+            occlusionCulling = true;
+        else if (std::strcmp(argv[i], "--terrain-tiles") == 0 && i + 1 < argc)
+            tileDir = argv[++i];
+        else if (std::strcmp(argv[i], "--tile-budget") == 0 && i + 1 < argc)
+        {
+            float mib;
+            usage = !parseNumber(argv[++i], 0.0f, (float)MAX_TILE_BUDGET_MIB, mib);
+            if (usage)
+                std::cerr << "--tile-budget takes 0 to " << MAX_TILE_BUDGET_MIB << " MiB, got \"" << argv[i] << "\"" << std::endl;
+            else
+                terrain.budgetBytes = (uint64_t)((double)mib * (1 << 20));
+        }
+        else if (std::strcmp(argv[i], "--tile-radius") == 0 && i + 1 < argc)
+        {
+            usage = !parseNumber(argv[++i], 0.0f, (float)MAX_TILE_RADIUS, terrain.loadRadius);
+            if (usage)
+                std::cerr << "--tile-radius takes 0 (three tiles) to " << MAX_TILE_RADIUS << " units, got \"" << argv[i]
+                          << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+        {
+            usage = !parseNumber(argv[++i], 0.0f, MAX_FRAME_BUDGET_MS, resolution.targetMs);
+            if (usage)
+                std::cerr << "--frame-budget takes 0 (fixed resolution) to " << MAX_FRAME_BUDGET_MS << " ms, got \""
+                          << argv[i] << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc)
+        {
+            usage = !parseNumber(argv[++i], LOWEST_RENDER_SCALE, 1.0f, renderScale);
+            if (usage)
+                std::cerr << "--render-scale takes " << LOWEST_RENDER_SCALE << " to 1, got \"" << argv[i] << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--min-scale") == 0 && i + 1 < argc)
+        {
+            usage = !parseNumber(argv[++i], LOWEST_RENDER_SCALE, 1.0f, resolution.minScale);
+            if (usage)
+                std::cerr << "--min-scale takes " << LOWEST_RENDER_SCALE << " to 1, got \"" << argv[i] << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--props") == 0 && i + 2 < argc)
+        {
+            propFile = argv[++i];
+            usage = !parseCount(argv[++i], MAX_PROPS, propCount);
+            if (usage)
+                std::cerr << "--props takes 0 to " << MAX_PROPS << " copies, got \"" << argv[i] << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--profile-overlay") == 0)
+            showProfileOverlay = true;
+        else if (std::strcmp(argv[i], "--profile-log") == 0 && i + 1 < argc)
+            profileLog = argv[++i];
+        else if (std::strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc)
+            profileTrace = argv[++i];
+        else
+            usage = true;
+    }
+    if (usage)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--headless <image>] [--shapes] [--wireframe] [--threads <n>] [--lod-error <px>] [--latency <n>]"
+                  << " [--occlusion] [--props <obj> <n>] [--terrain-tiles <dir>] [--tile-budget <MiB>] [--tile-radius <units>]"
+                  << " [--frame-budget <ms>] [--render-scale <s>] [--min-scale <s>] [--profile-overlay] [--profile-log <file>] [--profile-trace <file>]" << std::endl;
+        return 1;
+    }
+
+    if (!GRAPH_PROFILE && (showProfileOverlay || profileLog || profileTrace))
+        std::cerr << "Built without the profiler (GRAPH_PROFILE), profiling options are ignored" << std::endl;
+
+    std::string error;
+    if (GRAPH_PROFILE && ((profileLog && !frameProfiler.openLog(profileLog, &error))
+                          || (profileTrace && !frameProfiler.openTrace(profileTrace, &error))))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    // SFML draws the shapes path straight at window size
+    if (useShapes)
+    {
+        resolution.targetMs = 0.0f;
+        renderScale = 1.0f;
+    }
+    resolution.setScale(renderScale);
+
+    // A single headless frame has nothing to overlap
+    if (!init(threadCount, headlessOutput ? 0 : latency, propFile, propCount, tileDir)) return 1;
+    resolution.setLatency(pipeline ? pipeline->latency() : 0);
+
+    if (headlessOutput)
+    {
+        // The one frame waits for the tiles around the camera
+        if (streamTerrain)
+        {
+            updateTerrain(makeFrameParams(sf::Time::Zero));
+            terrain.waitIdle();
+        }
+
+        PROFILE_BEGIN_FRAME();
+        rasterObj(frame, sf::Time::Zero);
+        PROFILE_END_FRAME();
+        if (!frame.saveToFile(headlessOutput))
+        {
+            std::cerr << "Could not write " << headlessOutput << std::endl;
+            return 1;
+        }
+
+        const cullStats &cull = streamTerrain ? terrain.cullCounters : geometry.cullCounters;
+        const clipStats &clip = streamTerrain ? terrain.clipCounters : geometry.clipCounters;
+        std::cout << "cull: " << cull.nodesTested << " nodes tested, " << cull.nodesCulled << " culled, "
+                  << cull.nodesBackfacing << " backfacing, " << cull.trianglesSkipped << " triangles skipped, "
+                  << cull.trianglesBackfacing << " backfacing, " << cull.trianglesTested << " tested, "
+                  << clip.backfacing << " backface culled, "
+                  << cull.trianglesDrawn << " drawn" << std::endl;
+        std::cout << "lod: " << cull.lodChunksCoarse << " chunks coarse, "
+                  << cull.trianglesSavedByLod << " triangles saved" << std::endl;
+        std::cout << "occlusion: " << cull.occluderTriangles << " occluder triangles, "
+                  << cull.nodesOccluded << " nodes occluded, " << cull.trianglesOccluded << " triangles occluded" << std::endl;
+        if (!props.instances.empty())
+            std::cout << "props: " << propStage.counters.instancesTested << " instances, "
+                      << propStage.counters.instancesCulled << " culled, " << propStage.counters.trianglesTested
+                      << " triangles tested, " << propStage.counters.trianglesDrawn << " drawn" << std::endl;
+        if (streamTerrain)
+            std::cout << "tiles: " << terrain.counters.resident << " resident, " << terrain.counters.residentBytes / 1024
+                      << " KiB, " << terrain.counters.loadsFinished << " loaded, " << terrain.counters.loadsFailed << " failed, "
+                      << terrain.counters.deferred << " deferred by the budget" << std::endl;
+
+        std::cout << "clip: " << clip.accepted << " accepted, " << clip.rejected << " rejected, "
+                  << clip.clipped << " clipped (near " << clip.planeClips[CLIP_NEAR]
+                  << ", far " << clip.planeClips[CLIP_FAR]
+                  << ", left " << clip.planeClips[CLIP_LEFT]
+                  << ", right " << clip.planeClips[CLIP_RIGHT]
+                  << ", bottom " << clip.planeClips[CLIP_BOTTOM]
+                  << ", top " << clip.planeClips[CLIP_TOP] << "), into 0/1/2/+ triangles "
+                  << clip.clipResults[0] << "/" << clip.clipResults[1] << "/" << clip.clipResults[2]
+                  << "/" << clip.clipResults[3] << std::endl;
+        return 0;
+    }
+
     auto window = sf::RenderWindow{ { SCREEN_WIDTH, SCREEN_HEIGHT }, "3D Graphics" };
     window.setFramerateLimit(60);
-    init();
 
-    sf::Clock clock;
+    // The framebuffer is stretched over the whole window, filtered
+    sf::Texture texture;
+    texture.setSmooth(true);
+    sf::Sprite sprite;
+
+    sf::Clock clock, workClock;
     while (window.isOpen())
     {
+        PROFILE_BEGIN_FRAME();
+        workClock.restart();
         for (auto event = sf::Event{}; window.pollEvent(event);)
         {
             if (event.type == sf::Event::Closed)
             {
                 window.close();
             }
+            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F3)
+            {
+                showProfileOverlay = !showProfileOverlay;
+                if (!showProfileOverlay)
+                    window.setTitle("3D Graphics");
+            }
         }
 
         sf::Time elapsed = clock.restart();
-        handleMovement(elapsed);
+        {
+            PROFILE_SCOPE("input");
+            handleMovement(elapsed);
+        }
 
         window.clear();
-        drawObj(window, elapsed);
-        window.display();
+        bool rendered = false;
+        if (useShapes)
+        {
+            drawObj(window, elapsed);
+        }
+        else
+        {
+            // Whole frame goes up as a single texture upload and draw, the
+            // texture keeps the last frame while nothing changes
+            if (rasterObj(frame, elapsed))
+            {
+                PROFILE_SCOPE("upload");
+                if (texture.getSize().x != frame.width || texture.getSize().y != frame.height)
+                {
+                    texture.create(frame.width, frame.height);
+                    sprite.setTexture(texture, true);
+                    sprite.setScale((float)SCREEN_WIDTH / frame.width, (float)SCREEN_HEIGHT / frame.height);
+                }
+                texture.update(frame.pixels());
+                rendered = true;
+            }
+            window.draw(sprite);
+        }
+        if (GRAPH_PROFILE && showProfileOverlay)
+            drawProfileOverlay(window);
+
+        // Only what the frame took to make counts, not the wait for the
+        // frame rate limit in display. The new size reaches the next
+        // frame's geometry.
+        if (rendered)
+            resolution.update(workClock.getElapsedTime().asSeconds() * 1000.0f);
+
+        {
+            PROFILE_SCOPE("present");
+            window.display();
+        }
+        PROFILE_END_FRAME();
     }
 }
\ No newline at end of file
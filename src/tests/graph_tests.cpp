@@ -0,0 +1,1216 @@
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/command_line.hpp"
+#include "../include/depth_sort.hpp"
+#include "../include/frame_pipeline.hpp"
+#include "../include/geometry.hpp"
+#include "../include/mesh.hpp"
+#include "../include/pipeline.hpp"
+#include "../include/profiler.hpp"
+#include "../include/rasterizer.hpp"
+#include "../include/resolution.hpp"
+#include "../include/scene.hpp"
+#include "../include/terrain_stream.hpp"
+#include "../include/thread_pool.hpp"
+#include "../tools/bench_scenes.hpp"
+
+// Pass/fail checks of the render pipeline, one per CTest test.
+//
+//   graph_tests <test> [--threads <n>] [--frames <n>] [--assets <dir>]
+//
+// A test exits with 0 when it passes, 1 when it fails and 77, which CTest
+// reports as skipped, when the build cannot run it. --frames overrides
+// the frames the test renders along its camera paths.
+//
+// allocs runs graph's frame loop headless: the default terrain and a few
+// hundred scattered props through a framePipeline, sorted, batched into
+// SFML vertex arrays as the shapes path does and rasterized, every frame
+// between profiler frame marks; then a streamed terrain, serially like
+// graph runs it, once every tile is in. Each loop goes three times along
+// its camera path and fails unless the last pass makes no heap
+// allocations. Needs a GRAPH_PROFILE build.
+//
+// raster draws the triangles of every mesh along the camera path, plus
+// random ones from slivers to guard band sized, one at a time with the
+// block rasterizer and the one pixel at a time reference, and fails
+// unless they cover the same pixels, at depths within a few float
+// rounding steps of each other. Whole frames must then match bit for bit
+// single threaded and tiled on the pool. Random pairs sharing an edge
+// must draw every pixel inside their quad exactly once.
+// GRAPH_RASTER_KERNEL picks the kernel to check.
+//
+// occlusion renders every mesh along the orbit path and a path through
+// its valleys with and without occlusion culling and fails unless both
+// frames match bit for bit, as a conservative test must.
+//
+// scene scatters 1k, 4k and 16k props over a generated terrain and fails
+// unless a sceneStage on the pool gives the same triangles as one inline,
+// or if a scene takes an instance of a missing asset or of zero, infinite
+// or NaN scale.
+//
+// stream flies low across a generated terrain split into 16x16 tiles,
+// paced at 60 Hz, under a budget of a quarter of the tile set, and fails
+// if the resident and pending tiles together ever exceed it or none ever
+// load.
+//
+// math fails unless the inlined 4x4 product and the affine transformPoint
+// give the out of line 4x4 product's points exactly, and the mulAdd chain
+// gives them within a rounding step or two.
+//
+// vertex runs every vertex kernel set the CPU supports, whatever
+// GRAPH_VERTEX_KERNEL says, over whole streams whose length is no multiple
+// of any lane count and over ranges starting and ending at every offset
+// within a group of lanes. It fails if a kernel writes outside its range,
+// or if a result is further than VERTEX_KERNEL_ULPS units in the last
+// place of the magnitudes summed into it from mulMatrixByVector
+// (transform) or from the scalar divide and viewport mapping (project).
+// SSE adds the terms in another order and AVX2 fuses them.
+//
+// resolution runs a resolutionController over simulated frames whose cost
+// is fixed work plus work that goes with the render area, behind frame
+// pipelines of 0 to MAX_PIPELINE_LATENCY frames: one load over budget at
+// full size, one well under it starting at half size, and one that turns
+// heavy a third of the way in. Each must bring the size down as often as
+// its load calls for, starting within RESOLUTION_RECENT frames, without
+// being fooled by frames still in flight at the old size, and spend the
+// last third of the frames at one size, within budget, using at least 70%
+// of it unless at full size. Nothing is timed, so the result does not
+// depend on the machine or on --frames.
+//
+// cache writes the binary cache of a generated terrain, then copies of it
+// damaged one section at a time, indices, nodes, the hierarchy's layout,
+// split and depth, LOD chunks and levels, each with its checksum made to
+// match. It fails unless the intact cache loads and every damaged one is
+// rejected with the error for what was damaged.
+//
+// obj loads small OBJ files written to a temp directory: faces as v,
+// v/vt/vn and v//vn, negative indices, quads and larger polygons split
+// into fans, CRLF line ends and no final newline. It fails unless each
+// gives the expected vertex and triangle counts, and unless faces with an
+// index of 0 or past the vertices, texture coordinates or normals are
+// rejected with the file, the line and what was wrong.
+
+const int TEST_SKIPPED = 77;
+
+struct testOptions
+{
+    threadPool *pool;
+    int frames;             // 0 leaves it to the test
+    std::string assetDir;
+
+    int framesOr(int fallback) const { return frames > 0 ? frames : fallback; }
+};
+
+// graph's stages after the geometry, with its persistent batches
+struct frameOutput
+{
+    depthSorter sorter;
+    tiledRasterizer raster;
+    framebuffer fb;
+    sf::VertexArray fillBatch{ sf::Triangles };
+    sf::VertexArray lineBatch{ sf::Lines };
+
+    explicit frameOutput(threadPool *pool)
+    {
+        sorter.pool = raster.pool = pool;
+        fb.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    }
+
+    void draw(std::vector<triangle> &tris)
+    {
+        {
+            PROFILE_SCOPE("sort");
+            sorter.sort(tris);
+        }
+        {
+            PROFILE_SCOPE("batch");
+            fillBatch.clear();
+            lineBatch.clear();
+            for (const auto &t : tris)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    fillBatch.append(sf::Vertex(sf::Vector2f(t.p[k].x, t.p[k].y), t.color));
+                    const vec3d &next = t.p[(k + 1) % 3];
+                    lineBatch.append(sf::Vertex(sf::Vector2f(t.p[k].x, t.p[k].y), sf::Color::Black));
+                    lineBatch.append(sf::Vertex(sf::Vector2f(next.x, next.y), sf::Color::Black));
+                }
+            }
+        }
+        PROFILE_SCOPE("raster");
+        raster.draw(fb, tris);
+    }
+};
+
+// Heap allocations of three passes of frames calls of frame(f), each
+// call a profiler frame
+template <typename F>
+static bool steadyFrames(const char *name, int frames, F &&frame)
+{
+    uint64_t allocations[3];
+    for (int pass = 0; pass < 3; pass++)
+    {
+        uint64_t before = allocationCount();
+        for (int f = 0; f < frames; f++)
+        {
+            PROFILE_BEGIN_FRAME();
+            frame(f);
+            PROFILE_END_FRAME();
+        }
+        allocations[pass] = allocationCount() - before;
+    }
+    std::cout << name << ": " << allocations[0] << " allocations in the first pass, " << allocations[1]
+              << " in the second, " << allocations[2] << " in the third" << std::endl;
+    return allocations[2] == 0;
+}
+
+static int testAllocs(const testOptions &options)
+{
+    if (!GRAPH_PROFILE)
+    {
+        std::cerr << "allocs needs a build with GRAPH_PROFILE on to count allocations" << std::endl;
+        return TEST_SKIPPED;
+    }
+    namespace fs = std::filesystem;
+    int frames = options.framesOr(20);
+    mat4x4 matProj = benchProjection();
+    frameOutput output(options.pool);
+    bool ok = true;
+
+    // Pipelined like graph's default, the geometry on a pool of its own
+    {
+        benchMesh ground, prop;
+        std::string error;
+        if (!ground.m.load(options.assetDir + "/mountains.obj", &error) ||
+            !prop.m.load(options.assetDir + "/monkey.obj", &error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        scene props;
+        scatterInstances(props, ground.m, prop.m, 300, 1);
+
+        threadPool geometryPool(options.pool->size());
+        geometryStage geometry;
+        sceneStage propStage;
+        geometry.pool = propStage.pool = &geometryPool;
+        const unsigned latency = 2;
+        framePipeline pipeline(geometry, latency, &propStage);
+        for (unsigned i = 0; i < latency; i++)
+            pipeline.submit(ground.m, benchCamera(ground.m, (int)i, frames, matProj), &props);
+
+        ok = steadyFrames("pipelined", frames, [&](int f)
+        {
+            framePipeline::frame &done = pipeline.take();
+            pipeline.submit(ground.m, benchCamera(ground.m, (f + (int)latency) % frames, frames, matProj), &props);
+            if (done.changed)
+                output.draw(done.triangles);
+        }) && ok;
+        pipeline.take();
+        pipeline.take();
+    }
+
+    // Streamed, every tile in before the passes so none load during them
+    {
+        benchMesh ground;
+        if (!syntheticTerrain(ground, 256, 400.0f))
+            return 1;
+        std::string dir = (fs::temp_directory_path() / "graph_tests_alloc_tiles").string();
+        std::string error;
+        terrainStreamer terrain;
+        terrain.pool = options.pool;
+        terrain.loadRadius = 1e6f;
+        vec3d look;
+        frameParams params = flyoverCamera(ground.m, 0, frames, matProj, look);
+        if (!writeTerrainTiles(ground.m, 4, dir, &error) || !terrain.open(dir, &error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        terrain.update(params.cameraPos, look);
+        terrain.waitIdle();
+        terrain.update(params.cameraPos, look);
+
+        std::vector<triangle> tris;
+        ok = steadyFrames("streamed", frames, [&](int f)
+        {
+            frameParams params = flyoverCamera(ground.m, f, frames, matProj, look);
+            {
+                PROFILE_SCOPE("stream");
+                terrain.update(params.cameraPos, look);
+            }
+            if (terrain.upToDate(params))
+                return;
+            tris.clear();
+            {
+                PROFILE_SCOPE("geometry");
+                terrain.run(params, tris);
+            }
+            output.draw(tris);
+        }) && ok;
+        terrain.close();
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    if (!ok)
+        std::cerr << "Steady state frames allocated" << std::endl;
+    return ok ? 0 : 1;
+}
+
+// Vertex coordinate on the rasterizer's subpixel grid
+static int64_t subpixel(float v)
+{
+    return (int64_t)std::nearbyint((double)v * (1 << SUBPIXEL_BITS));
+}
+
+// Twice the signed area of a, b, p in subpixels
+static int64_t cross(const int64_t a[2], const int64_t b[2], const int64_t p[2])
+{
+    return (b[0] - a[0]) * (p[1] - a[1]) - (b[1] - a[1]) * (p[0] - a[0]);
+}
+
+// Pixels the triangles may touch on screen, with a pixel to spare
+static pixelRect triangleBounds(std::initializer_list<const triangle *> tris, const pixelRect &screen)
+{
+    float lo[2] = { INFINITY, INFINITY }, hi[2] = { -INFINITY, -INFINITY };
+    for (const triangle *t : tris)
+    {
+        for (const auto &p : t->p)
+        {
+            lo[0] = std::min(lo[0], p.x);
+            lo[1] = std::min(lo[1], p.y);
+            hi[0] = std::max(hi[0], p.x);
+            hi[1] = std::max(hi[1], p.y);
+        }
+    }
+    pixelRect r;
+    r.minX = (int)std::max((float)screen.minX, std::floor(lo[0]) - 1.0f);
+    r.minY = (int)std::max((float)screen.minY, std::floor(lo[1]) - 1.0f);
+    r.maxX = (int)std::min((float)screen.maxX, std::ceil(hi[0]) + 1.0f);
+    r.maxY = (int)std::min((float)screen.maxY, std::ceil(hi[1]) + 1.0f);
+    return r;
+}
+
+// Back to a cleared framebuffer's color and depth within r
+static void clearRect(framebuffer &fb, const pixelRect &r, sf::Color c)
+{
+    if (r.minX > r.maxX)
+        return;
+    for (int y = r.minY; y <= r.maxY; y++)
+    {
+        size_t row = (size_t)y * fb.width;
+        std::fill(fb.color.begin() + row + r.minX, fb.color.begin() + row + r.maxX + 1, packColor(c));
+        std::fill(fb.depth.begin() + row + r.minX, fb.depth.begin() + row + r.maxX + 1, INFINITY);
+    }
+}
+
+// Depth the block kernels may be off from the reference: a few float
+// rounding steps of the largest value their depth plane takes between
+// its anchor, a block's width outside the triangle at most, and the
+// triangle's far corner
+static double depthTolerance(const triangle &t)
+{
+    double x[3], y[3], lo[2] = { INFINITY, INFINITY }, hi[2] = { -INFINITY, -INFINITY }, zMax = 0.0;
+    for (int i = 0; i < 3; i++)
+    {
+        x[i] = (double)subpixel(t.p[i].x) / (1 << SUBPIXEL_BITS);
+        y[i] = (double)subpixel(t.p[i].y) / (1 << SUBPIXEL_BITS);
+        lo[0] = std::min(lo[0], x[i]);
+        lo[1] = std::min(lo[1], y[i]);
+        hi[0] = std::max(hi[0], x[i]);
+        hi[1] = std::max(hi[1], y[i]);
+        zMax = std::max(zMax, std::fabs((double)t.p[i].z));
+    }
+    double ux = x[1] - x[0], uy = y[1] - y[0], vx = x[2] - x[0], vy = y[2] - y[0];
+    double du = (double)t.p[1].z - t.p[0].z, dv = (double)t.p[2].z - t.p[0].z;
+    double det = ux * vy - uy * vx;
+    if (det == 0.0)
+        return 0.0;
+    double dzdx = (du * vy - dv * uy) / det, dzdy = (dv * ux - du * vx) / det;
+    double reach = zMax + std::fabs(dzdx) * (hi[0] - lo[0] + RASTER_BLOCK) + std::fabs(dzdy) * (hi[1] - lo[1] + RASTER_BLOCK);
+    return 16.0 * FLT_EPSILON * reach;
+}
+
+// Draws each triangle on its own with the block rasterizer and the
+// reference and fails unless they cover the same pixels in the same
+// color, at depths within depthTolerance. block and reference come in
+// cleared and go out that way.
+static bool checkTriangles(const std::vector<triangle> &tris, framebuffer &block, framebuffer &reference)
+{
+    pixelRect screen = { 0, 0, (int)BENCH_WIDTH - 1, (int)BENCH_HEIGHT - 1 };
+    size_t coverage = 0, depth = 0;
+    double worst = 0.0;
+    for (const auto &t : tris)
+    {
+        rasterizeTriangle(block, t, screen);
+        rasterizeTriangleReference(reference, t, screen);
+
+        pixelRect r = triangleBounds({ &t }, screen);
+        double tolerance = depthTolerance(t);
+        for (int y = r.minY; y <= r.maxY; y++)
+        {
+            for (int x = r.minX; x <= r.maxX; x++)
+            {
+                size_t i = (size_t)y * block.width + x;
+                bool inBlock = block.depth[i] != INFINITY, inReference = reference.depth[i] != INFINITY;
+                if (inBlock != inReference || (inBlock && block.color[i] != reference.color[i]))
+                    coverage++;
+                else if (inBlock)
+                {
+                    double off = std::fabs((double)block.depth[i] - reference.depth[i]);
+                    worst = std::max(worst, tolerance > 0.0 ? off / tolerance : off);
+                    if (off > tolerance)
+                        depth++;
+                }
+            }
+        }
+        clearRect(block, r, sf::Color::Black);
+        clearRect(reference, r, sf::Color::Black);
+    }
+
+    if (coverage || depth)
+        std::cerr << "  against the reference: " << coverage << " pixels covered differently, " << depth
+                  << " beyond the depth tolerance (worst " << worst << " of it)" << std::endl;
+    return coverage == 0 && depth == 0;
+}
+
+// Pairs from randomScreenTriangles whose far corners lie on opposite
+// sides of their shared edge cover a quad without overlapping. Fails if a
+// pixel is drawn by both triangles of such a pair, or by neither although
+// its center is inside the quad rather than on its outline. pairs counts
+// the pairs checked.
+static bool checkSharedEdges(const std::vector<triangle> &tris, framebuffer &first, framebuffer &second, size_t &pairs)
+{
+    pixelRect screen = { 0, 0, (int)BENCH_WIDTH - 1, (int)BENCH_HEIGHT - 1 };
+    size_t overlaps = 0, gaps = 0;
+    pairs = 0;
+    for (size_t k = 0; k + 1 < tris.size(); k += 2)
+    {
+        const triangle &a = tris[k], &b = tris[k + 1];
+        int64_t p[4][2];
+        const vec3d *corners[4] = { &a.p[0], &a.p[1], &a.p[2], &b.p[2] };
+        for (int i = 0; i < 4; i++)
+        {
+            p[i][0] = subpixel(corners[i]->x);
+            p[i][1] = subpixel(corners[i]->y);
+        }
+        int64_t side0 = cross(p[1], p[2], p[0]), side3 = cross(p[1], p[2], p[3]);
+        if (side0 == 0 || side3 == 0 || (side0 > 0) == (side3 > 0))
+            continue;
+        pairs++;
+
+        rasterizeTriangle(first, a, screen);
+        rasterizeTriangle(second, b, screen);
+
+        // Closed triangles p0 p1 p2 and p2 p1 p3, and the four edges of
+        // their outline
+        const int tri[2][3] = { { 0, 1, 2 }, { 2, 1, 3 } };
+        const int outline[4][2] = { { 0, 1 }, { 2, 0 }, { 1, 3 }, { 3, 2 } };
+        pixelRect r = triangleBounds({ &a, &b }, screen);
+        for (int y = r.minY; y <= r.maxY; y++)
+        {
+            for (int x = r.minX; x <= r.maxX; x++)
+            {
+                size_t i = (size_t)y * first.width + x;
+                bool inFirst = first.depth[i] != INFINITY, inSecond = second.depth[i] != INFINITY;
+                if (inFirst && inSecond)
+                {
+                    overlaps++;
+                    continue;
+                }
+                if (inFirst || inSecond)
+                    continue;
+
+                const int64_t c[2] = { (int64_t)x * (1 << SUBPIXEL_BITS) + (1 << SUBPIXEL_BITS) / 2,
+                                       (int64_t)y * (1 << SUBPIXEL_BITS) + (1 << SUBPIXEL_BITS) / 2 };
+                bool inside = false;
+                for (const auto &t : tri)
+                {
+                    int64_t e0 = cross(p[t[0]], p[t[1]], c), e1 = cross(p[t[1]], p[t[2]], c), e2 = cross(p[t[2]], p[t[0]], c);
+                    inside = inside || (e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0);
+                }
+                for (const auto &e : outline)
+                {
+                    const int64_t *u = p[e[0]], *v = p[e[1]];
+                    bool onLine = cross(u, v, c) == 0 && c[0] >= std::min(u[0], v[0]) && c[0] <= std::max(u[0], v[0]) &&
+                                  c[1] >= std::min(u[1], v[1]) && c[1] <= std::max(u[1], v[1]);
+                    inside = inside && !onLine;
+                }
+                if (inside)
+                    gaps++;
+            }
+        }
+        clearRect(first, r, sf::Color::Black);
+        clearRect(second, r, sf::Color::Black);
+    }
+
+    if (overlaps || gaps)
+        std::cerr << "  shared edges: " << overlaps << " pixels drawn twice, " << gaps << " inside pixels missed" << std::endl;
+    return overlaps == 0 && gaps == 0;
+}
+
+// Checks tris against the reference, then fails unless the tiled
+// rasterizer on the pool draws them bit for bit like the single threaded
+// one. single and reference come in cleared and go out that way.
+static bool checkRasterFrame(const std::vector<triangle> &tris, tiledRasterizer &raster, framebuffer &tiled,
+                             framebuffer &single, framebuffer &reference)
+{
+    if (!checkTriangles(tris, single, reference))
+        return false;
+
+    pixelRect screen = { 0, 0, (int)BENCH_WIDTH - 1, (int)BENCH_HEIGHT - 1 };
+    for (const auto &t : tris)
+        rasterizeTriangle(single, t, screen);
+    raster.draw(tiled, tris);
+    size_t mismatches;
+    bool same = sameFramebuffer(tiled, single, mismatches);
+    if (!same)
+        std::cerr << "  tiled: " << mismatches << " pixels differ from single threaded" << std::endl;
+    single.clear(sf::Color::Black);
+    return same;
+}
+
+static int testRaster(const testOptions &options)
+{
+    std::vector<benchMesh> meshes;
+    if (!loadBenchMeshes(options.assetDir, meshes))
+        return 1;
+
+    int frames = options.framesOr(8);
+    framebuffer tiled, single, reference;
+    tiled.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    single.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    reference.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    single.clear(sf::Color::Black);
+    reference.clear(sf::Color::Black);
+    mat4x4 matProj = benchProjection();
+    tiledRasterizer raster;
+    raster.pool = options.pool;
+
+    std::cout << "kernel " << rasterKernelName() << std::endl;
+    bool clean = true;
+    for (const auto &bm : meshes)
+    {
+        geometryStage geometry;
+        geometry.pool = options.pool;
+        std::vector<triangle> tris;
+        bool ok = true;
+        for (int f = 0; f < frames && ok; f++)
+        {
+            tris.clear();
+            geometry.run(bm.m, benchCamera(bm.m, f, frames, matProj), tris);
+            ok = checkRasterFrame(tris, raster, tiled, single, reference);
+        }
+        std::cout << bm.name << (ok ? "" : ": MISMATCH") << std::endl;
+        clean = clean && ok;
+    }
+
+    bool ok = true;
+    size_t pairs = 0;
+    for (unsigned seed = 1; seed <= 20 && ok; seed++)
+    {
+        std::vector<triangle> tris = randomScreenTriangles(200, seed);
+        size_t checked = 0;
+        ok = checkRasterFrame(tris, raster, tiled, single, reference) &&
+             checkSharedEdges(tris, single, reference, checked);
+        pairs += checked;
+    }
+    ok = ok && pairs > 0;
+    std::cout << "random, " << pairs << " quads checked for shared edges" << (ok ? "" : ": MISMATCH") << std::endl;
+    clean = clean && ok;
+
+    if (!clean)
+        std::cerr << "The block rasterizer does not match the reference" << std::endl;
+    return clean ? 0 : 1;
+}
+
+static int testOcclusion(const testOptions &options)
+{
+    std::vector<benchMesh> meshes;
+    if (!loadBenchMeshes(options.assetDir, meshes))
+        return 1;
+
+    int frames = options.framesOr(16);
+    framebuffer culled, full;
+    culled.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    full.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    mat4x4 matProj = benchProjection();
+    depthSorter sorter;
+    tiledRasterizer raster;
+    sorter.pool = raster.pool = options.pool;
+
+    bool clean = true;
+    using cameraPath = frameParams (*)(const mesh &, int, int, const mat4x4 &);
+    const struct { const char *name; cameraPath camera; } paths[] = { { "orbit", benchCamera }, { "valley", valleyCamera } };
+    for (const auto &bm : meshes)
+    {
+        for (const auto &path : paths)
+        {
+            // One stage each, LOD levels carry over from frame to frame
+            geometryStage withOcclusion, without;
+            withOcclusion.pool = without.pool = options.pool;
+            std::vector<triangle> tris;
+            size_t mismatches = 0;
+            bool ok = true;
+
+            auto render = [&](geometryStage &geometry, bool occlusion, int f, framebuffer &fb)
+            {
+                frameParams params = path.camera(bm.m, f, frames, matProj);
+                params.occlusionCulling = occlusion;
+                tris.clear();
+                geometry.run(bm.m, params, tris);
+                sorter.sort(tris);
+                raster.draw(fb, tris);
+            };
+
+            for (int f = 0; f < frames && ok; f++)
+            {
+                render(withOcclusion, true, f, culled);
+                render(without, false, f, full);
+                ok = sameFramebuffer(culled, full, mismatches);
+            }
+
+            std::cout << bm.name << " " << path.name;
+            if (!ok)
+                std::cout << ": MISMATCH (" << mismatches << " pixels)";
+            std::cout << std::endl;
+            clean = clean && ok;
+        }
+    }
+
+    if (!clean)
+        std::cerr << "Occlusion culling changed what was drawn" << std::endl;
+    return clean ? 0 : 1;
+}
+
+static int testScene(const testOptions &options)
+{
+    benchMesh prop, ground;
+    std::string error;
+    if (!prop.m.load(options.assetDir + "/monkey.obj", &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (!syntheticTerrain(ground, 256, 400.0f))
+        return 1;
+
+    int frames = options.framesOr(8);
+    mat4x4 matProj = benchProjection();
+    bool clean = true;
+    for (unsigned count : { 1000u, 4000u, 16000u })
+    {
+        scene props;
+        scatterInstances(props, ground.m, prop.m, count, count);
+
+        sceneStage threaded, inlined;
+        threaded.pool = options.pool;
+        std::vector<triangle> tris, reference;
+        bool ok = true;
+        for (int f = 0; f < frames && ok; f++)
+        {
+            frameParams params = benchCamera(ground.m, f, frames, matProj);
+            tris.clear();
+            threaded.run(props, params, tris);
+            reference.clear();
+            inlined.run(props, params, reference);
+            ok = sameTriangles(tris, reference);
+        }
+        std::cout << count << " instances" << (ok ? "" : ": MISMATCH") << std::endl;
+        clean = clean && ok;
+    }
+
+    scene bad;
+    uint32_t asset = bad.addAsset(prop.m);
+    const float origin[3] = { 0.0f, 0.0f, 0.0f };
+    bool rejected = !bad.addInstance(asset + 1, origin, 0.0f, 1.0f);
+    for (float scale : { 0.0f, -0.0f, INFINITY, NAN })
+        rejected = rejected && !bad.addInstance(asset, origin, 0.0f, scale);
+    rejected = rejected && bad.instances.empty() && bad.addInstance(asset, origin, 0.0f, -1.0f);
+    std::cout << "bad instances " << (rejected ? "rejected" : "ACCEPTED") << std::endl;
+
+    if (!clean)
+        std::cerr << "Threaded instances differ from inline ones" << std::endl;
+    if (!rejected)
+        std::cerr << "The scene took an instance it cannot draw" << std::endl;
+    return clean && rejected ? 0 : 1;
+}
+
+static int testStream(const testOptions &options)
+{
+    namespace fs = std::filesystem;
+    benchMesh ground;
+    if (!syntheticTerrain(ground, 724, 400.0f))
+        return 1;
+
+    std::string dir = (fs::temp_directory_path() / "graph_tests_tiles").string();
+    std::string error;
+    std::vector<terrainTileInfo> tiles;
+    if (!writeTerrainTiles(ground.m, 16, dir, &error) || !readTerrainManifest(dir, tiles, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    uint64_t totalBytes = 0;
+    for (const terrainTileInfo &t : tiles)
+        totalBytes += t.bytes;
+
+    terrainStreamer terrain;
+    terrain.pool = options.pool;
+    terrain.budgetBytes = totalBytes / 4;
+    if (!terrain.open(dir, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    int frames = options.framesOr(200);
+    mat4x4 matProj = benchProjection();
+    std::vector<triangle> tris;
+    uint64_t maxBytes = 0;
+    bool withinBudget = true;
+    for (int f = 0; f < frames; f++)
+    {
+        auto frameStart = benchClock::now();
+        vec3d look;
+        frameParams params = flyoverCamera(ground.m, f, frames, matProj, look);
+        terrain.update(params.cameraPos, look);
+        tris.clear();
+        terrain.run(params, tris);
+        const terrainStreamStats &c = terrain.counters;
+        maxBytes = std::max(maxBytes, c.residentBytes + c.pendingBytes);
+        withinBudget = withinBudget && c.residentBytes + c.pendingBytes <= terrain.budgetBytes;
+
+        // Paced like a 60 Hz render loop, which gives the I/O thread its time
+        std::this_thread::sleep_until(frameStart + std::chrono::microseconds(16667));
+    }
+
+    const terrainStreamStats &c = terrain.counters;
+    std::cout << "budget " << terrain.budgetBytes / 1024 << " KiB, most resident and pending " << maxBytes / 1024 << " KiB, "
+              << c.loadsFinished << " loads, " << c.loadsFailed << " failed" << std::endl;
+    bool ok = withinBudget && c.loadsFinished > 0 && c.loadsFailed == 0;
+    terrain.close();
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+
+    if (!ok)
+        std::cerr << (withinBudget ? "No tiles were streamed in" : "Resident and pending tiles exceeded the budget") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// One way of damaging a cache's payload, and the error it must give
+struct cacheDamage
+{
+    const char *what;
+    const char *error;
+    void (*damage)(char *data, const meshCacheHeader &h);
+};
+
+template <typename T>
+static T *cacheSection(char *data, uint64_t offset)
+{
+    return reinterpret_cast<T *>(data + offset);
+}
+
+static const cacheDamage cacheDamages[] = {
+    { "index past the vertices", "vertex index out of range", [](char *data, const meshCacheHeader &h)
+      { cacheSection<uint32_t>(data, h.indexOffset)[5] = h.vertexCount; } },
+    { "LOD index past the vertices", "vertex index out of range", [](char *data, const meshCacheHeader &h)
+      { cacheSection<uint32_t>(data, h.lodIndexOffset)[0] = h.vertexCount; } },
+    { "node vertex range", "node out of range", [](char *data, const meshCacheHeader &h)
+      { cacheSection<meshNode>(data, h.nodeOffset)[0].vertexLast = h.vertexCount + 1; } },
+    { "root short of a triangle", "hierarchy root does not hold every triangle", [](char *data, const meshCacheHeader &h)
+      { cacheSection<meshNode>(data, h.nodeOffset)[0].count--; } },
+    { "first child made a leaf", "hierarchy is not stored depth first", [](char *data, const meshCacheHeader &h)
+      { cacheSection<meshNode>(data, h.nodeOffset)[1].secondChild = 0; } },
+    { "first child short of a triangle", "hierarchy children do not split their parent's triangles",
+      [](char *data, const meshCacheHeader &h) { cacheSection<meshNode>(data, h.nodeOffset)[1].count--; } },
+    { "every node's second child the next node", "hierarchy children do not split their parent's triangles",
+      [](char *data, const meshCacheHeader &h)
+      {
+          meshNode *nodes = cacheSection<meshNode>(data, h.nodeOffset);
+          for (uint32_t i = 0; i + 1 < h.nodeCount; i++)
+              nodes[i].secondChild = i + 1;
+      } },
+    // A spine of nodes each splitting off a one triangle leaf: laid out
+    // and split correctly, but one level deeper per spine node
+    { "a spine past the depth limit", "hierarchy is too deep", [](char *data, const meshCacheHeader &h)
+      {
+          meshNode *nodes = cacheSection<meshNode>(data, h.nodeOffset);
+          uint32_t triangles = h.indexCount / 3;
+          for (uint32_t i = 0; i < h.nodeCount; i++)
+          {
+              uint32_t k = i / 2;
+              bool spine = i % 2 == 0, last = i + 1 == h.nodeCount;
+              nodes[i].first = k;
+              nodes[i].count = spine ? triangles - k : 1;
+              nodes[i].secondChild = spine && !last ? i + 2 : 0;
+          }
+      } },
+    { "LOD chunk past the nodes", "LOD chunk out of range", [](char *data, const meshCacheHeader &h)
+      { cacheSection<meshLodChunk>(data, h.lodChunkOffset)[0].node = h.nodeCount; } },
+    { "LOD level past the LOD triangles", "LOD level out of range", [](char *data, const meshCacheHeader &h)
+      { cacheSection<meshLodLevel>(data, h.lodLevelOffset)[0].count = h.lodIndexCount / 3 + 1; } },
+};
+
+static int testCache(const testOptions &)
+{
+    namespace fs = std::filesystem;
+    benchMesh ground;
+    if (!syntheticTerrain(ground, 64, 100.0f))
+        return 1;
+
+    std::string dir = (fs::temp_directory_path() / "graph_tests_cache").string();
+    std::string file = (fs::path(dir) / "terrain.gmesh").string();
+    std::string error;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    std::vector<char> intact;
+    {
+        std::ifstream in;
+        if (ground.m.saveToCacheFile(file, &error))
+            in.open(file, std::ios::binary);
+        intact.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    meshCacheHeader h;
+    if (intact.size() < sizeof(h))
+    {
+        std::cerr << (error.empty() ? file + ": could not read cache" : error) << std::endl;
+        return 1;
+    }
+    std::memcpy(&h, intact.data(), sizeof(h));
+    if (h.lodLevelCount == 0 || h.nodeCount < 2 * MESH_MAX_DEPTH + 1)
+    {
+        std::cerr << "The terrain is too small to damage every section" << std::endl;
+        return 1;
+    }
+
+    bool clean = true;
+    mesh loaded;
+    bool ok = loaded.loadFromCacheFile(file, &error) && loaded.triangleCount() == ground.m.triangleCount();
+    std::cout << "intact: " << (ok ? "loads" : error) << std::endl;
+    clean = clean && ok;
+
+    for (const cacheDamage &d : cacheDamages)
+    {
+        std::vector<char> damaged = intact;
+        d.damage(damaged.data(), h);
+        uint64_t checksum = meshCacheChecksum(damaged.data() + sizeof(h), damaged.size() - sizeof(h));
+        std::memcpy(damaged.data() + offsetof(meshCacheHeader, checksum), &checksum, sizeof(checksum));
+        {
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            out.write(damaged.data(), (std::streamsize)damaged.size());
+        }
+
+        error.clear();
+        bool loads = loaded.loadFromCacheFile(file, &error);
+        ok = !loads && error == file + ": " + d.error;
+        std::cout << d.what << ": " << (loads ? "loads" : error) << (ok ? "" : ": FAILED") << std::endl;
+        clean = clean && ok;
+    }
+
+    // The last load failed, which unmapped the file
+    fs::remove_all(dir, ec);
+    if (!clean)
+        std::cerr << "The mesh cache loader did not reject damaged caches as expected" << std::endl;
+    return clean ? 0 : 1;
+}
+
+// The 4x4 product out of line, through references, as geometry.cpp had it
+// before the math moved into vecmath.hpp
+static vec3d (*volatile outOfLineTransform)(const mat4x4 &, const vec3d &) =
+    [](const mat4x4 &m, const vec3d &i) { return mulMatrixByVector(m, i); };
+
+static int testMath(const testOptions &)
+{
+    const size_t count = 1 << 16;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+    std::vector<vec3d> in(count), reference(count), out(count);
+    for (vec3d &v : in)
+        v = { coord(rng), coord(rng), coord(rng) };
+
+    // A world matrix like graph's: rotations then a translation
+    mat4x4 matWorld = mulMatrices(mulMatrices(makeRotatedMatrixZ(0.7f), makeRotatedMatrixX(0.35f)),
+                                  makeTranslatedMatrix(0.0f, 0.0f, 2.0f));
+    affineMatrix affine = toAffine(matWorld);
+    for (size_t i = 0; i < count; i++)
+        reference[i] = outOfLineTransform(matWorld, in[i]);
+
+    // Same to the bit, or within a rounding step or two when fused
+    bool clean = true;
+    auto check = [&](const char *name, float tolerance)
+    {
+        bool ok = true;
+        for (size_t i = 0; i < count && ok; i++)
+        {
+            const vec3d &a = out[i], &b = reference[i];
+            float scale = std::max({ 1.0f, std::fabs(b.x), std::fabs(b.y), std::fabs(b.z) });
+            ok = std::fabs(a.x - b.x) <= tolerance * scale && std::fabs(a.y - b.y) <= tolerance * scale &&
+                 std::fabs(a.z - b.z) <= tolerance * scale && a.w == b.w;
+        }
+        std::cout << name << (ok ? "" : ": MISMATCH") << std::endl;
+        clean = clean && ok;
+    };
+
+    for (size_t i = 0; i < count; i++)
+        out[i] = mulMatrixByVector(matWorld, in[i]);
+    check("4x4 inline", 0.0f);
+    for (size_t i = 0; i < count; i++)
+        out[i] = transformPoint(affine, in[i]);
+    check("affine", 0.0f);
+    for (size_t i = 0; i < count; i++)
+        out[i] = transformPointFused(affine, in[i]);
+    check(GRAPH_MATH_FMA ? "affine mulAdd (fma)" : "affine mulAdd", 1e-6f);
+
+    if (!clean)
+        std::cerr << "Transforms disagree with mulMatrixByVector" << std::endl;
+    return clean ? 0 : 1;
+}
+
+// Units in the last place of the summed magnitudes of a result's terms
+// the vertex kernels may be off by. A sum of four products rounds at most
+// four times, each by under an ulp of those magnitudes, whatever the order
+// or fusing, so two ways of adding them differ by at most twice that.
+const float VERTEX_KERNEL_ULPS = 8.0f;
+
+// Whether a is within VERTEX_KERNEL_ULPS units in the last place of scale
+// of b
+static bool withinUlps(float a, float b, float scale)
+{
+    float ulp = std::nextafter(scale, INFINITY) - scale;
+    return std::fabs(a - b) <= VERTEX_KERNEL_ULPS * ulp;
+}
+
+static int testVertex(const testOptions &)
+{
+    const size_t count = 1003;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coord(-100.0f, 100.0f), depth(0.1f, 100.0f);
+    vertexStream positions, clip;
+    for (size_t i = 0; i < count; i++)
+    {
+        positions.push_back({ coord(rng), coord(rng), coord(rng) });
+        clip.push_back({ coord(rng), coord(rng), coord(rng), depth(rng) });
+    }
+    vertexSpan in = positions.span();
+
+    // graph's projection of a turned and moved mesh
+    mat4x4 matWorld = mulMatrices(mulMatrices(makeRotatedMatrixZ(0.7f), makeRotatedMatrixX(0.35f)),
+                                  makeTranslatedMatrix(0.0f, 0.0f, 2.0f));
+    mat4x4 m = mulMatrices(matWorld, benchProjection());
+    viewport vp = { (float)BENCH_WIDTH, (float)BENCH_HEIGHT };
+
+    // Results and the summed magnitudes of the terms of each
+    vertexStream transformed, projected;
+    std::vector<float> transformScale(count * 4), projectScale(count * 2);
+    for (size_t i = 0; i < count; i++)
+    {
+        vec3d p = in.get(i);
+        vec3d r = mulMatrixByVector(m, p);
+        transformed.push_back(r);
+        for (int k = 0; k < 4; k++)
+            transformScale[i * 4 + k] = std::fabs(p.x * m.m[0][k]) + std::fabs(p.y * m.m[1][k]) +
+                                        std::fabs(p.z * m.m[2][k]) + std::fabs(m.m[3][k]);
+
+        float invW = 1.0f / clip.w[i];
+        float ndcX = clip.x[i] * invW, ndcY = clip.y[i] * invW;
+        projected.push_back({ (1.0f - ndcX) * (0.5f * vp.width), (1.0f - ndcY) * (0.5f * vp.height),
+                              clip.z[i] * invW, clip.w[i] });
+        projectScale[i * 2] = 0.5f * vp.width * (1.0f + std::fabs(ndcX));
+        projectScale[i * 2 + 1] = 0.5f * vp.height * (1.0f + std::fabs(ndcY));
+    }
+
+    // Runs one kernel over [first, last) of a stream filled with a marker
+    // and checks every vertex, inside the range against the reference and
+    // outside it for the marker
+    const float marker = -12345.0f;
+    vertexStream out;
+    auto checkRange = [&](const vertexKernels &k, bool project, size_t first, size_t last)
+    {
+        out.resize(count);
+        for (std::vector<float> *c : { &out.x, &out.y, &out.z, &out.w })
+            std::fill(c->begin(), c->end(), marker);
+        if (project)
+            k.project(vp, clip, out, first, last);
+        else
+            k.transform(m, in, out, first, last);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const float got[4] = { out.x[i], out.y[i], out.z[i], out.w[i] };
+            if (i < first || i >= last)
+            {
+                if (got[0] != marker || got[1] != marker || got[2] != marker || got[3] != marker)
+                    return false;
+                continue;
+            }
+            if (project)
+            {
+                // Depth and w take the same operations everywhere
+                if (!withinUlps(got[0], projected.x[i], projectScale[i * 2]) ||
+                    !withinUlps(got[1], projected.y[i], projectScale[i * 2 + 1]) ||
+                    got[2] != projected.z[i] || got[3] != projected.w[i])
+                    return false;
+                continue;
+            }
+            const float want[4] = { transformed.x[i], transformed.y[i], transformed.z[i], transformed.w[i] };
+            for (int c = 0; c < 4; c++)
+                if (!withinUlps(got[c], want[c], transformScale[i * 4 + c]))
+                    return false;
+        }
+        return true;
+    };
+
+    bool clean = true;
+    for (const vertexKernels &k : supportedVertexKernels())
+    {
+        for (bool project : { false, true })
+        {
+            bool ok = checkRange(k, project, 0, count);
+            for (size_t first = 0; first < 9 && ok; first++)
+                for (size_t n = 0; n <= 17 && ok; n++)
+                    ok = checkRange(k, project, 1 + first, 1 + first + n);
+            ok = ok && checkRange(k, project, count - 5, count);
+            std::cout << k.name << (project ? " project" : " transform") << (ok ? "" : ": MISMATCH") << std::endl;
+            clean = clean && ok;
+        }
+    }
+
+    if (!clean)
+        std::cerr << "A vertex kernel disagrees with the reference" << std::endl;
+    return clean ? 0 : 1;
+}
+
+// Frame cost in the resolution test: fixed work plus pixel work that goes
+// with the render area, given in ms at full size
+struct simulatedLoad
+{
+    const char *name;
+    float startScale;
+    float baseMs;
+    float pixelMsBefore, pixelMsAfter;  // the load changes a third of the way in
+    unsigned minDrops, maxDrops;        // size reductions it takes
+};
+
+// Runs a controller over frames of simulated cost behind a pipeline of
+// the given latency, each frame made at the size picked latency frames
+// before it is timed
+static bool checkResolution(const simulatedLoad &load, unsigned latency)
+{
+    const int frames = 480, change = frames / 3;
+    const double fullPixels = (double)BENCH_WIDTH * BENCH_HEIGHT;
+    resolutionController controller;
+    controller.minScale = 0.5f;
+    controller.setOutputSize(BENCH_WIDTH, BENCH_HEIGHT);
+    controller.setScale(load.startScale);
+    controller.setLatency(latency);
+
+    std::deque<std::pair<unsigned, unsigned>> inFlight(latency, { controller.width(), controller.height() });
+    unsigned drops = 0, lateChanges = 0;
+    int firstDrop = -1;
+    float ms = 0.0f, worstLateMs = 0.0f;
+    for (int f = 0; f < frames; f++)
+    {
+        inFlight.push_back({ controller.width(), controller.height() });
+        auto size = inFlight.front();
+        inFlight.pop_front();
+        float pixelMs = f < change ? load.pixelMsBefore : load.pixelMsAfter;
+        ms = load.baseMs + (float)(pixelMs * size.first * size.second / fullPixels);
+
+        unsigned width = controller.width();
+        if (controller.update(ms) && controller.width() < width)
+        {
+            drops++;
+            if (firstDrop < 0)
+                firstDrop = f;
+        }
+        if (f >= 2 * frames / 3)
+        {
+            lateChanges += controller.width() != width;
+            worstLateMs = std::max(worstLateMs, ms);
+        }
+    }
+
+    // A drop comes within RESOLUTION_RECENT frames of the load going over
+    // budget, from the start or from the change
+    int overFrom = load.pixelMsBefore == load.pixelMsAfter ? 0 : change;
+    bool reacted = load.maxDrops == 0 || (firstDrop >= overFrom && firstDrop < overFrom + (int)RESOLUTION_RECENT);
+    bool settled = lateChanges == 0 && worstLateMs <= controller.targetMs;
+    bool used = controller.scale() == controller.maxScale || ms >= 0.7f * controller.targetMs;
+    bool ok = drops >= load.minDrops && drops <= load.maxDrops && reacted && settled && used;
+    std::cout << load.name << ", latency " << latency << ": " << drops << " drops, first at frame " << firstDrop
+              << ", ending at scale " << controller.scale() << " and " << ms << " ms" << (ok ? "" : ": FAILED") << std::endl;
+    return ok;
+}
+
+static int testResolution(const testOptions &)
+{
+    const simulatedLoad loads[] = {
+        { "heavy", 1.0f, 2.0f, 28.0f, 28.0f, 1, 1 },
+        { "light", 0.5f, 2.0f, 10.0f, 10.0f, 0, 0 },
+        // The first mean over budget still holds light frames, so it
+        // may take a second step
+        { "heavier", 1.0f, 2.0f, 10.0f, 28.0f, 1, 2 },
+    };
+    bool ok = true;
+    for (const auto &load : loads)
+        for (unsigned latency : { 0u, 1u, 2u, 4u, MAX_PIPELINE_LATENCY })
+            ok = checkResolution(load, latency) && ok;
+    if (!ok)
+        std::cerr << "The resolution controller did not hold the budget as expected" << std::endl;
+    return ok ? 0 : 1;
+}
+
+// A small OBJ file and what loading it must give: the vertex and triangle
+// counts, or the error after "<file>:"
+struct objCase
+{
+    const char *what;
+    const char *text;
+    size_t vertices, triangles;
+    const char *error;
+};
+
+static const objCase objCases[] = {
+    { "plain faces", "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nf 1 2 3\nf 2 4 3\n", 4, 2, nullptr },
+    { "v/vt/vn", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvt 1 0\nvt 0 1\nvn 0 0 1\nf 1/1/1 2/2/1 3/3/1\n", 3, 1, nullptr },
+    { "v//vn", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3//1\n", 3, 1, nullptr },
+    { "negative indices", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -3 -2 -1\nv 1 1 0\nf -3 -1 -2\n", 4, 2, nullptr },
+    { "quad fan", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n", 4, 2, nullptr },
+    { "hexagon fan", "v 2 1 0\nv 1.5 2 0\nv 0.5 2 0\nv 0 1 0\nv 0.5 0 0\nv 1.5 0 0\nf 1 2 3 4 5 6\n", 6, 4, nullptr },
+    { "CRLF", "# comment\r\nv 0 0 0\r\nv 1 0 0\r\nv 0 1 0\r\nv 1 1 0\r\nf 1 2 3\r\nf 2 4 3\r\n", 4, 2, nullptr },
+    { "no final newline", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3", 3, 1, nullptr },
+    { "index 0", "v 0 0 0\nv 1 0 0\nv 0 1 0\n\nf 0 1 2\n", 0, 0, "5: vertex index 0 out of range" },
+    { "index past the vertices", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\nf 1 2 4\n", 0, 0, "5: vertex index 4 out of range" },
+    { "negative index before the first vertex", "v 0 0 0\r\nv 1 0 0\r\nv 0 1 0\r\nf -4 1 2\r\n", 0, 0,
+      "4: vertex index -4 out of range" },
+    { "texture coordinate past the end", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nf 1/1 2/2 3/1\n", 0, 0,
+      "5: texture coordinate index 2 out of range" },
+    { "normal past the end", "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3//2\n", 0, 0, "5: normal index 2 out of range" },
+    { "two corners", "v 0 0 0\nv 1 0 0\nf 1 2\n", 0, 0, "3: face needs at least three vertices" },
+};
+
+static int testObj(const testOptions &)
+{
+    namespace fs = std::filesystem;
+    std::string dir = (fs::temp_directory_path() / "graph_tests_obj").string();
+    std::string file = (fs::path(dir) / "case.obj").string();
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+
+    bool clean = true;
+    for (const objCase &c : objCases)
+    {
+        {
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            out << c.text;
+        }
+
+        mesh loaded;
+        std::string error;
+        bool loads = loaded.loadFromObjFile(file, &error);
+        bool ok;
+        if (c.error)
+        {
+            ok = !loads && error == file + ":" + c.error;
+            std::cout << c.what << ": " << (loads ? "loads" : error);
+        }
+        else
+        {
+            ok = loads && loaded.verts.size() == c.vertices && loaded.triangleCount() == c.triangles;
+            std::cout << c.what << ": ";
+            if (loads)
+                std::cout << loaded.verts.size() << " vertices, " << loaded.triangleCount() << " triangles";
+            else
+                std::cout << error;
+        }
+        std::cout << (ok ? "" : ": FAILED") << std::endl;
+        clean = clean && ok;
+    }
+
+    std::string error;
+    mesh missing;
+    std::string path = (fs::path(dir) / "missing.obj").string();
+    bool ok = !missing.loadFromObjFile(path, &error) && error == path + ": could not open file";
+    std::cout << "missing file: " << error << (ok ? "" : ": FAILED") << std::endl;
+    clean = clean && ok;
+
+    fs::remove_all(dir, ec);
+    if (!clean)
+        std::cerr << "The OBJ loader did not give the expected meshes and errors" << std::endl;
+    return clean ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    const struct { const char *name; int (*run)(const testOptions &); } tests[] = {
+        { "allocs", testAllocs },
+        { "raster", testRaster },
+        { "occlusion", testOcclusion },
+        { "scene", testScene },
+        { "stream", testStream },
+        { "math", testMath },
+        { "vertex", testVertex },
+        { "resolution", testResolution },
+        { "cache", testCache },
+        { "obj", testObj }
+    };
+
+    const char *name = nullptr;
+    unsigned threadCount = 0;
+    testOptions options = { nullptr, 0, "assets" };
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[++i], MAX_POOL_THREADS, threadCount))
+            {
+                std::cerr << "--threads takes 0 (one per hardware thread) to " << MAX_POOL_THREADS << ", got \""
+                          << argv[i] << "\"" << std::endl;
+                name = "";
+                break;
+            }
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            options.frames = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--assets") == 0 && i + 1 < argc)
+            options.assetDir = argv[++i];
+        else if (!name)
+            name = argv[i];
+        else
+            name = "";
+    }
+
+    for (const auto &test : tests)
+    {
+        if (name && std::strcmp(name, test.name) == 0)
+        {
+            threadPool pool(threadCount);
+            options.pool = &pool;
+            return test.run(options);
+        }
+    }
+
+    std::cerr << "Usage: " << argv[0] << " <test> [--threads <n>] [--frames <n>] [--assets <dir>]" << std::endl
+              << "Tests:";
+    for (const auto &test : tests)
+        std::cerr << " " << test.name;
+    std::cerr << std::endl;
+    return 1;
+}
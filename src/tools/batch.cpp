@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/command_line.hpp"
+#include "../include/depth_sort.hpp"
+#include "../include/geometry.hpp"
+#include "../include/mesh.hpp"
+#include "../include/pipeline.hpp"
+#include "../include/rasterizer.hpp"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Offline batch renderer for turntables and flythroughs.
+//
+//   graph_batch [--mesh <file>] [--size <w>x<h>] [--frames <first>:<last>]
+//               [--turntable <degrees per frame>] [--path <file>]
+//               [--output <pattern> | --raw] [--threads <n>]
+//               [--lod-error <px>] [--occlusion]
+//
+// Renders frames first through last (default 0:99) of a camera schedule
+// through the software path, the same way graph --headless renders one.
+// The schedule drives graph's inputs: theta turns the mesh, yaw turns the
+// camera and camera moves it. --turntable advances theta by a fixed
+// number of degrees per frame with the camera where graph starts it;
+// --path reads keyframes instead, one per line as
+//
+//   <frame> <theta degrees> <yaw degrees> <camera x> <camera y> <camera z>
+//
+// with frames in between interpolated linearly and frames outside the
+// keys held at the nearest one. Blank lines and lines starting with #
+// are skipped.
+//
+// Frames are independent of each other, so every thread renders whole
+// frames with a geometry stage, sorter, rasterizer and framebuffer of its
+// own and no thread waits on another. With --output (default
+// "frame_%04d.ppm", any extension framebuffer::saveToFile takes, and
+// exactly one %d for the frame number) every thread writes its frames
+// itself. With --raw frames go to stdout as
+// packed RGBA in frame order, for a video encoder such as
+//
+//   graph_batch --raw | ffmpeg -f rawvideo -pix_fmt rgba -s 920x640 -i - out.mp4
+//
+// and threads run at most BATCH_FRAMES_AHEAD frames per thread ahead of
+// the oldest one not written yet, which bounds the memory of frames
+// waiting for their turn.
+
+const unsigned BATCH_FRAMES_AHEAD = 2;
+
+// Most render threads --threads may ask for
+const unsigned MAX_BATCH_THREADS = 256;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 1000.0f;
+
+// Inputs of one frame, in graph's terms
+struct cameraKey
+{
+    float frame;
+    float theta, yaw;   // radians
+    vec3d camera;
+};
+
+struct batchOptions
+{
+    std::string meshFile = "assets/mountains.obj";
+    unsigned width = 920, height = 640;
+    int first = 0, last = 99;
+    float turntableDegrees = 1.0f;
+    std::string pathFile;
+    std::string outputPattern = "frame_%04d.ppm";
+    bool raw = false;
+    unsigned threadCount = 0;
+    float lodErrorPixels = 1.0f;
+    bool occlusionCulling = false;
+};
+
+static const float DEGREES = 3.14159265f / 180.0f;
+
+static bool loadPath(const std::string &filename, std::vector<cameraKey> &keys, std::string &error)
+{
+    std::ifstream f(filename);
+    if (!f.is_open())
+    {
+        error = "Could not open " + filename;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(f, line); number++)
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        std::istringstream in(line);
+        cameraKey k;
+        if (!(in >> k.frame >> k.theta >> k.yaw >> k.camera.x >> k.camera.y >> k.camera.z))
+        {
+            error = filename + ":" + std::to_string(number) + ": expected <frame> <theta> <yaw> <x> <y> <z>";
+            return false;
+        }
+        k.theta *= DEGREES;
+        k.yaw *= DEGREES;
+        keys.push_back(k);
+    }
+
+    if (keys.empty())
+    {
+        error = filename + ": no keyframes";
+        return false;
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const cameraKey &a, const cameraKey &b) { return a.frame < b.frame; });
+    return true;
+}
+
+// The schedule's inputs at frame f
+static cameraKey keyAt(const std::vector<cameraKey> &keys, float turntableDegrees, int f)
+{
+    if (keys.empty())
+        return { (float)f, f * turntableDegrees * DEGREES, 0.0f, vec3d() };
+
+    auto next = std::upper_bound(keys.begin(), keys.end(), (float)f,
+                                 [](float frame, const cameraKey &k) { return frame < k.frame; });
+    if (next == keys.begin())
+        return keys.front();
+    if (next == keys.end())
+        return keys.back();
+
+    const cameraKey &a = *(next - 1), &b = *next;
+    float t = (f - a.frame) / (b.frame - a.frame);
+    cameraKey k;
+    k.frame = (float)f;
+    k.theta = a.theta + (b.theta - a.theta) * t;
+    k.yaw = a.yaw + (b.yaw - a.yaw) * t;
+    k.camera = addVectors(a.camera, mulVector(subVectors(b.camera, a.camera), t));
+    return k;
+}
+
+// Same world and view matrices graph builds from theta, yaw and camera
+static frameParams makeFrameParams(const cameraKey &k, const batchOptions &options, const mat4x4 &matProj)
+{
+    mat4x4 matRotZ = makeRotatedMatrixZ(k.theta);
+    mat4x4 matRotX = makeRotatedMatrixX(k.theta * 0.5f);
+    mat4x4 matTrans = makeTranslatedMatrix(0.0f, 0.0f, 2.0f);
+    mat4x4 matWorld = mulMatrices(matRotZ, matRotX);
+    matWorld = mulMatrices(matWorld, matTrans);
+
+    vec3d up = { 0, 1, 0 };
+    vec3d forward = { 0, 0, 1 };
+    mat4x4 matRotCamera = makeRotatedMatrixY(k.yaw);
+    vec3d target = addVectors(k.camera, mulMatrixByVector(matRotCamera, forward));
+    mat4x4 matCamera = pointAt(k.camera, target, up);
+
+    frameParams params;
+    params.matWorld = matWorld;
+    params.matView = quickInverse(matCamera);
+    params.matProj = matProj;
+    params.cameraPos = k.camera;
+    params.vp = { (float)options.width, (float)options.height };
+    params.lodErrorPixels = options.lodErrorPixels;
+    params.occlusionCulling = options.occlusionCulling;
+    return params;
+}
+
+// True when pattern holds exactly one integer conversion for the frame
+// number (%d or %i, with optional flags, width and precision) and no other
+// conversion but %%. The pattern goes to snprintf as its format, so
+// anything else would read arguments that are not there, and a pattern
+// without the number would write every frame to the same file.
+static bool validOutputPattern(const std::string &pattern)
+{
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (pattern[i] != '%')
+            continue;
+        if (++i < pattern.size() && pattern[i] == '%')
+            continue;
+        while (i < pattern.size() && std::strchr("-+ #0", pattern[i]))
+            i++;
+        while (i < pattern.size() && std::isdigit((unsigned char)pattern[i]))
+            i++;
+        if (i < pattern.size() && pattern[i] == '.')
+            for (i++; i < pattern.size() && std::isdigit((unsigned char)pattern[i]); i++)
+                ;
+        if (i == pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i'))
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// pattern must have passed validOutputPattern
+static std::string frameFileName(const std::string &pattern, int f)
+{
+    std::vector<char> name(std::snprintf(nullptr, 0, pattern.c_str(), f) + 1);
+    std::snprintf(name.data(), name.size(), pattern.c_str(), f);
+    return name.data();
+}
+
+// Everything one thread needs to render frames on its own
+struct frameRenderer
+{
+    geometryStage geometry;
+    depthSorter sorter;
+    tiledRasterizer raster;
+    std::vector<triangle> tris;
+
+    void render(const mesh &m, const frameParams &params, framebuffer &fb)
+    {
+        // Every frame starts from scratch, whatever this thread drew before
+        geometry.forgetHistory();
+        tris.clear();
+        geometry.run(m, params, tris);
+        sorter.sort(tris);
+        raster.draw(fb, tris);
+    }
+};
+
+// Frames of the schedule, claimed one at a time by the threads, and the
+// first write error
+struct batchJob
+{
+    const batchOptions &options;
+    const mesh &m;
+    const std::vector<cameraKey> &keys;
+    mat4x4 matProj;
+
+    std::atomic<int> next;
+    std::atomic<bool> failed{ false };
+    std::mutex errorLock;
+    std::string error;
+
+    batchJob(const batchOptions &o, const mesh &mesh, const std::vector<cameraKey> &k, const mat4x4 &proj)
+        : options(o), m(mesh), keys(k), matProj(proj), next(o.first)
+    {
+    }
+
+    frameParams paramsAt(int f) const { return makeFrameParams(keyAt(keys, options.turntableDegrees, f), options, matProj); }
+
+    void fail(const std::string &message)
+    {
+        std::lock_guard<std::mutex> lk(errorLock);
+        if (!failed.exchange(true))
+            error = message;
+    }
+};
+
+static void renderToFiles(batchJob &job, unsigned threadCount)
+{
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&job]
+        {
+            frameRenderer renderer;
+            framebuffer fb;
+            fb.resize(job.options.width, job.options.height);
+            for (int f = job.next++; f <= job.options.last && !job.failed; f = job.next++)
+            {
+                renderer.render(job.m, job.paramsAt(f), fb);
+                std::string name = frameFileName(job.options.outputPattern, f);
+                if (!fb.saveToFile(name))
+                    job.fail("Could not write " + name);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+// Frames waiting to be written in order. Slot f % size holds frame f, a
+// thread only claims a frame once its slot is free again, and the writer
+// takes them oldest first.
+struct frameQueue
+{
+    struct slot
+    {
+        framebuffer fb;
+        bool ready = false;
+    };
+
+    std::vector<slot> slots;
+    std::mutex lock;
+    std::condition_variable written, rendered;
+    int oldest;     // not written yet
+};
+
+static void renderToPipe(batchJob &job, unsigned threadCount)
+{
+    frameQueue queue;
+    queue.slots.resize((size_t)threadCount * BATCH_FRAMES_AHEAD);
+    queue.oldest = job.options.first;
+    for (auto &s : queue.slots)
+        s.fb.resize(job.options.width, job.options.height);
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&job, &queue]
+        {
+            frameRenderer renderer;
+            for (int f = job.next++; f <= job.options.last; f = job.next++)
+            {
+                frameQueue::slot &s = queue.slots[(size_t)(f - job.options.first) % queue.slots.size()];
+                {
+                    std::unique_lock<std::mutex> lk(queue.lock);
+                    queue.written.wait(lk, [&] { return job.failed || f < queue.oldest + (int)queue.slots.size(); });
+                }
+                if (job.failed)
+                    return;
+
+                renderer.render(job.m, job.paramsAt(f), s.fb);
+                {
+                    std::lock_guard<std::mutex> lk(queue.lock);
+                    s.ready = true;
+                }
+                queue.rendered.notify_all();
+            }
+        });
+    }
+
+    // This thread writes, frame by frame in order
+    for (int f = job.options.first; f <= job.options.last; f++)
+    {
+        frameQueue::slot &s = queue.slots[(size_t)(f - job.options.first) % queue.slots.size()];
+        {
+            std::unique_lock<std::mutex> lk(queue.lock);
+            queue.rendered.wait(lk, [&] { return s.ready; });
+        }
+
+        size_t bytes = (size_t)s.fb.width * s.fb.height * 4;
+        if (std::fwrite(s.fb.pixels(), 1, bytes, stdout) != bytes || std::fflush(stdout) != 0)
+        {
+            job.fail("Could not write frame " + std::to_string(f) + " to stdout");
+            queue.written.notify_all();
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(queue.lock);
+            s.ready = false;
+            queue.oldest = f + 1;
+        }
+        queue.written.notify_all();
+    }
+
+    for (auto &t : threads)
+        t.join();
+}
+
+static bool parseRange(const char *text, int &first, int &last)
+{
+    return std::sscanf(text, "%d:%d", &first, &last) == 2 && first >= 0 && first <= last;
+}
+
+static bool parseSize(const char *text, unsigned &width, unsigned &height)
+{
+    return std::sscanf(text, "%ux%u", &width, &height) == 2 && width > 0 && height > 0;
+}
+
+int main(int argc, char **argv)
+{
+    batchOptions options;
+    bool usage = false;
+
+    for (int i = 1; i < argc && !usage; i++)
+    {
+        if (std::strcmp(argv[i], "--mesh") == 0 && i + 1 < argc)
+            options.meshFile = argv[++i];
+        else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            usage = !parseSize(argv[++i], options.width, options.height);
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            usage = !parseRange(argv[++i], options.first, options.last);
+        else if (std::strcmp(argv[i], "--turntable") == 0 && i + 1 < argc)
+            options.turntableDegrees = (float)std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+            options.pathFile = argv[++i];
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            options.outputPattern = argv[++i];
+        else if (std::strcmp(argv[i], "--raw") == 0)
+            options.raw = true;
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            usage = !parseCount(argv[++i], MAX_BATCH_THREADS, options.threadCount);
+            if (usage)
+                std::cerr << "--threads takes 0 (one per hardware thread) to " << MAX_BATCH_THREADS << ", got \""
+                          << argv[i] << "\"" << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+            options.lodErrorPixels = (float)std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--occlusion") == 0)
+            options.occlusionCulling = true;
+        else
+            usage = true;
+    }
+    if (usage)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--mesh <file>] [--size <w>x<h>] [--frames <first>:<last>]"
+                  << " [--turntable <degrees per frame>] [--path <file>] [--output <pattern> | --raw]"
+                  << " [--threads <n>] [--lod-error <px>] [--occlusion]" << std::endl;
+        return 1;
+    }
+
+    if (!options.raw && !validOutputPattern(options.outputPattern))
+    {
+        std::cerr << "--output needs exactly one %d for the frame number (and %% for a literal %), got \""
+                  << options.outputPattern << "\"" << std::endl;
+        return 1;
+    }
+
+    std::string error;
+    std::vector<cameraKey> keys;
+    if (!options.pathFile.empty() && !loadPath(options.pathFile, keys, error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    mesh m;
+    if (!m.load(options.meshFile, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    unsigned threadCount = options.threadCount ? options.threadCount : std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, (unsigned)(options.last - options.first + 1));
+    mat4x4 matProj = makeProjectionMatrix(90.0f, (float)options.height / (float)options.width, NEAR_PLANE, FAR_PLANE);
+    batchJob job(options, m, keys, matProj);
+
+    auto start = std::chrono::steady_clock::now();
+    if (options.raw)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        renderToPipe(job, threadCount);
+    }
+    else
+    {
+        renderToFiles(job, threadCount);
+    }
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+    if (job.failed)
+    {
+        std::cerr << job.error << std::endl;
+        return 1;
+    }
+
+    int frames = options.last - options.first + 1;
+    std::cerr << frames << " frames in " << took.count() << " s on " << threadCount << " threads, "
+              << frames / took.count() << " frames/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,837 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/command_line.hpp"
+#include "../include/depth_sort.hpp"
+#include "../include/frame_pipeline.hpp"
+#include "../include/geometry.hpp"
+#include "../include/mesh.hpp"
+#include "../include/pipeline.hpp"
+#include "../include/profiler.hpp"
+#include "../include/rasterizer.hpp"
+#include "../include/resolution.hpp"
+#include "../include/scene.hpp"
+#include "../include/terrain_stream.hpp"
+#include "../include/thread_pool.hpp"
+#include "bench_scenes.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define BENCH_TSC 1
+#define BENCH_TARGET_FMA __attribute__((target("fma")))
+#endif
+// Headless benchmarks for the render pipeline.
+//
+//   graph_bench pipeline [--threads <n>] [--frames <n>] [--assets <dir>] [--latency <n>] [--occlusion]
+//   graph_bench raster [--threads <n>] [--frames <n>] [--assets <dir>]
+//   graph_bench occlusion [--threads <n>] [--frames <n>] [--assets <dir>]
+//   graph_bench scene [--threads <n>] [--frames <n>] [--assets <dir>]
+//   graph_bench stream [--threads <n>] [--frames <n>]
+//   graph_bench sort [--threads <n>]
+//   graph_bench math
+//   graph_bench resolution [--threads <n>] [--frames <n>]
+//
+// pipeline loads every OBJ in the assets directory (default "assets") plus
+// two generated terrains of about 130k and 1M triangles, then renders each
+// one through the software path for a fixed number of frames along a
+// scripted camera path, with no window and no frame limit. The report is
+// JSON on stdout: load time, per stage and whole frame times (mean, p50,
+// p99, max), triangles per second and triangle counts. The camera path
+// and meshes are fixed, so the triangle counts only change when the
+// pipeline's output does. A short summary goes to stderr. With --latency
+// the geometry runs through a framePipeline on a second pool of its own,
+// that many frames ahead, like graph does; stage times then overlap and
+// frame times are what is left over. --occlusion turns occlusion
+// culling on.
+//
+// raster draws the triangles of every mesh along the camera path, plus a
+// set of random ones from slivers to guard band sized, and times the
+// block rasterizer and the one pixel at a time reference on them, both
+// single threaded. GRAPH_RASTER_KERNEL picks the kernel to time.
+//
+// occlusion renders every mesh along the camera path, and along a second
+// one walking through it at mid height, with and without occlusion
+// culling. It reports the share of triangles occluded and the time from
+// geometry through raster both ways.
+//
+// scene scatters 1k, 4k and 16k instances of monkey.obj from the assets
+// directory over the smaller generated terrain and draws them along the
+// orbit camera path through a sceneStage on the pool. It reports the
+// visible instances and drawn triangles per frame, the stage time, and
+// the bytes the scene and the stage's scratch hold next to what copies of
+// the mesh per instance would.
+//
+// stream splits the larger generated terrain into 16x16 tiles in a
+// temporary directory and flies low across it, looking where it goes,
+// streaming the tiles under a budget of a quarter of the tile set, one
+// frame every 16.7 ms at most. It reports the slowest update (the render
+// thread's whole share of streaming), loads, evictions and resident tiles
+// per frame.
+//
+// sort compares the old comparator based std::sort of the painter's path
+// against depthSorter, single threaded and on the pool, for 10k, 100k
+// and 1M random triangles. Times are the best of several runs.
+//
+// math times one world transform of 64k random points per vertex: the
+// 4x4 product called out of line as geometry.cpp used to have it, the
+// same inlined, the affine transformPoint and its mulAdd chain, and that
+// chain with hardware FMA where the CPU has it. It reports nanoseconds
+// and, on x86-64, time stamp counter cycles per vertex.
+//
+// resolution renders the smaller generated terrain along the orbit path
+// at full size and at a quarter of it to time both, then again with a
+// resolutionController given a budget halfway between the two. It reports
+// the render sizes, frame times and the share of frames over budget.
+//
+// The pass/fail checks of these paths are graph_tests, run by ctest.
+
+static std::vector<triangle> randomTriangles(size_t count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+
+    std::vector<triangle> tris(count);
+    for (auto &t : tris)
+        for (auto &p : t.p)
+            p.z = depth(rng);
+    return tris;
+}
+
+template <typename F>
+static double bestMilliseconds(int runs, const std::vector<triangle> &input, F &&fn)
+{
+    double best = 1e30;
+    std::vector<triangle> tris;
+    for (int r = 0; r < runs; r++)
+    {
+        tris = input;
+        auto start = benchClock::now();
+        fn(tris);
+        std::chrono::duration<double, std::milli> took = benchClock::now() - start;
+        best = std::min(best, took.count());
+    }
+    return best;
+}
+
+static int benchSort(threadPool &pool)
+{
+    depthSorter serial, parallel;
+    parallel.pool = &pool;
+
+    std::cout << "triangles   std::sort ms   radix ms   radix x" << pool.size() << " ms" << std::endl;
+    for (size_t count : { (size_t)10000, (size_t)100000, (size_t)1000000 })
+    {
+        std::vector<triangle> input = randomTriangles(count, 1234);
+        int runs = count >= 1000000 ? 5 : 20;
+
+        double comparator = bestMilliseconds(runs, input, [](std::vector<triangle> &tris)
+        {
+            std::sort(tris.begin(), tris.end(), [](triangle &t1, triangle &t2){
+                float z1 = (t1.p[0].z + t1.p[1].z + t1.p[2].z) / 3.0f;
+                float z2 = (t2.p[0].z + t2.p[1].z + t2.p[2].z) / 3.0f;
+                return z1 > z2;
+            });
+        });
+        double radix = bestMilliseconds(runs, input, [&](std::vector<triangle> &tris) { serial.sort(tris); });
+        double radixPool = bestMilliseconds(runs, input, [&](std::vector<triangle> &tris) { parallel.sort(tris); });
+
+        std::cout << count << "\t\t" << comparator << "\t\t" << radix << "\t\t" << radixPool << std::endl;
+    }
+    return 0;
+}
+
+const int WARMUP_FRAMES = 5;
+
+// Milliseconds for every measured frame of one stage
+struct stageSamples
+{
+    const char *name;
+    std::vector<double> ms;
+};
+
+// Nearest rank percentile of already sorted samples
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) return 0.0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+static void writeSummary(std::ostream &out, const std::vector<double> &samples)
+{
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (double s : sorted) sum += s;
+
+    out << "{ \"mean\": " << (sorted.empty() ? 0.0 : sum / sorted.size())
+        << ", \"p50\": " << percentile(sorted, 50.0)
+        << ", \"p99\": " << percentile(sorted, 99.0)
+        << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << " }";
+}
+
+// The 4x4 product as geometry.cpp compiled it before the math moved into
+// vecmath.hpp: out of line, through references. Called through a volatile
+// pointer so the compiler cannot inline it back.
+static vec3d outOfLineMulMatrixByVector(const mat4x4 &m, const vec3d &i)
+{
+    return mulMatrixByVector(m, i);
+}
+static vec3d (*volatile outOfLineTransform)(const mat4x4 &, const vec3d &) = outOfLineMulMatrixByVector;
+
+#ifdef BENCH_TARGET_FMA
+// transformPointFused as it compiles where GRAPH_MATH_FMA is on
+BENCH_TARGET_FMA static void transformPointsFMA(const affineMatrix &a, const vec3d *in, vec3d *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const vec3d &p = in[i];
+        out[i] = {
+            std::fma(p.x, a.m[0][0], std::fma(p.y, a.m[1][0], std::fma(p.z, a.m[2][0], a.m[3][0]))),
+            std::fma(p.x, a.m[0][1], std::fma(p.y, a.m[1][1], std::fma(p.z, a.m[2][1], a.m[3][1]))),
+            std::fma(p.x, a.m[0][2], std::fma(p.y, a.m[1][2], std::fma(p.z, a.m[2][2], a.m[3][2]))),
+            1.0f
+        };
+    }
+}
+#endif
+
+static uint64_t cycleCounter()
+{
+#ifdef BENCH_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Best nanoseconds and cycles per vertex of fn over several runs
+template <typename F>
+static void bestPerVertex(size_t count, F &&fn, double &ns, double &cycles)
+{
+    ns = cycles = 1e30;
+    for (int r = 0; r < 50; r++)
+    {
+        auto start = benchClock::now();
+        uint64_t startCycles = cycleCounter();
+        fn();
+        uint64_t took = cycleCounter() - startCycles;
+        std::chrono::duration<double, std::nano> elapsed = benchClock::now() - start;
+        ns = std::min(ns, elapsed.count() / count);
+        cycles = std::min(cycles, (double)took / count);
+    }
+}
+
+static int benchMath()
+{
+    const size_t count = 1 << 16;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+    std::vector<vec3d> in(count), out(count);
+    for (vec3d &v : in)
+        v = { coord(rng), coord(rng), coord(rng) };
+
+    // A world matrix like graph's: rotations then a translation
+    mat4x4 matWorld = mulMatrices(mulMatrices(makeRotatedMatrixZ(0.7f), makeRotatedMatrixX(0.35f)),
+                                  makeTranslatedMatrix(0.0f, 0.0f, 2.0f));
+    affineMatrix affine = toAffine(matWorld);
+
+    auto report = [&](const char *name, double ns, double cycles)
+    {
+        std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << ns;
+#ifdef BENCH_TSC
+        std::cout << std::setw(12) << std::setprecision(2) << cycles;
+#endif
+        std::cout << std::endl;
+    };
+
+    std::cout << std::left << std::setw(20) << "transform" << std::right << std::setw(10) << "ns/vert";
+#ifdef BENCH_TSC
+    std::cout << std::setw(12) << "cycles/vert";
+#endif
+    std::cout << std::endl;
+
+    double ns, cycles;
+    bestPerVertex(count, [&]
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = outOfLineTransform(matWorld, in[i]);
+    }, ns, cycles);
+    report("4x4 out of line", ns, cycles);
+
+    bestPerVertex(count, [&]
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = mulMatrixByVector(matWorld, in[i]);
+    }, ns, cycles);
+    report("4x4 inline", ns, cycles);
+
+    bestPerVertex(count, [&]
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = transformPoint(affine, in[i]);
+    }, ns, cycles);
+    report("affine", ns, cycles);
+
+#ifdef BENCH_TARGET_FMA
+    if (cpuHasAVX2())
+    {
+        bestPerVertex(count, [&] { transformPointsFMA(affine, in.data(), out.data(), count); }, ns, cycles);
+        report("affine fma", ns, cycles);
+    }
+#endif
+    bestPerVertex(count, [&]
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = transformPointFused(affine, in[i]);
+    }, ns, cycles);
+    report(GRAPH_MATH_FMA ? "affine mulAdd (fma)" : "affine mulAdd", ns, cycles);
+    return 0;
+}
+
+static void benchMeshFrames(std::ostream &json, const benchMesh &bm, int frames, threadPool &pool,
+                            threadPool *geometryPool, unsigned latency, bool occlusion)
+{
+    geometryStage geometry;
+    depthSorter sorter;
+    tiledRasterizer raster;
+    geometry.pool = sorter.pool = raster.pool = &pool;
+
+    framebuffer fb;
+    fb.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    mat4x4 matProj = benchProjection();
+
+    stageSamples stages[] = { { "cull", {} }, { "transform", {} }, { "occlusion", {} }, { "clip", {} }, { "sort", {} },
+                              { "raster", {} } };
+    std::vector<double> frameMs;
+    uint64_t drawnTotal = 0, testedTotal = 0, occludedTotal = 0;
+    std::vector<triangle> serialTris;
+    auto camera = [&](int f)
+    {
+        frameParams params = benchCamera(bm.m, f, frames, matProj);
+        params.occlusionCulling = occlusion;
+        return params;
+    };
+
+    std::unique_ptr<framePipeline> pipeline;
+    if (latency > 0)
+    {
+        geometry.pool = geometryPool;
+        pipeline.reset(new framePipeline(geometry, latency));
+        for (unsigned i = 0; i < latency; i++)
+            pipeline->submit(bm.m, camera(0));
+    }
+
+    for (int f = -WARMUP_FRAMES; f < frames; f++)
+    {
+        std::vector<triangle> *tris = &serialTris;
+        stageTimes times;
+        cullStats cull;
+
+        auto frameStart = benchClock::now();
+        if (pipeline)
+        {
+            framePipeline::frame &done = pipeline->take();
+            pipeline->submit(bm.m, camera(std::max(f + (int)latency, 0)));
+            tris = &done.triangles;
+            times = done.times;
+            cull = done.cull;
+        }
+        else
+        {
+            serialTris.clear();
+            geometry.run(bm.m, camera(std::max(f, 0)), serialTris);
+            times = geometry.timeCounters;
+            cull = geometry.cullCounters;
+        }
+        auto sortStart = benchClock::now();
+        sorter.sort(*tris);
+        auto rasterStart = benchClock::now();
+        raster.draw(fb, *tris);
+        double total = millisecondsSince(frameStart);
+
+        if (f < 0)
+            continue;
+        stages[0].ms.push_back(times.cull);
+        stages[1].ms.push_back(times.transform);
+        stages[2].ms.push_back(times.occlusion);
+        stages[3].ms.push_back(times.clip);
+        stages[4].ms.push_back(std::chrono::duration<double, std::milli>(rasterStart - sortStart).count());
+        stages[5].ms.push_back(millisecondsSince(rasterStart));
+        frameMs.push_back(total);
+        drawnTotal += cull.trianglesDrawn;
+        testedTotal += cull.trianglesTested;
+        occludedTotal += cull.trianglesOccluded;
+    }
+
+    double seconds = 0.0;
+    for (double ms : frameMs) seconds += ms / 1000.0;
+    double meshTrianglesPerSecond = seconds > 0.0 ? (double)bm.m.triangleCount() * frames / seconds : 0.0;
+    double drawnPerSecond = seconds > 0.0 ? (double)drawnTotal / seconds : 0.0;
+
+    json << "    {\n"
+         << "      \"name\": \"" << bm.name << "\",\n"
+         << "      \"vertices\": " << bm.m.verts.size() << ",\n"
+         << "      \"triangles\": " << bm.m.triangleCount() << ",\n"
+         << "      \"load_ms\": " << bm.loadMilliseconds << ",\n"
+         << "      \"stages_ms\": {\n";
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++)
+    {
+        json << "        \"" << stages[s].name << "\": ";
+        writeSummary(json, stages[s].ms);
+        json << (s + 1 < sizeof(stages) / sizeof(stages[0]) ? ",\n" : "\n");
+    }
+    json << "      },\n"
+         << "      \"frame_ms\": ";
+    writeSummary(json, frameMs);
+    json << ",\n"
+         << "      \"mesh_triangles_per_second\": " << meshTrianglesPerSecond << ",\n"
+         << "      \"drawn_triangles_per_second\": " << drawnPerSecond << ",\n"
+         << "      \"triangles_occluded\": " << occludedTotal << ",\n"
+         << "      \"triangles_tested\": " << testedTotal << ",\n"
+         << "      \"triangles_drawn\": " << drawnTotal << "\n"
+         << "    }";
+
+    std::vector<double> sorted = frameMs;
+    std::sort(sorted.begin(), sorted.end());
+    std::cerr << bm.name << ": " << bm.m.triangleCount() << " triangles, load " << bm.loadMilliseconds
+              << " ms, frame p50 " << percentile(sorted, 50.0) << " ms, p99 " << percentile(sorted, 99.0)
+              << " ms" << std::endl;
+}
+
+static int benchPipeline(threadPool &pool, threadPool *geometryPool, unsigned latency, bool occlusion, int frames,
+                         const std::string &assetDir)
+{
+    std::vector<benchMesh> meshes;
+    if (!loadBenchMeshes(assetDir, meshes))
+        return 1;
+
+    std::ostream &json = std::cout;
+    json << std::fixed << std::setprecision(4);
+    json << "{\n"
+         << "  \"threads\": " << pool.size() << ",\n"
+         << "  \"frames\": " << frames << ",\n"
+         << "  \"latency\": " << latency << ",\n"
+         << "  \"occlusion\": " << (occlusion ? "true" : "false") << ",\n"
+         << "  \"width\": " << BENCH_WIDTH << ",\n"
+         << "  \"height\": " << BENCH_HEIGHT << ",\n"
+         << "  \"vertex_kernels\": \"" << vertexKernelName() << "\",\n"
+         << "  \"meshes\": [\n";
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        benchMeshFrames(json, meshes[i], frames, pool, geometryPool, latency, occlusion);
+        json << (i + 1 < meshes.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n"
+         << "}" << std::endl;
+    return 0;
+}
+
+// Adds the single threaded times of both rasterizers on one frame's
+// triangles to blockMs and referenceMs
+static void timeRasterFrame(const std::vector<triangle> &tris, framebuffer &fb, double &blockMs, double &referenceMs)
+{
+    pixelRect screen = { 0, 0, (int)BENCH_WIDTH - 1, (int)BENCH_HEIGHT - 1 };
+
+    fb.clear();
+    auto start = benchClock::now();
+    for (const auto &t : tris)
+        rasterizeTriangleReference(fb, t, screen);
+    referenceMs += millisecondsSince(start);
+
+    fb.clear();
+    start = benchClock::now();
+    for (const auto &t : tris)
+        rasterizeTriangle(fb, t, screen);
+    blockMs += millisecondsSince(start);
+}
+
+static int benchRaster(threadPool &pool, int frames, const std::string &assetDir)
+{
+    std::vector<benchMesh> meshes;
+    if (!loadBenchMeshes(assetDir, meshes))
+        return 1;
+
+    framebuffer fb;
+    fb.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    mat4x4 matProj = benchProjection();
+
+    std::cout << "kernel " << rasterKernelName() << std::endl;
+    std::cout << "mesh               block ms   reference ms" << std::endl;
+    auto report = [&](const std::string &name, double blockMs, double referenceMs)
+    {
+        std::cout << std::left << std::setw(18) << name << std::right << " " << std::setw(9) << blockMs
+                  << "  " << std::setw(13) << referenceMs << std::endl;
+    };
+
+    for (const auto &bm : meshes)
+    {
+        geometryStage geometry;
+        geometry.pool = &pool;
+        std::vector<triangle> tris;
+        double blockMs = 0.0, referenceMs = 0.0;
+        for (int f = 0; f < frames; f++)
+        {
+            tris.clear();
+            geometry.run(bm.m, benchCamera(bm.m, f, frames, matProj), tris);
+            timeRasterFrame(tris, fb, blockMs, referenceMs);
+        }
+        report(bm.name, blockMs, referenceMs);
+    }
+
+    double blockMs = 0.0, referenceMs = 0.0;
+    for (unsigned seed = 1; seed <= 20; seed++)
+        timeRasterFrame(randomScreenTriangles(200, seed), fb, blockMs, referenceMs);
+    report("random", blockMs, referenceMs);
+    return 0;
+}
+
+static int benchOcclusion(threadPool &pool, int frames, const std::string &assetDir)
+{
+    std::vector<benchMesh> meshes;
+    if (!loadBenchMeshes(assetDir, meshes))
+        return 1;
+
+    framebuffer fb;
+    fb.resize(BENCH_WIDTH, BENCH_HEIGHT);
+    mat4x4 matProj = benchProjection();
+    depthSorter sorter;
+    tiledRasterizer raster;
+    sorter.pool = raster.pool = &pool;
+
+    std::cout << "mesh               path     occluded %   culled ms   full ms" << std::endl;
+    using cameraPath = frameParams (*)(const mesh &, int, int, const mat4x4 &);
+    const struct { const char *name; cameraPath camera; } paths[] = { { "orbit", benchCamera }, { "valley", valleyCamera } };
+    for (const auto &bm : meshes)
+    {
+        for (const auto &path : paths)
+        {
+            // One stage each, LOD levels carry over from frame to frame
+            geometryStage withOcclusion, without;
+            withOcclusion.pool = without.pool = &pool;
+            std::vector<triangle> tris;
+            uint64_t occluded = 0, tested = 0;
+            double culledMs = 0.0, fullMs = 0.0;
+
+            auto render = [&](geometryStage &geometry, bool occlusion, int f)
+            {
+                frameParams params = path.camera(bm.m, f, frames, matProj);
+                params.occlusionCulling = occlusion;
+                auto start = benchClock::now();
+                tris.clear();
+                geometry.run(bm.m, params, tris);
+                sorter.sort(tris);
+                raster.draw(fb, tris);
+                return millisecondsSince(start);
+            };
+
+            for (int f = 0; f < frames; f++)
+            {
+                culledMs += render(withOcclusion, true, f);
+                fullMs += render(without, false, f);
+                occluded += withOcclusion.cullCounters.trianglesOccluded;
+                tested += without.cullCounters.trianglesTested;
+            }
+
+            std::cout << std::left << std::setw(18) << bm.name << " " << std::setw(6) << path.name << std::right << " " << std::setw(12)
+                      << (tested ? 100.0 * occluded / tested : 0.0) << "  " << std::setw(10) << culledMs / frames
+                      << "  " << std::setw(8) << fullMs / frames << std::endl;
+        }
+    }
+    return 0;
+}
+
+static int benchScene(threadPool &pool, int frames, const std::string &assetDir)
+{
+    benchMesh prop, ground;
+    std::string error;
+    if (!prop.m.load(assetDir + "/monkey.obj", &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (!syntheticTerrain(ground, 256, 400.0f))
+        return 1;
+
+    mat4x4 matProj = benchProjection();
+    size_t meshBytes = prop.m.verts.size() * 3 * sizeof(float) + prop.m.indices.size() * sizeof(uint32_t) +
+                       prop.m.faceNormals.size() * sizeof(vec3d);
+
+    std::cout << "instances   visible   triangles        ms   scene KiB   scratch KiB   copies KiB" << std::endl;
+    for (unsigned count : { 1000u, 4000u, 16000u })
+    {
+        scene props;
+        scatterInstances(props, ground.m, prop.m, count, count);
+
+        sceneStage threaded;
+        threaded.pool = &pool;
+        std::vector<triangle> tris;
+        uint64_t visible = 0, drawn = 0;
+        double ms = 0.0;
+        for (int f = 0; f < frames; f++)
+        {
+            frameParams params = benchCamera(ground.m, f, frames, matProj);
+            auto start = benchClock::now();
+            tris.clear();
+            threaded.run(props, params, tris);
+            ms += millisecondsSince(start);
+            visible += threaded.counters.instancesTested - threaded.counters.instancesCulled;
+            drawn += threaded.counters.trianglesDrawn;
+        }
+
+        std::cout << std::setw(9) << count << std::setw(10) << visible / frames << std::setw(12) << drawn / frames
+                  << std::setw(10) << std::fixed << std::setprecision(3) << ms / frames
+                  << std::setw(12) << props.bytes() / 1024 << std::setw(14) << threaded.scratchBytes() / 1024
+                  << std::setw(13) << count * meshBytes / 1024 << std::endl;
+    }
+    return 0;
+}
+
+static int benchStream(threadPool &pool, int frames)
+{
+    namespace fs = std::filesystem;
+    benchMesh ground;
+    if (!syntheticTerrain(ground, 724, 400.0f))
+        return 1;
+
+    std::string dir = (fs::temp_directory_path() / "graph_bench_tiles").string();
+    std::string error;
+    auto start = benchClock::now();
+    if (!writeTerrainTiles(ground.m, 16, dir, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    double splitMs = millisecondsSince(start);
+
+    std::vector<terrainTileInfo> tiles;
+    uint64_t totalBytes = 0;
+    if (!readTerrainManifest(dir, tiles, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    for (const terrainTileInfo &t : tiles)
+        totalBytes += t.bytes;
+
+    terrainStreamer terrain;
+    terrain.pool = &pool;
+    terrain.budgetBytes = totalBytes / 4;
+    if (!terrain.open(dir, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    mat4x4 matProj = benchProjection();
+    std::vector<triangle> tris;
+    double updateMaxMs = 0.0, updateTotalMs = 0.0, geometryMs = 0.0;
+    uint64_t residentSum = 0, maxBytes = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        vec3d look;
+        frameParams params = flyoverCamera(ground.m, f, frames, matProj, look);
+
+        auto frameStart = benchClock::now();
+        start = frameStart;
+        terrain.update(params.cameraPos, look);
+        double ms = millisecondsSince(start);
+        updateMaxMs = std::max(updateMaxMs, ms);
+        updateTotalMs += ms;
+
+        start = benchClock::now();
+        tris.clear();
+        terrain.run(params, tris);
+        geometryMs += millisecondsSince(start);
+
+        residentSum += terrain.counters.resident;
+        maxBytes = std::max(maxBytes, terrain.counters.residentBytes);
+
+        // Paced like a 60 Hz render loop, which gives the I/O thread its time
+        std::this_thread::sleep_until(frameStart + std::chrono::microseconds(16667));
+    }
+
+    const terrainStreamStats &c = terrain.counters;
+    std::cout << std::fixed << std::setprecision(3)
+              << "tiles: " << tiles.size() << " (" << totalBytes / 1024 << " KiB), split in " << splitMs << " ms" << std::endl
+              << "budget: " << terrain.budgetBytes / 1024 << " KiB, most resident " << maxBytes / 1024 << " KiB" << std::endl
+              << "update: " << updateTotalMs / frames << " ms mean, " << updateMaxMs << " ms max" << std::endl
+              << "geometry: " << geometryMs / frames << " ms per frame" << std::endl
+              << "loads: " << c.loadsFinished << " finished, " << c.loadsFailed << " failed, " << c.evictions
+              << " evictions, " << (double)residentSum / frames << " tiles resident per frame" << std::endl;
+
+    terrain.close();
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    return 0;
+}
+
+static int benchResolution(threadPool &pool, int frames)
+{
+    benchMesh ground;
+    if (!syntheticTerrain(ground, 256, 400.0f))
+        return 1;
+
+    mat4x4 matProj = benchProjection();
+    geometryStage geometry;
+    tiledRasterizer raster;
+    geometry.pool = raster.pool = &pool;
+    framebuffer fb;
+    std::vector<triangle> tris;
+
+    // Geometry and raster of frame f at the controller's size, like graph
+    auto render = [&](int f, const resolutionController &r)
+    {
+        frameParams params = benchCamera(ground.m, f, frames, matProj);
+        params.vp = { (float)r.width(), (float)r.height() };
+        auto start = benchClock::now();
+        if (fb.width != r.width() || fb.height != r.height())
+            fb.resize(r.width(), r.height());
+        tris.clear();
+        geometry.run(ground.m, params, tris);
+        raster.draw(fb, tris);
+        return millisecondsSince(start);
+    };
+
+    // Mean frame time at a fixed scale, after a pass that warms up the
+    // LOD levels and scratch buffers
+    auto meanMs = [&](float scale)
+    {
+        resolutionController fixed;
+        fixed.minScale = scale;
+        fixed.setOutputSize(BENCH_WIDTH, BENCH_HEIGHT);
+        fixed.setScale(scale);
+        double ms = 0.0;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            ms = 0.0;
+            for (int f = 0; f < frames; f++)
+                ms += render(f, fixed);
+        }
+        return ms / frames;
+    };
+    const float minScale = 0.25f;
+    double fullMs = meanMs(1.0f), smallMs = meanMs(minScale);
+
+    // Halfway between the two, which some scale in between can make
+    resolutionController controller;
+    controller.targetMs = (float)(0.5 * (fullMs + smallMs));
+    controller.minScale = minScale;
+    controller.setOutputSize(BENCH_WIDTH, BENCH_HEIGHT);
+    double settledMs = 0.0, settledScale = 0.0;
+    unsigned minWidth = BENCH_WIDTH, changes = 0, overBudget = 0, settled = 0;
+    for (int f = 0; f < frames; f++)
+    {
+        double ms = render(f, controller);
+        if (f >= frames / 2)
+        {
+            settledMs += ms;
+            settledScale += controller.scale();
+            overBudget += ms > controller.targetMs;
+            settled++;
+        }
+        changes += controller.update((float)ms);
+        minWidth = std::min(minWidth, controller.width());
+    }
+    settledMs /= settled;
+    settledScale /= settled;
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "full size: " << BENCH_WIDTH << "x" << BENCH_HEIGHT << ", " << fullMs << " ms per frame, "
+              << smallMs << " ms at scale " << minScale << std::endl
+              << "budget: " << controller.targetMs << " ms, " << changes << " size changes, smallest width " << minWidth << std::endl
+              << "second half: scale " << settledScale << ", " << settledMs << " ms per frame, "
+              << 100.0 * overBudget / settled << "% of frames over budget, ending at "
+              << controller.width() << "x" << controller.height() << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *mode = nullptr;
+    unsigned threadCount = 0;
+    int frames = 200;
+    std::string assetDir = "assets";
+    unsigned latency = 0;
+    bool occlusion = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[++i], MAX_POOL_THREADS, threadCount))
+            {
+                std::cerr << "--threads takes 0 (one per hardware thread) to " << MAX_POOL_THREADS << ", got \""
+                          << argv[i] << "\"" << std::endl;
+                mode = "";
+                break;
+            }
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--assets") == 0 && i + 1 < argc)
+            assetDir = argv[++i];
+        else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+        {
+            if (!parseCount(argv[++i], MAX_PIPELINE_LATENCY, latency))
+            {
+                std::cerr << "--latency takes 0 to " << MAX_PIPELINE_LATENCY << " frames, got \"" << argv[i] << "\""
+                          << std::endl;
+                mode = "";
+                break;
+            }
+        }
+        else if (std::strcmp(argv[i], "--occlusion") == 0)
+            occlusion = true;
+        else if (!mode)
+            mode = argv[i];
+        else
+            mode = "";
+    }
+
+    threadPool pool(threadCount);
+
+    if (mode && std::strcmp(mode, "pipeline") == 0)
+    {
+        // Pipelined geometry needs a pool of its own, sized like the first
+        std::unique_ptr<threadPool> geometryPool;
+        if (latency > 0)
+            geometryPool.reset(new threadPool(threadCount));
+        return benchPipeline(pool, geometryPool.get(), latency, occlusion, frames, assetDir);
+    }
+    if (mode && std::strcmp(mode, "raster") == 0)
+        return benchRaster(pool, frames, assetDir);
+    if (mode && std::strcmp(mode, "occlusion") == 0)
+        return benchOcclusion(pool, frames, assetDir);
+    if (mode && std::strcmp(mode, "scene") == 0)
+        return benchScene(pool, frames, assetDir);
+    if (mode && std::strcmp(mode, "stream") == 0)
+        return benchStream(pool, frames);
+    if (mode && std::strcmp(mode, "sort") == 0)
+        return benchSort(pool);
+    if (mode && std::strcmp(mode, "math") == 0)
+        return benchMath();
+    if (mode && std::strcmp(mode, "resolution") == 0)
+        return benchResolution(pool, frames);
+
+    std::cerr << "Usage: " << argv[0] << " pipeline [--threads <n>] [--frames <n>] [--assets <dir>] [--latency <n>] [--occlusion]" << std::endl
+              << "       " << argv[0] << " raster [--threads <n>] [--frames <n>] [--assets <dir>]" << std::endl
+              << "       " << argv[0] << " occlusion [--threads <n>] [--frames <n>] [--assets <dir>]" << std::endl
+              << "       " << argv[0] << " scene [--threads <n>] [--frames <n>] [--assets <dir>]" << std::endl
+              << "       " << argv[0] << " stream [--threads <n>] [--frames <n>]" << std::endl
+              << "       " << argv[0] << " sort [--threads <n>]" << std::endl
+              << "       " << argv[0] << " math" << std::endl
+              << "       " << argv[0] << " resolution [--threads <n>] [--frames <n>]" << std::endl;
+    return 1;
+}
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include "bench_scenes.hpp"
+
+double millisecondsSince(benchClock::time_point start)
+{
+    std::chrono::duration<double, std::milli> took = benchClock::now() - start;
+    return took.count();
+}
+
+mat4x4 benchProjection()
+{
+    return makeProjectionMatrix(90.0f, (float)BENCH_HEIGHT / (float)BENCH_WIDTH, 0.1f, 1000.0f);
+}
+
+bool syntheticTerrain(benchMesh &out, int cells, float size)
+{
+    std::vector<float> x, y, z;
+    std::vector<uint32_t> indices;
+    int side = cells + 1;
+    x.reserve((size_t)side * side);
+    y.reserve((size_t)side * side);
+    z.reserve((size_t)side * side);
+    indices.reserve((size_t)cells * cells * 6);
+
+    for (int j = 0; j < side; j++)
+    {
+        for (int i = 0; i < side; i++)
+        {
+            float u = (float)i / cells, v = (float)j / cells;
+            x.push_back((u - 0.5f) * size);
+            z.push_back((v - 0.5f) * size);
+            y.push_back(size * (0.05f * std::sin(u * 7.0f) * std::cos(v * 5.0f)
+                              + 0.02f * std::sin(u * 23.0f + v * 17.0f)
+                              + 0.005f * std::cos(u * 71.0f - v * 53.0f)));
+        }
+    }
+
+    // Wound clockwise seen from above, so the top faces the camera
+    for (int j = 0; j < cells; j++)
+    {
+        for (int i = 0; i < cells; i++)
+        {
+            uint32_t a = (uint32_t)(j * side + i), b = a + 1, c = a + side, d = c + 1;
+            indices.insert(indices.end(), { a, c, b, b, c, d });
+        }
+    }
+
+    out.name = "terrain_" + std::to_string(cells) + "x" + std::to_string(cells);
+    auto start = benchClock::now();
+    std::string error;
+    bool ok = out.m.loadFromArrays(std::move(x), std::move(y), std::move(z), std::move(indices), &error);
+    out.loadMilliseconds = millisecondsSince(start);
+    if (!ok)
+        std::cerr << out.name << ": " << error << std::endl;
+    return ok;
+}
+
+bool loadBenchMeshes(const std::string &assetDir, std::vector<benchMesh> &meshes)
+{
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(assetDir, ec))
+        if (entry.path().extension() == ".obj")
+            files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    if (ec || files.empty())
+    {
+        std::cerr << "No OBJ files in " << assetDir << std::endl;
+        return false;
+    }
+
+    // Load times include the binary cache when there is a fresh one, like graph
+    for (const auto &file : files)
+    {
+        benchMesh bm;
+        bm.name = fs::path(file).stem().string();
+        std::string error;
+        auto start = benchClock::now();
+        if (!bm.m.load(file, &error))
+        {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        bm.loadMilliseconds = millisecondsSince(start);
+        meshes.push_back(std::move(bm));
+    }
+    for (int cells : { 256, 724 })
+    {
+        benchMesh bm;
+        if (!syntheticTerrain(bm, cells, 400.0f))
+            return false;
+        meshes.push_back(std::move(bm));
+    }
+    return true;
+}
+
+// View and projection looking from eye at target, at the bench's size
+static frameParams cameraParams(const vec3d &eye, const vec3d &target, const mat4x4 &matProj)
+{
+    vec3d up = { 0, 1, 0 };
+    mat4x4 matCamera = pointAt(eye, target, up);
+
+    frameParams params;
+    params.matWorld = makeIdentityMatrix();
+    params.matView = quickInverse(matCamera);
+    params.matProj = matProj;
+    params.cameraPos = eye;
+    params.vp = { (float)BENCH_WIDTH, (float)BENCH_HEIGHT };
+    return params;
+}
+
+frameParams benchCamera(const mesh &m, int f, int frames, const mat4x4 &matProj)
+{
+    vec3d lo = m.boundsMin, hi = m.boundsMax;
+    vec3d extent = subVectors(hi, lo);
+    vec3d center = addVectors(lo, hi);
+    center = mulVector(center, 0.5f);
+    float radius = std::max(0.5f * lenVector(extent), 1e-3f);
+
+    float t = (float)f / frames;
+    float angle = 6.2831853f * t;
+    float swing = std::sin(3.14159265f * t);
+    float distance = radius * (1.6f - 1.0f * swing * swing);
+
+    vec3d eye = {
+        center.x + distance * std::cos(angle),
+        center.y + radius * (0.2f + 0.3f * swing),
+        center.z + distance * std::sin(angle)
+    };
+    return cameraParams(eye, center, matProj);
+}
+
+frameParams valleyCamera(const mesh &m, int f, int frames, const mat4x4 &matProj)
+{
+    vec3d lo = m.boundsMin, hi = m.boundsMax;
+    float t = (float)f / frames;
+    float angle = 6.2831853f * t;
+
+    vec3d eye = {
+        lo.x + (hi.x - lo.x) * (0.3f + 0.4f * t),
+        lo.y + (hi.y - lo.y) * 0.6f,
+        lo.z + (hi.z - lo.z) * 0.5f
+    };
+    vec3d target = { eye.x + std::cos(angle), eye.y - 0.15f, eye.z + std::sin(angle) };
+    return cameraParams(eye, target, matProj);
+}
+
+frameParams flyoverCamera(const mesh &m, int f, int frames, const mat4x4 &matProj, vec3d &lookDir)
+{
+    vec3d lo = m.boundsMin, hi = m.boundsMax;
+    float t = (float)f / frames;
+    vec3d eye = {
+        lo.x + (hi.x - lo.x) * (0.1f + 0.8f * t),
+        lo.y + (hi.y - lo.y) * 0.7f,
+        lo.z + (hi.z - lo.z) * (0.5f + 0.3f * std::sin(6.2831853f * t))
+    };
+    lookDir = { 0.8f, 0.0f, 0.3f * 6.2831853f * std::cos(6.2831853f * t), 0.0f };
+    vec3d target = addVectors(eye, lookDir);
+    target.y -= 0.2f;
+    return cameraParams(eye, target, matProj);
+}
+
+void scatterInstances(scene &s, const mesh &ground, const mesh &prop, unsigned count, unsigned seed)
+{
+    uint32_t asset = s.addAsset(prop);
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> vertex(0, ground.verts.size() - 1);
+    std::uniform_real_distribution<float> yaw(0.0f, 6.2831853f), scale(0.5f, 1.5f);
+    for (unsigned i = 0; i < count; i++)
+    {
+        vec3d v = ground.verts.get(vertex(rng));
+        float sc = scale(rng);
+        const float position[3] = { v.x, v.y - sc * prop.boundsMin.y, v.z };
+        s.addInstance(asset, position, yaw(rng), sc);
+    }
+}
+
+std::vector<triangle> randomScreenTriangles(size_t count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float w = (float)BENCH_WIDTH, h = (float)BENCH_HEIGHT;
+
+    std::vector<triangle> tris;
+    while (tris.size() < count)
+    {
+        float size = std::pow(2.0f, 1.0f + 11.0f * unit(rng));
+        float cx = (unit(rng) * 1.5f - 0.25f) * w, cy = (unit(rng) * 1.5f - 0.25f) * h;
+        vec3d p[4];
+        for (auto &v : p)
+            v = { cx + (unit(rng) - 0.5f) * size, cy + (unit(rng) - 0.5f) * size, unit(rng), 1.0f };
+        sf::Color color((sf::Uint8)(rng() & 255), (sf::Uint8)(rng() & 255), (sf::Uint8)(rng() & 255));
+
+        // Two triangles across the shared edge p1 p2
+        tris.push_back({ { p[0], p[1], p[2] }, color });
+        color.r ^= 0x80;
+        tris.push_back({ { p[2], p[1], p[3] }, color });
+    }
+    return tris;
+}
+
+bool sameFramebuffer(const framebuffer &a, const framebuffer &b, size_t &mismatches)
+{
+    mismatches = 0;
+    for (size_t i = 0; i < a.color.size(); i++)
+        if (a.color[i] != b.color[i] || std::memcmp(&a.depth[i], &b.depth[i], sizeof(float)) != 0)
+            mismatches++;
+    return mismatches == 0;
+}
+
+bool sameTriangles(const std::vector<triangle> &a, const std::vector<triangle> &b)
+{
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(triangle)) == 0);
+}
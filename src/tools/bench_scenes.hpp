@@ -0,0 +1,66 @@
+#ifndef BENCH_SCENES_H
+#define BENCH_SCENES_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../include/mesh.hpp"
+#include "../include/pipeline.hpp"
+#include "../include/rasterizer.hpp"
+#include "../include/scene.hpp"
+
+// Meshes, camera paths and comparisons graph_bench and graph_tests share
+
+using benchClock = std::chrono::steady_clock;
+
+// Same target and projection as graph
+const unsigned BENCH_WIDTH = 920;
+const unsigned BENCH_HEIGHT = 640;
+
+struct benchMesh
+{
+    std::string name;
+    mesh m;
+    double loadMilliseconds;
+};
+
+extern double millisecondsSince(benchClock::time_point start);
+
+extern mat4x4 benchProjection();
+
+// Rolling hills of cells x cells quads, size units across, from a few
+// fixed sine waves so every run gets the same mesh
+extern bool syntheticTerrain(benchMesh &out, int cells, float size);
+
+// Every OBJ in assetDir, then generated terrains of about 130k and 1M
+// triangles
+extern bool loadBenchMeshes(const std::string &assetDir, std::vector<benchMesh> &meshes);
+
+// Camera for frame f of frames: one orbit around the mesh, swinging in
+// from well outside its bounds to inside them and back out, looking at
+// the center the whole time
+extern frameParams benchCamera(const mesh &m, int f, int frames, const mat4x4 &matProj);
+
+// Walks across the middle of the mesh a little above half its height,
+// looking around and slightly down, for views into valleys
+extern frameParams valleyCamera(const mesh &m, int f, int frames, const mat4x4 &matProj);
+
+// Flies low and diagonally across the mesh, weaving from side to side and
+// looking where it goes. lookDir takes the direction for a terrainStreamer.
+extern frameParams flyoverCamera(const mesh &m, int f, int frames, const mat4x4 &matProj, vec3d &lookDir);
+
+// count copies of prop standing on random vertices of ground, turned and
+// sized at random but the same for every seed
+extern void scatterInstances(scene &s, const mesh &ground, const mesh &prop, unsigned count, unsigned seed);
+
+// Screen space triangles from a few pixels up to well past the screen,
+// in pairs sharing an edge the way mesh triangles do
+extern std::vector<triangle> randomScreenTriangles(size_t count, unsigned seed);
+
+// Color and depth equal bit for bit, mismatches counts the pixels that
+// are not
+extern bool sameFramebuffer(const framebuffer &a, const framebuffer &b, size_t &mismatches);
+
+extern bool sameTriangles(const std::vector<triangle> &a, const std::vector<triangle> &b);
+
+#endif
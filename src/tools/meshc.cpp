@@ -0,0 +1,58 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "../include/command_line.hpp"
+#include "../include/mesh.hpp"
+#include "../include/terrain_stream.hpp"
+
+// Offline converter from Wavefront OBJ to the binary mesh cache that
+// mesh::load picks up automatically when it is newer than the OBJ, or to
+// a set of terrain tiles for streaming.
+//
+//   graph_meshc <input.obj> [output.gmesh]
+//   graph_meshc --tiles <n> <input.obj> <directory>
+int main(int argc, char **argv)
+{
+    bool tiled = argc == 5 && std::strcmp(argv[1], "--tiles") == 0;
+    if (!tiled && (argc < 2 || argc > 3))
+    {
+        std::cerr << "Usage: " << argv[0] << " <input.obj> [output.gmesh]" << std::endl
+                  << "       " << argv[0] << " --tiles <n> <input.obj> <directory>" << std::endl;
+        return 1;
+    }
+
+    std::string error;
+    mesh m;
+    if (tiled)
+    {
+        unsigned tilesPerSide;
+        if (!parseCount(argv[2], MAX_TERRAIN_TILES_PER_SIDE, tilesPerSide) || tilesPerSide == 0)
+        {
+            std::cerr << "--tiles takes 1 to " << MAX_TERRAIN_TILES_PER_SIDE << " tiles per side, got \"" << argv[2] << "\""
+                      << std::endl;
+            return 1;
+        }
+        std::string input = argv[3], output = argv[4];
+        if (!m.loadFromObjFile(input, &error) || !writeTerrainTiles(m, (int)tilesPerSide, output, &error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        std::cout << output << ": " << tilesPerSide << "x" << tilesPerSide << " tiles of "
+                  << m.triangleCount() << " triangles" << std::endl;
+        return 0;
+    }
+
+    std::string input = argv[1];
+    std::string output = argc == 3 ? argv[2] : mesh::cacheFileName(input);
+
+    if (!m.loadFromObjFile(input, &error) || !m.saveToCacheFile(output, &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    std::cout << output << ": " << m.verts.size() << " vertices, "
+              << m.triangleCount() << " triangles" << std::endl;
+    return 0;
+}